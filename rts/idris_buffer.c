@@ -0,0 +1,206 @@
+#include "idris_buffer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+VAL idris_newBuffer(VM* vm, i_int size) {
+    if (size < 0) {
+        size = 0;
+    }
+    Closure* cl = allocate(sizeof(Closure) + size, 0);
+    SETTY(cl, CT_RAWDATA);
+    cl->info.size = size;
+    return cl;
+}
+
+i_int idris_getBufferSize(VAL buf) {
+    return BUFFER_SIZE(buf);
+}
+
+// How many of the 'len' bytes at 'loc' are in the buffer. If 'loc' itself
+// is not, it is moved to the start, so that it is safe to add to the
+// buffer's address.
+static i_int in_range(VAL buf, i_int* loc, i_int len) {
+    i_int size = BUFFER_SIZE(buf);
+    if (*loc < 0 || *loc > size) {
+        *loc = 0;
+        return 0;
+    }
+    if (len <= 0) {
+        return 0;
+    }
+    return len < size - *loc ? len : size - *loc;
+}
+
+// Compilers turn these into a load or store, and a byte swap if needed
+static inline uint64_t load(const uint8_t* p, int n, int big) {
+    uint64_t val = 0;
+    int i;
+    if (big) {
+        for(i = 0; i < n; ++i) {
+            val = (val << 8) | p[i];
+        }
+    } else {
+        for(i = n - 1; i >= 0; --i) {
+            val = (val << 8) | p[i];
+        }
+    }
+    return val;
+}
+
+static inline void store(uint8_t* p, int n, uint64_t val, int big) {
+    int i;
+    for(i = 0; i < n; ++i) {
+        p[big ? n - 1 - i : i] = (uint8_t)val;
+        val >>= 8;
+    }
+}
+
+uint8_t idris_getBufferByte(VAL buf, i_int loc) {
+    return in_range(buf, &loc, 1) == 1 ? BUFFER_DATA(buf)[loc] : 0;
+}
+
+void idris_setBufferByte(VAL buf, i_int loc, uint8_t byte) {
+    if (in_range(buf, &loc, 1) == 1) {
+        BUFFER_DATA(buf)[loc] = byte;
+    }
+}
+
+uint16_t idris_getBufferBits16(VAL buf, i_int loc, int big) {
+    return in_range(buf, &loc, 2) == 2 ? load(BUFFER_DATA(buf) + loc, 2, big)
+                                      : 0;
+}
+
+uint32_t idris_getBufferBits32(VAL buf, i_int loc, int big) {
+    return in_range(buf, &loc, 4) == 4 ? load(BUFFER_DATA(buf) + loc, 4, big)
+                                      : 0;
+}
+
+uint64_t idris_getBufferBits64(VAL buf, i_int loc, int big) {
+    return in_range(buf, &loc, 8) == 8 ? load(BUFFER_DATA(buf) + loc, 8, big)
+                                      : 0;
+}
+
+double idris_getBufferDouble(VAL buf, i_int loc, int big) {
+    uint64_t bits = idris_getBufferBits64(buf, loc, big);
+    double val;
+    memcpy(&val, &bits, sizeof(double));
+    return val;
+}
+
+void idris_setBufferBits16(VAL buf, i_int loc, uint16_t val, int big) {
+    if (in_range(buf, &loc, 2) == 2) {
+        store(BUFFER_DATA(buf) + loc, 2, val, big);
+    }
+}
+
+void idris_setBufferBits32(VAL buf, i_int loc, uint32_t val, int big) {
+    if (in_range(buf, &loc, 4) == 4) {
+        store(BUFFER_DATA(buf) + loc, 4, val, big);
+    }
+}
+
+void idris_setBufferBits64(VAL buf, i_int loc, uint64_t val, int big) {
+    if (in_range(buf, &loc, 8) == 8) {
+        store(BUFFER_DATA(buf) + loc, 8, val, big);
+    }
+}
+
+void idris_setBufferDouble(VAL buf, i_int loc, double val, int big) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(double));
+    idris_setBufferBits64(buf, loc, bits, big);
+}
+
+VAL idris_getBufferString(VM* vm, VAL buf, i_int loc, i_int len) {
+    i_int n = in_range(buf, &loc, len);
+    Closure* cl;
+    // Allocating the string may collect, and move buf
+    if (vm->valstack_top < vm->stack_max) {
+        *(vm->valstack_top++) = buf;
+        cl = allocStr(vm, n + 1, 0);
+        buf = *(--vm->valstack_top);
+        memcpy(cl->info.str, BUFFER_DATA(buf) + loc, n);
+    } else {
+        char* tmp = malloc(n + 1);
+        if (tmp == NULL) {
+            fprintf(stderr, "RTS ERROR: Unable to copy buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(tmp, BUFFER_DATA(buf) + loc, n);
+        cl = allocStr(vm, n + 1, 0);
+        memcpy(cl->info.str, tmp, n);
+        free(tmp);
+    }
+    cl->info.str[n] = '\0';
+    STRHEADER(cl)->len = n;
+    return cl;
+}
+
+i_int idris_setBufferString(VAL buf, i_int loc, VAL str) {
+    char* s = GETSTR(str); // this never collects, so buf stays put
+    i_int n = in_range(buf, &loc, idris_strbytes(str));
+    memcpy(BUFFER_DATA(buf) + loc, s, n);
+    return n;
+}
+
+i_int idris_copyBuffer(VAL from, i_int start, i_int len, VAL to, i_int loc) {
+    i_int n = in_range(from, &start, len);
+    n = in_range(to, &loc, n);
+    memmove(BUFFER_DATA(to) + loc, BUFFER_DATA(from) + start, n);
+    return n;
+}
+
+void idris_fillBuffer(VAL buf, i_int loc, i_int len, uint8_t byte) {
+    i_int n = in_range(buf, &loc, len);
+    memset(BUFFER_DATA(buf) + loc, byte, n);
+}
+
+int idris_compareBuffer(VAL l, i_int lloc, VAL r, i_int rloc, i_int len) {
+    i_int ln = in_range(l, &lloc, len);
+    i_int rn = in_range(r, &rloc, len);
+    int cmp = memcmp(BUFFER_DATA(l) + lloc, BUFFER_DATA(r) + rloc,
+                     ln < rn ? ln : rn);
+    if (cmp == 0) {
+        cmp = ln < rn ? -1 : ln > rn;
+    }
+    return cmp;
+}
+
+i_int idris_findBufferByte(VAL buf, i_int loc, uint8_t byte) {
+    i_int n = in_range(buf, &loc, BUFFER_SIZE(buf));
+    uint8_t* p = memchr(BUFFER_DATA(buf) + loc, byte, n);
+    return p == NULL ? -1 : p - BUFFER_DATA(buf);
+}
+
+i_int idris_readBufferFd(int fd, VAL buf, i_int loc, i_int len) {
+    i_int n = in_range(buf, &loc, len);
+    return read(fd, BUFFER_DATA(buf) + loc, n);
+}
+
+i_int idris_readBufferFile(void* h, VAL buf, i_int loc, i_int len) {
+    FILE* f = (FILE*)h;
+    i_int n = in_range(buf, &loc, len);
+    size_t got = fread(BUFFER_DATA(buf) + loc, 1, n, f);
+    return got == 0 && ferror(f) ? -1 : (i_int)got;
+}
+
+i_int idris_writeBufferFd(int fd, VAL buf, i_int loc, i_int len) {
+    i_int n = in_range(buf, &loc, len);
+    return write(fd, BUFFER_DATA(buf) + loc, n);
+}
+
+i_int idris_writeBufferFile(void* h, VAL buf, i_int loc, i_int len) {
+    FILE* f = (FILE*)h;
+    i_int n = in_range(buf, &loc, len);
+    size_t put = fwrite(BUFFER_DATA(buf) + loc, 1, n, f);
+    return put < (size_t)n && ferror(f) ? -1 : (i_int)put;
+}
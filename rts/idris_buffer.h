@@ -0,0 +1,59 @@
+#ifndef _IDRIS_BUFFER_H
+#define _IDRIS_BUFFER_H
+
+#include "idris_rts.h"
+
+/* *** Buffers ***
+ * A Buffer is a mutable block of bytes in the Idris heap: a CT_RAWDATA
+ * object, with the bytes following the Closure. It holds no pointers, so
+ * it can be written whichever generation it is in. Collections may move
+ * it, so a pointer into it must not be kept across an allocation.
+ *
+ * Every access is checked against the buffer's size: reads out of range
+ * give 0, and writes out of range do nothing.
+ */
+
+#define BUFFER_DATA(x) ((uint8_t*)(x) + sizeof(Closure))
+#define BUFFER_SIZE(x) ((i_int)((x)->info.size))
+
+// A new buffer of 'size' bytes, all 0
+VAL idris_newBuffer(VM* vm, i_int size);
+i_int idris_getBufferSize(VAL buf);
+
+uint8_t idris_getBufferByte(VAL buf, i_int loc);
+void idris_setBufferByte(VAL buf, i_int loc, uint8_t byte);
+
+// Multi byte values are little endian unless 'big' is nonzero
+uint16_t idris_getBufferBits16(VAL buf, i_int loc, int big);
+uint32_t idris_getBufferBits32(VAL buf, i_int loc, int big);
+uint64_t idris_getBufferBits64(VAL buf, i_int loc, int big);
+double idris_getBufferDouble(VAL buf, i_int loc, int big);
+void idris_setBufferBits16(VAL buf, i_int loc, uint16_t val, int big);
+void idris_setBufferBits32(VAL buf, i_int loc, uint32_t val, int big);
+void idris_setBufferBits64(VAL buf, i_int loc, uint64_t val, int big);
+void idris_setBufferDouble(VAL buf, i_int loc, double val, int big);
+
+// A string of the 'len' bytes at 'loc', cut short at the end of the buffer
+VAL idris_getBufferString(VM* vm, VAL buf, i_int loc, i_int len);
+// Copy the bytes of str to 'loc', as many as fit. Returns how many did.
+i_int idris_setBufferString(VAL buf, i_int loc, VAL str);
+
+// Copy 'len' bytes at 'start' in 'from' to 'loc' in 'to' (which may be the
+// same buffer, overlapping), as many as are in range. Returns how many.
+i_int idris_copyBuffer(VAL from, i_int start, i_int len, VAL to, i_int loc);
+void idris_fillBuffer(VAL buf, i_int loc, i_int len, uint8_t byte);
+// As memcmp, on the bytes in range
+int idris_compareBuffer(VAL l, i_int lloc, VAL r, i_int rloc, i_int len);
+// Where the next 'byte' at or after 'loc' is, or -1 if there is none
+i_int idris_findBufferByte(VAL buf, i_int loc, uint8_t byte);
+
+// Read up to 'len' bytes into the buffer at 'loc', with read(2) on a file
+// descriptor or fread on a handle. Return how many were read, or -1 with
+// errno set.
+i_int idris_readBufferFd(int fd, VAL buf, i_int loc, i_int len);
+i_int idris_readBufferFile(void* h, VAL buf, i_int loc, i_int len);
+// Write up to 'len' bytes from the buffer at 'loc', likewise
+i_int idris_writeBufferFd(int fd, VAL buf, i_int loc, i_int len);
+i_int idris_writeBufferFile(void* h, VAL buf, i_int loc, i_int len);
+
+#endif
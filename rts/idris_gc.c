@@ -1,14 +1,48 @@
 #include "idris_rts.h"
 #include "idris_gc.h"
+#include "idris_pargc.h"
 #include "idris_bitstring.h"
 #include <assert.h>
 
+size_t closure_size(VAL x) {
+    size_t size = sizeof(Closure);
+    switch(GETTY(x)) {
+    case CT_CON:
+        size += sizeof(VAL)*CARITY(x);
+        break;
+    case CT_STRING:
+        size += sizeof(StrHeader) + STRALLOC(x);
+        break;
+    case CT_STROFFSET:
+        size += sizeof(StrOffset);
+        break;
+    case CT_ROPE:
+        size += sizeof(Rope);
+        break;
+    case CT_MANAGEDPTR:
+        size += sizeof(ManagedPtr) + x->info.mptr->size;
+        break;
+    case CT_BIGINT: // the mpz_t and its limbs
+    case CT_RAWDATA:
+        size += x->info.size;
+        break;
+    default: // Everything else fits in the Closure itself
+        break;
+    }
+    // allocate rounds every request up to a multiple of 8
+    return (size + 7) & ~(size_t)7;
+}
+
 VAL copy(VM* vm, VAL x) {
     int ar;
     Closure* cl = NULL;
     if (x==NULL || ISINT(x)) {
         return x;
     }
+    if (HASFLAG(x, HEAP_SHARED)) {
+        shared_mark(&vm->shared, x);
+        return x;
+    }
     switch(GETTY(x)) {
     case CT_CON:
         ar = CARITY(x);
@@ -24,12 +58,24 @@ VAL copy(VM* vm, VAL x) {
         break;
     case CT_STRING:
         cl = MKSTRc(vm, x->info.str);
+        STRHEADER(cl)->chars = STRHEADER(x)->chars;
         break;
     case CT_STROFFSET:
         cl = MKSTROFFc(vm, x->info.str_offset);
         break;
+    case CT_ROPE:
+        if (x->info.rope->flat != NULL) {
+            // Only the characters survive
+            cl = copy(vm, x->info.rope->flat);
+        } else {
+            cl = allocate_uninit(sizeof(Closure) + sizeof(Rope), 0);
+            SETTY(cl, CT_ROPE);
+            cl->info.rope = (Rope*)((char*)cl + sizeof(Closure));
+            *(cl->info.rope) = *(x->info.rope);
+        }
+        break;
     case CT_BIGINT:
-        cl = MKBIGMc(vm, x->info.ptr);
+        cl = MKBIGMc(vm, &GETMPZ(x));
         break;
     case CT_PTR:
         cl = MKPTRc(vm, x->info.ptr);
@@ -37,12 +83,6 @@ VAL copy(VM* vm, VAL x) {
     case CT_MANAGEDPTR:
         cl = MKMPTRc(vm, x->info.mptr->data, x->info.mptr->size);
         break;
-    case CT_BITS8:
-        cl = idris_b8CopyForGC(vm, x);
-        break;
-    case CT_BITS16:
-        cl = idris_b16CopyForGC(vm, x);
-        break;
     case CT_BITS32:
         cl = idris_b32CopyForGC(vm, x);
         break;
@@ -54,8 +94,9 @@ VAL copy(VM* vm, VAL x) {
     case CT_RAWDATA:
         {
             size_t size = x->info.size + sizeof(Closure);
-            cl = allocate(size, 0);
+            cl = allocate_uninit(size, 0);
             memcpy(cl, x, size);
+            CLEARFLAG(cl, HEAP_REMEMBERED);
         }
         break;
     case CT_CDATA:
@@ -70,63 +111,311 @@ VAL copy(VM* vm, VAL x) {
     return cl;
 }
 
-void cheney(VM *vm) {
+// In a minor collection only nursery objects move; everything else
+// (the old generation, nullary constructors) is left where it is.
+static inline VAL evacuate(VM* vm, VAL x, int minor) {
+    if (minor && (x == NULL || ISINT(x) || !IN_NURSERY(&vm->heap, x))) {
+        return x;
+    }
+    return copy(vm, x);
+}
+
+static inline void scan_rope(VM* vm, Rope* r, int minor) {
+    r->left = evacuate(vm, r->left, minor);
+    r->right = evacuate(vm, r->right, minor);
+    r->flat = evacuate(vm, r->flat, minor);
+}
+
+// Strings at least this long, if only views of them survive, keep only the
+// parts in view
+#define TRIM_MIN 4096
+
+// In a full collection, put off copying the string a view is of until
+// everything else has been copied (see trim_views). Returns 0 if the
+// string is not worth trimming, so should be copied as usual.
+static int defer_view(VM* vm, VAL view) {
+    Heap* h = &vm->heap;
+    VAL str = view->info.str_offset->str;
+    if (GETTY(str) != CT_STRING || HASFLAG(str, HEAP_SHARED) ||
+        STRALLOC(str) < TRIM_MIN) {
+        return 0;
+    }
+    if (h->views_count == h->views_size) {
+        h->views_size = h->views_size == 0 ? 64 : h->views_size * 2;
+        h->views = realloc(h->views, h->views_size * sizeof(VAL));
+        if (h->views == NULL) {
+            fprintf(stderr, "RTS ERROR: Unable to grow view list.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    h->views[h->views_count++] = view;
+    return 1;
+}
+
+static int view_order(const void* x, const void* y) {
+    StrOffset* a = (*(VAL*)x)->info.str_offset;
+    StrOffset* b = (*(VAL*)y)->info.str_offset;
+    if (a->str != b->str) {
+        return a->str < b->str ? -1 : 1;
+    }
+    return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+static size_t piece_size(size_t start, size_t end) {
+    return ALIGN(sizeof(Closure) + sizeof(StrHeader) + end - start + 1, 8);
+}
+
+// Copy the parts of str which the views (sorted by offset) cover, one
+// piece for each run of overlapping views, and point the views at them.
+static void trim_string(VM* vm, VAL str, VAL* views, size_t n) {
+    int ascii = STRHEADER(str)->chars == STRHEADER(str)->len;
+    size_t i = 0;
+    while (i < n) {
+        StrOffset* first = views[i]->info.str_offset;
+        size_t start = first->offset;
+        size_t end = start + first->len;
+        size_t before = first->before;
+        size_t j, k;
+        for(j = i + 1; j < n && views[j]->info.str_offset->offset <= end; ++j) {
+            StrOffset* off = views[j]->info.str_offset;
+            if (off->offset + off->len > end) {
+                end = off->offset + off->len;
+            }
+        }
+
+        VAL piece = allocStr(vm, end - start + 1, 1);
+        memcpy(piece->info.str, str->info.str + start, end - start);
+        piece->info.str[end - start] = '\0';
+        STRHEADER(piece)->len = end - start;
+        if (ascii) {
+            STRHEADER(piece)->chars = end - start;
+        }
+
+        for(k = i; k < j; ++k) {
+            StrOffset* off = views[k]->info.str_offset;
+            if (ascii) {
+                off->before = off->offset - start;
+            } else if (off->before != STR_UNKNOWN && before != STR_UNKNOWN) {
+                off->before -= before;
+            } else {
+                off->before = STR_UNKNOWN;
+            }
+            off->offset -= start;
+            off->str = piece;
+        }
+        i = j;
+    }
+}
+
+// Copy the strings of the views put off by defer_view. A string which was
+// reached some other way has been copied already; one which was reached
+// only through views, and which they mostly do not cover, is trimmed.
+static void trim_views(VM* vm) {
+    Heap* h = &vm->heap;
+    VAL* views = h->views;
+    size_t n = h->views_count;
+    size_t i = 0;
+
+    if (n == 0) {
+        return;
+    }
+    qsort(views, n, sizeof(VAL), view_order);
+    while (i < n) {
+        VAL str = views[i]->info.str_offset->str;
+        size_t j, k;
+        for(j = i + 1; j < n && views[j]->info.str_offset->str == str; ++j);
+
+        if (GETTY(str) != CT_FWD) {
+            // Room for the pieces, which must fit in the room the whole
+            // string would have taken
+            StrOffset* first = views[i]->info.str_offset;
+            size_t start = first->offset;
+            size_t end = start + first->len;
+            size_t kept = 0;
+            idris_strbytes(str); // make sure the length is known
+            for(k = i + 1; k < j; ++k) {
+                StrOffset* off = views[k]->info.str_offset;
+                if (off->offset > end) {
+                    kept += piece_size(start, end);
+                    start = off->offset;
+                }
+                if (off->offset + off->len > end) {
+                    end = off->offset + off->len;
+                }
+            }
+            kept += piece_size(start, end);
+
+            if (kept * 2 <= closure_size(str)) {
+                trim_string(vm, str, views + i, j - i);
+                i = j;
+                continue;
+            }
+            copy(vm, str);
+        }
+        for(k = i; k < j; ++k) {
+            views[k]->info.str_offset->str = str->info.ptr;
+        }
+        i = j;
+    }
+    h->views_count = 0;
+}
+
+// Scan the to-space from 'scan' up to the allocation pointer, copying
+// everything the scanned objects refer to.
+void cheney(VM *vm, char* scan, int minor) {
     int i;
     int ar;
-    char* scan = vm->heap.heap;
 
     while(scan < vm->heap.next) {
-       size_t inc = *((size_t*)scan);
-       VAL heap_item = (VAL)(scan+sizeof(size_t));
+       VAL heap_item = (VAL)scan;
        // If it's a CT_CON or CT_STROFFSET, copy its arguments
        switch(GETTY(heap_item)) {
        case CT_CON:
            ar = ARITY(heap_item);
            for(i = 0; i < ar; ++i) {
-               VAL newptr = copy(vm, heap_item->info.c.args[i]);
+               VAL newptr = evacuate(vm, heap_item->info.c.args[i], minor);
                heap_item->info.c.args[i] = newptr;
            }
            break;
        case CT_STROFFSET:
-           heap_item->info.str_offset->str
-               = copy(vm, heap_item->info.str_offset->str);
+           if (minor || !defer_view(vm, heap_item)) {
+               heap_item->info.str_offset->str
+                   = evacuate(vm, heap_item->info.str_offset->str, minor);
+           }
+           break;
+       case CT_ROPE:
+           scan_rope(vm, heap_item->info.rope, minor);
            break;
        default: // Nothing to copy
            break;
        }
-       scan += inc;
+       scan += closure_size(heap_item);
     }
     assert(scan == vm->heap.next);
 }
 
-void idris_gc(VM* vm) {
-    HEAP_CHECK(vm)
-    STATS_ENTER_GC(vm->stats, vm->heap.size)
+static void copy_roots(VM* vm, int minor) {
+    VAL* root;
 
-    if (vm->heap.old != NULL)
-        free(vm->heap.old);
+    for(root = vm->valstack; root < vm->valstack_top; ++root) {
+        *root = evacuate(vm, *root, minor);
+    }
 
-    /* Allocate swap heap. */
-    alloc_heap(&vm->heap, vm->heap.size, vm->heap.growth, vm->heap.heap);
+    vm->ret = evacuate(vm, vm->ret, minor);
+    vm->reg1 = evacuate(vm, vm->reg1, minor);
+}
 
-    VAL* root;
+// The nursery half which is not in use. The half we are leaving stays
+// intact until the next collection, so pointers held across this one
+// remain readable, as with the old semispace.
+static char* other_nursery(Heap* h, char* current) {
+    return current == h->nursery ? h->nursery + h->nursery_size : h->nursery;
+}
 
-    for(root = vm->valstack; root < vm->valstack_top; ++root) {
-        *root = copy(vm, *root);
+static void reset_nursery(Heap* h, char* current) {
+    h->heap = other_nursery(h, current);
+    h->next = h->heap;
+    h->end  = h->heap + h->nursery_size;
+}
+
+static void idris_major_gc(VM* vm, size_t reserve) {
+    Heap* h = &vm->heap;
+    char* nursery = h->heap;
+    size_t young = h->next - h->heap;
+    // Strings flattened outside the heap are copied in too
+    size_t live = h->gen_next - h->gen_heap + vm->spill_size;
+
+    // Everything in both generations may survive, and leave a nursery's
+    // worth of space for the next minor collection to promote into.
+    size_t need = live + young + h->nursery_size + reserve;
+#ifdef HAS_PTHREAD
+    if (vm->gc_threads > 1) {
+        need += idris_par_slack(vm, live + young);
+    }
+#endif
+    size_t size = h->size;
+    if (size < need) {
+        size = need;
     }
 
+    flip_heap(h, h->gen_heap, h->gen_end - h->gen_heap, size);
+
 #ifdef HAS_PTHREAD
-    Msg* msg;
+    if (vm->gc_threads > 1) {
+        idris_par_copy(vm, h->old, h->old + h->old_size,
+                           nursery, nursery + h->nursery_size);
+    } else
+#endif
+    {
+        copy_roots(vm, 0);
+        cheney(vm, h->heap, 0);
+        trim_views(vm);
+    }
 
-    for(msg = vm->inbox; msg < vm->inbox_write; ++msg) {
-        msg->msg = copy(vm, msg->msg);
+    h->gen_heap = h->heap;
+    h->gen_next = h->next;
+    h->gen_end  = h->end;
+
+    if ((h->gen_next - h->gen_heap) > h->size >> 1) {
+        h->size += h->growth;
+    }
+
+    // Objects were copied with fresh headers, so nothing is remembered.
+    h->remembered_count = 0;
+
+    STATS_RELEASE(vm->stats, release_space(h->gen_next, h->gen_end, h->release))
+
+    reset_nursery(h, nursery);
+}
+
+void idris_gc_reserve(VM* vm, size_t reserve) {
+    reserve += 8; // allocation checks for strictly more room
+    HEAP_CHECK(vm)
+    STATS_ENTER_GC(vm->stats, vm->heap.size)
+
+    if (vm->heap.nursery_size > 0) {
+        idris_major_gc(vm, reserve);
+        c_heap_sweep(&vm->c_heap);
+        shared_sweep(&vm->shared);
+        idris_retire_spill(vm);
+
+        STATS_LEAVE_GC(vm->stats, vm->heap.size,
+                       vm->heap.gen_next - vm->heap.gen_heap)
+        HEAP_CHECK(vm)
+        return;
+    }
+
+    // Everything may survive, and there must still be room for the
+    // allocation which needed this collection. Otherwise it would have to
+    // collect again, and pointers from before the first collection (which
+    // C primitives may still hold) would no longer be readable.
+    // Strings flattened outside the heap are copied in too
+    size_t used = vm->heap.next - vm->heap.heap + vm->spill_size;
+    size_t need = used + reserve;
+#ifdef HAS_PTHREAD
+    if (vm->gc_threads > 1) {
+        need += idris_par_slack(vm, used);
     }
 #endif
+    size_t size = vm->heap.size;
+    if (size < need) {
+        size = need;
+    }
 
-    vm->ret = copy(vm, vm->ret);
-    vm->reg1 = copy(vm, vm->reg1);
+    /* Swap to the other semispace. */
+    flip_heap(&vm->heap, vm->heap.heap, vm->heap.end - vm->heap.heap, size);
 
-    cheney(vm);
+#ifdef HAS_PTHREAD
+    if (vm->gc_threads > 1) {
+        idris_par_copy(vm, vm->heap.old, vm->heap.old + vm->heap.old_size,
+                           NULL, NULL);
+    } else
+#endif
+    {
+        copy_roots(vm, 0);
+        cheney(vm, vm->heap.heap, 0);
+        trim_views(vm);
+    }
 
     // After reallocation, if we've still more than half filled the new heap, grow the heap
     // for next time.
@@ -135,19 +424,110 @@ void idris_gc(VM* vm) {
         vm->heap.size += vm->heap.growth;
     }
 
-    // finally, sweep the C heap
+    STATS_RELEASE(vm->stats, release_space(vm->heap.next, vm->heap.end,
+                                           vm->heap.release))
+
+    // finally, sweep the C heap and the shared regions
     c_heap_sweep(&vm->c_heap);
+    shared_sweep(&vm->shared);
+    idris_retire_spill(vm);
 
     STATS_LEAVE_GC(vm->stats, vm->heap.size, vm->heap.next - vm->heap.heap)
     HEAP_CHECK(vm)
 }
 
+void idris_gc(VM* vm) {
+    idris_gc_reserve(vm, 0);
+}
+
+void idris_retire_spill(VM* vm) {
+    StrSpill* s = vm->spill_retired;
+    while (s != NULL) {
+        StrSpill* next = s->next;
+        free(s);
+        s = next;
+    }
+    vm->spill_retired = vm->spill;
+    vm->spill = NULL;
+    vm->spill_size = 0;
+}
+
+void idris_minor_gc(VM* vm) {
+    Heap* h = &vm->heap;
+
+    if (h->nursery_size == 0) {
+        idris_gc(vm);
+        return;
+    }
+
+    char* nursery = h->heap;
+    size_t young = h->next - h->heap;
+
+    // If every young object might not fit in the old generation, collect
+    // both generations instead.
+    if (!(h->gen_next + young < h->gen_end)) {
+        idris_gc(vm);
+        return;
+    }
+
+    HEAP_CHECK(vm)
+    STATS_ENTER_GC(vm->stats, vm->heap.size)
+
+    // Promote into the old generation: allocation now happens there.
+    char* scan = h->gen_next;
+    h->heap = h->gen_heap;
+    h->next = h->gen_next;
+    h->end  = h->gen_end;
+
+    copy_roots(vm, 1);
+
+    size_t i;
+    for(i = 0; i < h->remembered_count; ++i) {
+        VAL x = h->remembered[i];
+        CLEARFLAG(x, HEAP_REMEMBERED);
+        if (GETTY(x) == CT_CON) {
+            int a, ar = CARITY(x);
+            for(a = 0; a < ar; ++a) {
+                x->info.c.args[a] = evacuate(vm, x->info.c.args[a], 1);
+            }
+        } else if (GETTY(x) == CT_ROPE) { // flattened since promotion
+            scan_rope(vm, x->info.rope, 1);
+        } else if (GETTY(x) == CT_STRING) { // indexed since promotion
+            STRHEADER(x)->index = NULL;
+        } else if (GETTY(x) == CT_STROFFSET) { // copied since promotion
+            x->info.str_offset->str = evacuate(vm, x->info.str_offset->str, 1);
+        }
+    }
+    h->remembered_count = 0;
+
+    cheney(vm, scan, 1);
+
+    h->gen_next = h->next;
+    reset_nursery(h, nursery);
+
+    // The C heap is only swept after a major collection, since old objects
+    // are not scanned here and so their CData are not marked.
+
+    STATS_LEAVE_GC(vm->stats, vm->heap.size, h->gen_next - scan)
+    HEAP_CHECK(vm)
+}
+
 void idris_gcInfo(VM* vm, int doGC) {
     printf("Stack: <BOT %p> <TOP %p>\n", vm->valstack, vm->valstack_top);
     printf("Final heap size         %zd\n", vm->heap.size);
-    printf("Final heap use          %zd\n", vm->heap.next - vm->heap.heap);
-    if (doGC) { idris_gc(vm); }
-    printf("Final heap use after GC %zd\n", vm->heap.next - vm->heap.heap);
+    if (vm->heap.nursery_size > 0) {
+        printf("Nursery size            %zd\n", vm->heap.nursery_size);
+        printf("Final nursery use       %zd\n", vm->heap.next - vm->heap.heap);
+        printf("Final old gen use       %zd\n",
+               vm->heap.gen_next - vm->heap.gen_heap);
+        if (doGC) { idris_gc(vm); }
+        printf("Final heap use after GC %zd\n",
+               vm->heap.gen_next - vm->heap.gen_heap);
+    } else {
+        printf("Final heap use          %zd\n", vm->heap.next - vm->heap.heap);
+        if (doGC) { idris_gc(vm); }
+        printf("Final heap use after GC %zd\n", vm->heap.next - vm->heap.heap);
+    }
 #ifdef IDRIS_ENABLE_STATS
     printf("Total allocations       %" PRIu64 "\n", vm->stats.allocations);
 #endif
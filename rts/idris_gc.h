@@ -4,6 +4,19 @@
 #include "idris_rts.h"
 
 void idris_gc(VM* vm);
+// Collect, leaving room to allocate at least 'reserve' bytes without
+// another collection (in the old generation, if the heap is generational)
+void idris_gc_reserve(VM* vm, size_t reserve);
+// Collect only the nursery if the heap is generational, otherwise the
+// same as idris_gc.
+void idris_minor_gc(VM* vm);
+// Size of a heap object, as allocated, worked out from its type and
+// contents (objects have no size header)
+size_t closure_size(VAL x);
+// Free the ropes flattened outside the heap before the previous full
+// collection, and hold back the others until the next one. Called after
+// every full collection.
+void idris_retire_spill(VM* vm);
 void idris_gcInfo(VM* vm, int doGC);
 
 #endif
@@ -4,269 +4,805 @@
 #else
 #include "mini-gmp.h"
 #endif
+#include <ctype.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
-// TMP HACK! Require this much space in the heap before a GMP operation
-// so it doesn't garbage collect in the middle.
-// This is highly dodgy and needs to be done better because who knows if
-// GMP will need to allocate more than 64k... better to work out how
-// much space is needed (or find another way of preventing copying)
-#define IDRIS_MAXGMP 65536
+// Integers are small (tagged, like Int) when they fit in all but the tag
+// bit of an i_int, so 63 bits on 64-bit machines, and only become GMP
+// integers when they don't. Results which fit are made small again.
+#define IDRIS_SMALL_MAX (INTPTR_MAX >> 1)
+#define IDRIS_SMALL_MIN (INTPTR_MIN >> 1)
+
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define HAS_OVERFLOW_BUILTINS
+#endif
+
+#define LIMB_BITS (sizeof(mp_limb_t) * 8)
+
+// Limbs needed for the value of a long, or of a small Integer
+#define LONG_LIMBS ((sizeof(long) + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t))
+#define SMALL_LIMBS ((sizeof(i_int) + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t))
+
+// Bytes which GMP may allocate through idris_alloc while it works on
+// operands of n limbs in all, for those operations (such as division)
+// which build their results in temporaries: a few objects of at most n + 2
+// limbs each, and a copy of the result. Additions and multiplications
+// work on the limbs directly and need none of this.
+#define GMP_SCRATCH(n) (5 * BIGSIZE((n) + 2))
+
+#ifdef IDRIS_GMP
+// GMP's own multiplication may need temporaries for large operands
+#define MUL_SCRATCH(n) GMP_SCRATCH(n)
+#else
+#define MUL_SCRATCH(n) 0
+#endif
 
 void init_gmpalloc() {
     mp_set_memory_functions(idris_alloc, idris_realloc, idris_free);
 }
 
-VAL MKBIGI(int val) {
-    return MKINT((i_int)val);
+// A small Integer as an mpz_t on the C stack, so that it can be passed to
+// GMP without allocating
+typedef struct {
+    mpz_t z;
+    mp_limb_t limbs[SMALL_LIMBS];
+} SmallMPZ;
+
+static mpz_srcptr small_mpz(SmallMPZ* s, i_int val) {
+    uintptr_t mag = val < 0 ? -(uintptr_t)val : (uintptr_t)val;
+    int n = 0;
+    while (mag != 0) {
+        s->limbs[n++] = (mp_limb_t)mag;
+        // In two steps, since a limb may be as wide as mag
+        mag = (mag >> (LIMB_BITS / 2)) >> (LIMB_BITS / 2);
+    }
+    s->z->_mp_alloc = SMALL_LIMBS;
+    s->z->_mp_size = val < 0 ? -n : n;
+    s->z->_mp_d = s->limbs;
+    return s->z;
 }
 
-VAL MKBIGC(VM* vm, char* val) {
-    idris_requireAlloc(IDRIS_MAXGMP);
-    mpz_t* bigint;
-    
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    
-    mpz_init(*bigint);
-    mpz_set_str(*bigint, val, 10);
+// The mpz_t of any Integer, using 's' for a small one
+static mpz_srcptr to_mpz(VAL x, SmallMPZ* s) {
+    return ISINT(x) ? small_mpz(s, GETINT(x)) : GETMPZ(x);
+}
+
+static size_t limbs_of(VAL x) {
+    return ISINT(x) ? SMALL_LIMBS : mpz_size(GETMPZ(x));
+}
 
+// Make sure that 'size' bytes can be allocated without collecting. The n
+// values in 'vals' are kept on the stack meanwhile, since a collection
+// moves them, and updated.
+static void big_reserve(VM* vm, size_t size, VAL* vals, int n) {
+    if (vm->valstack_top + n <= vm->stack_max) {
+        memcpy(vm->valstack_top, vals, n * sizeof(VAL));
+        vm->valstack_top += n;
+        idris_requireAlloc(size);
+        vm->valstack_top -= n;
+        memcpy(vals, vm->valstack_top, n * sizeof(VAL));
+    } else {
+        idris_requireAlloc(size);
+    }
+}
+
+// Make cl, which has room for 'limbs' limbs, an Integer of value zero
+static VAL big_init(VAL cl, size_t limbs) {
     SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
+    cl->info.size = BIGSIZE(limbs) - sizeof(Closure);
+    mpz_ptr big = GETMPZ(cl);
+    big->_mp_alloc = limbs;
+    big->_mp_size = 0;
+    big->_mp_d = BIGLIMBS(cl);
+    return cl;
+}
 
+// A new Integer, zero, with room for 'limbs' limbs
+static VAL big_new(size_t limbs, int outerlock) {
+    if (limbs == 0) {
+        limbs = 1;
+    }
+    return big_init(allocate_uninit(BIGSIZE(limbs), outerlock), limbs);
+}
+
+// A copy of a GMP integer, with room for just its limbs
+static VAL big_copy(mpz_srcptr big, int outerlock) {
+    size_t n = mpz_size(big);
+    VAL cl = big_new(n, outerlock);
+    memcpy(BIGLIMBS(cl), big->_mp_d, n * sizeof(mp_limb_t));
+    GETMPZ(cl)->_mp_size = big->_mp_size;
     return cl;
 }
 
-VAL MKBIGM(VM* vm, void* big) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+// The value of a GMP integer as a small Integer, if it fits
+static VAL demote(VAL cl) {
+    mpz_srcptr big = GETMPZ(cl);
+    if (mpz_fits_slong_p(big)) {
+        long val = mpz_get_si(big);
+        if (val >= IDRIS_SMALL_MIN && val <= IDRIS_SMALL_MAX) {
+            return MKINT((i_int)val);
+        }
+    }
+    return cl;
+}
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
+// GMP grows a result in idris_alloc'd memory if it runs out of room, and
+// some operations build the result in a temporary and swap it in, so
+// the limbs may have left the Integer. If so, copy them into a new one.
+static VAL big_settle(VAL cl) {
+    mpz_srcptr big = GETMPZ(cl);
+    if (big->_mp_d != BIGLIMBS(cl)) {
+        cl = big_copy(big, 0);
+    }
+    return demote(cl);
+}
 
-    mpz_init(*bigint);
-    mpz_set(*bigint, *((mpz_t*)big));
+/* *** Decimal conversion ***
+ * mini-gmp converts to and from decimal a limb's worth of digits at a time,
+ * which takes time quadratic in the length. A long number is instead split
+ * in two at a power of ten, and each half converted the same way: with
+ * Karatsuba multiplication, and division by the reciprocal of each power
+ * (worked out by Newton's method), this takes about O(n^1.6) time. The
+ * working space comes from malloc, so nothing here can start a collection.
+ * GMP's own conversions are subquadratic already.
+ */
+
+#ifndef IDRIS_GMP
+
+// Below these sizes, in limbs, mini-gmp's own methods are quicker
+#define KARATSUBA_LIMBS 32
+#define DECIMAL_LIMBS 32
+
+// Digits of the largest power of ten in a limb
+#define LIMB_DIGITS (LIMB_BITS == 64 ? 19 : 9)
+// Room for the value of 'digits' digits, in limbs
+#define DIGIT_LIMBS(digits) ((digits) / LIMB_DIGITS + 2)
+
+static mp_ptr limbs_alloc(mp_size_t n) {
+    mp_ptr p = malloc((n > 0 ? n : 1) * sizeof(mp_limb_t));
+    if (p == NULL) {
+        fprintf(stderr, "RTS ERROR: Unable to allocate Integer workspace.\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
 
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
+static mp_size_t normal_size(mp_srcptr p, mp_size_t n) {
+    while (n > 0 && p[n - 1] == 0) {
+        n--;
+    }
+    return n;
+}
 
-    return cl;
+// Working space for kara_mul_n on n limbs
+static mp_size_t kara_scratch(mp_size_t n) {
+    mp_size_t size = 0;
+    while (n >= KARATSUBA_LIMBS) {
+        n = n - n / 2 + 1;
+        size += 4 * n;
+    }
+    return size;
 }
 
-VAL MKBIGMc(VM* vm, void* big) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+// rp = ap * bp, where both have n limbs, into 2n limbs. Each is split in
+// two, so that three multiplications of half the size do, rather than four.
+static void kara_mul_n(mp_ptr rp, mp_srcptr ap, mp_srcptr bp, mp_size_t n,
+                       mp_ptr tp) {
+    if (n < KARATSUBA_LIMBS) {
+        mpn_mul_n(rp, ap, bp, n);
+        return;
+    }
+    mp_size_t l = n / 2;
+    mp_size_t h = n - l;
+    mp_ptr sa = tp;
+    mp_ptr sb = tp + (h + 1);
+    mp_ptr mid = tp + 2 * (h + 1);
+    mp_ptr next = tp + 4 * (h + 1);
+
+    // (a0 + a1)(b0 + b1), a0 b0 and a1 b1
+    sa[h] = mpn_add(sa, ap + l, h, ap, l);
+    sb[h] = mpn_add(sb, bp + l, h, bp, l);
+    kara_mul_n(mid, sa, sb, h + 1, next);
+    kara_mul_n(rp, ap, bp, l, next);
+    kara_mul_n(rp + 2 * l, ap + l, bp + l, h, next);
+
+    // What is left is a0 b1 + a1 b0, which fits in 2h + 1 limbs
+    mpn_sub(mid, mid, 2 * (h + 1), rp, 2 * l);
+    mpn_sub(mid, mid, 2 * (h + 1), rp + 2 * l, 2 * h);
+    mpn_add(rp + l, rp + l, 2 * n - l, mid, 2 * h + 1);
+}
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
+// rp = ap * bp, into an + bn limbs, for an >= bn > 0
+static void kara_mul(mp_ptr rp, mp_srcptr ap, mp_size_t an,
+                     mp_srcptr bp, mp_size_t bn) {
+    if (bn < KARATSUBA_LIMBS) {
+        mpn_mul(rp, ap, an, bp, bn);
+        return;
+    }
+    mp_ptr tp = limbs_alloc(2 * bn + kara_scratch(bn));
+    if (an == bn) {
+        kara_mul_n(rp, ap, bp, bn, tp);
+    } else {
+        // bn limbs of a at a time
+        mp_size_t done;
+        memset(rp, 0, (an + bn) * sizeof(mp_limb_t));
+        for (done = 0; done < an; done += bn) {
+            mp_size_t k = an - done < bn ? an - done : bn;
+            if (k == bn) {
+                kara_mul_n(tp, ap + done, bp, bn, tp + 2 * bn);
+            } else {
+                kara_mul(tp, bp, bn, ap + done, k);
+            }
+            mpn_add(rp + done, rp + done, an + bn - done, tp, k + bn);
+        }
+    }
+    free(tp);
+}
 
-    mpz_init_set(*bigint, *((mpz_t*)big));
+// rp = ap * bp, into an + bn limbs
+static void fast_mul(mp_ptr rp, mp_srcptr ap, mp_size_t an,
+                     mp_srcptr bp, mp_size_t bn) {
+    if (an == 0 || bn == 0) {
+        memset(rp, 0, (an + bn) * sizeof(mp_limb_t));
+    } else if (an >= bn) {
+        kara_mul(rp, ap, an, bp, bn);
+    } else {
+        kara_mul(rp, bp, bn, ap, an);
+    }
+}
 
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
+// 10^digits, which has n limbs, and for dividing by it (if wanted)
+// floor(B^2n / p), where B is the limb base
+typedef struct {
+    size_t digits;
+    mp_ptr p;
+    mp_size_t n;
+    mp_ptr inv;
+    mp_size_t invn;
+} Power;
+
+// 10^(LIMB_DIGITS * 2^k) for k from 0, as far as a conversion needs
+typedef struct {
+    Power pow[8 * sizeof(size_t)];
+    int count;
+} Powers;
+
+// Work out the reciprocal of a power by Newton's method, from 'a' (with
+// room for n + 2 limbs), which must be no more than it. Each step adds
+// a (B^2n - p a) / B^2n, which never overshoots, until B^2n - p a < p.
+static void power_invert(Power* pw, mp_ptr a, mp_size_t an) {
+    mp_size_t n = pw->n;
+    mp_ptr pa = limbs_alloc(2 * n + 2);
+    mp_ptr e = limbs_alloc(2 * n);
+    mp_ptr ae = limbs_alloc(3 * n + 2);
+    for (;;) {
+        mp_size_t i, en, incn;
+        mp_limb_t carry;
+
+        fast_mul(pa, pw->p, n, a, an);
+        for (i = n + an; i < 2 * n; i++) {
+            pa[i] = 0;
+        }
+        // p a is at most B^2n, so the difference is the negation of its
+        // low limbs
+        for (i = 0; i < 2 * n; i++) {
+            e[i] = ~pa[i];
+        }
+        mpn_add_1(e, e, 2 * n, 1);
+        en = normal_size(e, 2 * n);
+        if (en < n || (en == n && mpn_cmp(e, pw->p, n) < 0)) {
+            break;
+        }
 
-    return cl;
+        fast_mul(ae, a, an, e, en);
+        incn = an + en > 2 * n ? normal_size(ae + 2 * n, an + en - 2 * n) : 0;
+        if (incn == 0) {
+            // Still short by at least one
+            ae[2 * n] = 1;
+            incn = 1;
+        }
+        if (incn > an) {
+            carry = mpn_add(a, ae + 2 * n, incn, a, an);
+            an = incn;
+        } else {
+            carry = mpn_add(a, a, an, ae + 2 * n, incn);
+        }
+        if (carry != 0) {
+            a[an++] = carry;
+        }
+    }
+    free(pa);
+    free(e);
+    free(ae);
+    pw->inv = a;
+    pw->invn = normal_size(a, an);
 }
 
-VAL MKBIGUI(VM* vm, unsigned long val) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+// The powers with fewer than 'digits' digits (at least the first), with
+// their reciprocals if 'inverses'
+static void powers_make(Powers* pws, size_t digits, int inverses) {
+    Power* pw = &pws->pow[0];
+    mp_limb_t ten = 1;
+    int i;
+    for (i = 0; i < LIMB_DIGITS; i++) {
+        ten *= 10;
+    }
+    pw->digits = LIMB_DIGITS;
+    pw->p = limbs_alloc(1);
+    pw->p[0] = ten;
+    pw->n = 1;
+    pw->inv = NULL;
+    if (inverses) {
+        // B is under B^2 / p, since p < B
+        mp_ptr a = limbs_alloc(3);
+        a[0] = 0;
+        a[1] = 1;
+        power_invert(pw, a, 2);
+    }
+    pws->count = 1;
+
+    while (pw->digits * 2 < digits) {
+        Power* next = pw + 1;
+        next->digits = pw->digits * 2;
+        next->p = limbs_alloc(2 * pw->n);
+        fast_mul(next->p, pw->p, pw->n, pw->p, pw->n);
+        next->n = normal_size(next->p, 2 * pw->n);
+        next->inv = NULL;
+        if (inverses) {
+            // The square of the last reciprocal, scaled, is just under
+            // this one
+            mp_size_t sqn = 2 * pw->invn;
+            mp_size_t shift = 4 * pw->n - 2 * next->n;
+            mp_ptr sq = limbs_alloc(sqn);
+            mp_ptr a = limbs_alloc(next->n + 2);
+            fast_mul(sq, pw->inv, pw->invn, pw->inv, pw->invn);
+            mp_size_t an = normal_size(sq + shift, sqn - shift);
+            memcpy(a, sq + shift, an * sizeof(mp_limb_t));
+            free(sq);
+            power_invert(next, a, an);
+        }
+        pws->count++;
+        pw = next;
+    }
+}
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
+static void powers_free(Powers* pws) {
+    int i;
+    for (i = 0; i < pws->count; i++) {
+        free(pws->pow[i].p);
+        free(pws->pow[i].inv);
+    }
+    pws->count = 0;
+}
 
-    mpz_init_set_ui(*bigint, val);
+// The largest power with fewer than 'digits' digits
+static const Power* power_below(const Powers* pws, size_t digits) {
+    int k = pws->count - 1;
+    while (k > 0 && pws->pow[k].digits >= digits) {
+        k--;
+    }
+    return &pws->pow[k];
+}
 
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
+// q = x / p and r = x % p, for x (of xn limbs) under p^2. qp needs room
+// for xn - n + 2 limbs, and rp for n. This is Barrett's method: the top
+// limbs of x times the reciprocal give q, or at most 2 under it.
+static void power_divide(const Power* pw, mp_srcptr xp, mp_size_t xn,
+                         mp_ptr qp, mp_size_t* qn,
+                         mp_ptr rp, mp_size_t* rn) {
+    mp_size_t n = pw->n;
+    if (xn < n) {
+        memcpy(rp, xp, xn * sizeof(mp_limb_t));
+        *qn = 0;
+        *rn = xn;
+        return;
+    }
 
-    return cl;
+    mp_size_t tn = xn - (n - 1) + pw->invn;
+    mp_ptr t = limbs_alloc(tn > xn + 2 ? tn : xn + 2);
+    fast_mul(t, xp + n - 1, xn - (n - 1), pw->inv, pw->invn);
+    mp_size_t q = tn > n + 1 ? normal_size(t + n + 1, tn - (n + 1)) : 0;
+    memcpy(qp, t + n + 1, q * sizeof(mp_limb_t));
+
+    mp_ptr r = limbs_alloc(xn);
+    fast_mul(t, qp, q, pw->p, n);
+    mpn_sub(r, xp, xn, t, normal_size(t, q + n));
+    mp_size_t rsize = normal_size(r, xn);
+    while (rsize > n || (rsize == n && mpn_cmp(r, pw->p, n) >= 0)) {
+        mpn_sub(r, r, rsize, pw->p, n);
+        rsize = normal_size(r, rsize);
+        if (q == 0) {
+            qp[q++] = 1;
+        } else if (mpn_add_1(qp, qp, q, 1) != 0) {
+            qp[q++] = 1;
+        }
+    }
+    memcpy(rp, r, rsize * sizeof(mp_limb_t));
+    free(t);
+    free(r);
+    *qn = q;
+    *rn = rsize;
 }
 
-VAL MKBIGSI(VM* vm, signed long val) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+// Write x, which is under 10^nd, as nd digit values with leading zeros.
+// x is overwritten.
+static void to_digits(unsigned char* out, size_t nd, mp_ptr xp,
+                      mp_size_t xn, const Powers* pws) {
+    xn = normal_size(xp, xn);
+    if (xn < DECIMAL_LIMBS) {
+        size_t sn = xn > 0 ? mpn_get_str(out, 10, xp, xn) : 0;
+        memmove(out + nd - sn, out, sn);
+        memset(out, 0, nd - sn);
+        return;
+    }
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
+    const Power* pw = power_below(pws, nd);
+    mp_size_t qn, rn;
+    mp_ptr qp = limbs_alloc(xn - pw->n + 2);
+    mp_ptr rp = limbs_alloc(pw->n);
+    power_divide(pw, xp, xn, qp, &qn, rp, &rn);
+    to_digits(out, nd - pw->digits, qp, qn, pws);
+    to_digits(out + nd - pw->digits, pw->digits, rp, rn, pws);
+    free(qp);
+    free(rp);
+}
 
-    mpz_init_set_si(*bigint, val);
+// The value of dn digit values, into rp (with room for DIGIT_LIMBS(dn)
+// limbs). Returns its size.
+static mp_size_t from_digits(mp_ptr rp, const unsigned char* dp, size_t dn,
+                             const Powers* pws) {
+    if (dn <= DECIMAL_LIMBS * LIMB_DIGITS) {
+        // mini-gmp's mpn_set_str fails on a whole limb of leading zeros
+        while (dn > 0 && *dp == 0) {
+            dp++;
+            dn--;
+        }
+        return dn > 0 ? mpn_set_str(rp, dp, dn, 10) : 0;
+    }
 
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
+    // hi * 10^d + lo, for the low d digits
+    const Power* pw = power_below(pws, dn);
+    size_t hd = dn - pw->digits;
+    mp_ptr hp = limbs_alloc(DIGIT_LIMBS(hd));
+    mp_ptr lp = limbs_alloc(DIGIT_LIMBS(pw->digits));
+    mp_size_t hn = from_digits(hp, dp, hd, pws);
+    mp_size_t ln = from_digits(lp, dp + hd, pw->digits, pws);
+    fast_mul(rp, hp, hn, pw->p, pw->n);
+    mpn_add(rp, rp, hn + pw->n, lp, ln);
+    free(hp);
+    free(lp);
+    return normal_size(rp, hn + pw->n);
+}
 
-    return cl;
+// Parse a decimal number as mpz_set_str does: after any spaces and a '-',
+// only digits, though spaces may come among them. Returns the limbs, from
+// malloc, or NULL if it is not a number.
+static mp_ptr parse_decimal(const char* str, int* negative, mp_size_t* n) {
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+    *negative = *str == '-';
+    str += *negative;
+
+    unsigned char* dp = malloc(strlen(str) + 1);
+    size_t dn = 0;
+    if (dp == NULL) {
+        fprintf(stderr, "RTS ERROR: Unable to allocate Integer workspace.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (; *str != '\0'; str++) {
+        if (*str >= '0' && *str <= '9') {
+            dp[dn++] = *str - '0';
+        } else if (!isspace((unsigned char)*str)) {
+            free(dp);
+            return NULL;
+        }
+    }
+    if (dn == 0) {
+        free(dp);
+        return NULL;
+    }
+
+    Powers pws;
+    powers_make(&pws, dn, 0);
+    mp_ptr rp = limbs_alloc(DIGIT_LIMBS(dn));
+    *n = from_digits(rp, dp, dn, &pws);
+    powers_free(&pws);
+    free(dp);
+    return rp;
+}
+
+// Write big in decimal, in at most nd digits (and a sign), into out.
+// Returns the length.
+static size_t big_decimal(char* out, mpz_srcptr big, size_t nd) {
+    mp_size_t n = mpz_size(big);
+    mp_ptr xp = limbs_alloc(n);
+    memcpy(xp, big->_mp_d, n * sizeof(mp_limb_t));
+    char* digits = out;
+    if (big->_mp_size < 0) {
+        *digits++ = '-';
+    }
+
+    Powers pws;
+    pws.count = 0;
+    if (n >= DECIMAL_LIMBS) {
+        powers_make(&pws, nd, 1);
+    }
+    to_digits((unsigned char*)digits, nd, xp, n, &pws);
+    powers_free(&pws);
+    free(xp);
+
+    // Drop the leading zeros, but not the last digit
+    size_t zeros = 0, i;
+    while (zeros + 1 < nd && digits[zeros] == 0) {
+        zeros++;
+    }
+    nd -= zeros;
+    memmove(digits, digits + zeros, nd);
+    for (i = 0; i < nd; i++) {
+        digits[i] += '0';
+    }
+    digits[nd] = '\0';
+    return digits + nd - out;
+}
+
+// Bytes for the Integer of a number of 'len' digits
+static size_t parse_room(size_t len) {
+    return BIGSIZE(DIGIT_LIMBS(len));
 }
 
-VAL GETBIG(VM * vm, VAL x) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+// Bytes which mpn_get_str may allocate while converting n limbs. Only with
+// limbs of 32 bits, where 10^9 is not normalised.
+#define DECIMAL_SCRATCH(n) GMP_SCRATCH(n)
 
-    if (ISINT(x)) {
-        mpz_t* bigint;
-        VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-        idris_doneAlloc();
-        bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
+#else
 
-        mpz_init(*bigint);
-        mpz_set_si(*bigint, GETINT(x));
+// Space for a number of 'len' decimal digits (log2(10) < 4)
+static size_t parse_room(size_t len) {
+    return BIGSIZE(len * 4 / LIMB_BITS + 2) + GMP_SCRATCH(len / 8 + 1);
+}
 
-        SETTY(cl, CT_BIGINT);
-        cl -> info.ptr = (void*)bigint;
+// Bytes which mpz_get_str may allocate while converting n limbs
+#define DECIMAL_SCRATCH(n) (2 * GMP_SCRATCH(n))
 
-        return cl;
-    } else {
-        idris_doneAlloc();
-        switch(GETTY(x)) {
-        case CT_FWD:
-            return GETBIG(vm, x->info.ptr);
-        default:
-            return x;
+#endif
+
+VAL MKBIGI(int val) {
+    return MKINT((i_int)val);
+}
+
+VAL MKBIGC(VM* vm, char* val) {
+#ifdef IDRIS_GMP
+    size_t len = strlen(val);
+    idris_requireAlloc(parse_room(len));
+
+    VAL cl = big_new(len * 4 / LIMB_BITS + 2, 0);
+    mpz_set_str(GETMPZ(cl), val, 10);
+    return big_settle(cl);
+#else
+    // Parsed outside the heap, so val can be read until it is done
+    int negative;
+    mp_size_t n;
+    mp_ptr limbs = parse_decimal(val, &negative, &n);
+    if (limbs == NULL) {
+        return MKINT(0);
+    }
+    idris_requireAlloc(BIGSIZE(n));
+
+    VAL cl = big_new(n, 0);
+    memcpy(BIGLIMBS(cl), limbs, n * sizeof(mp_limb_t));
+    GETMPZ(cl)->_mp_size = negative ? -n : n;
+    free(limbs);
+    return demote(cl);
+#endif
+}
+
+void idris_bigConsts(VAL* consts, const char* const* digits, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+#ifdef IDRIS_GMP
+        mpz_t big;
+        // This runs before main, when GMP still allocates with malloc
+        mpz_init_set_str(big, digits[i], 10);
+        int negative = mpz_sgn(big) < 0;
+        mp_size_t n = mpz_size(big);
+        mp_srcptr limbs = big->_mp_d;
+#else
+        int negative;
+        mp_size_t n = 0;
+        mp_ptr limbs = parse_decimal(digits[i], &negative, &n);
+#endif
+        VAL cl = malloc(BIGSIZE(n > 0 ? n : 1));
+        if (cl == NULL) {
+            fprintf(stderr, "RTS ERROR: Unable to allocate Integer constant.\n");
+            exit(EXIT_FAILURE);
+        }
+        cl->ty = 0;
+        big_init(cl, n > 0 ? n : 1);
+        memcpy(BIGLIMBS(cl), limbs, n * sizeof(mp_limb_t));
+        GETMPZ(cl)->_mp_size = negative ? -n : n;
+#ifdef IDRIS_GMP
+        mpz_clear(big);
+#else
+        free(limbs);
+#endif
+
+        consts[i] = demote(cl);
+        if (consts[i] != cl) {
+            free(cl);
+        } else {
+            SETFLAG(cl, HEAP_SHARED | HEAP_STATIC);
         }
     }
 }
 
-VAL bigAdd(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+VAL MKBIGM(VM* vm, void* big) {
+    idris_requireAlloc(BIGSIZE(mpz_size(*(mpz_t*)big)));
+    return demote(big_copy(*(mpz_t*)big, 0));
+}
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_add(*bigint, GETMPZ(GETBIG(vm,x)), GETMPZ(GETBIG(vm,y)));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+VAL MKBIGMc(VM* vm, void* big) {
+    return big_copy(*(mpz_t*)big, 1);
 }
 
-VAL bigSub(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+VAL MKBIGUI(VM* vm, unsigned long val) {
+    if (val <= (unsigned long)IDRIS_SMALL_MAX) {
+        return MKINT((i_int)val);
+    }
+    idris_requireAlloc(BIGSIZE(LONG_LIMBS));
+    VAL cl = big_new(LONG_LIMBS, 0);
+    mpz_set_ui(GETMPZ(cl), val);
+    return cl;
+}
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_sub(*bigint, GETMPZ(GETBIG(vm,x)), GETMPZ(GETBIG(vm,y)));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
+VAL MKBIGSI(VM* vm, signed long val) {
+    if (val >= IDRIS_SMALL_MIN && val <= IDRIS_SMALL_MAX) {
+        return MKINT((i_int)val);
+    }
+    idris_requireAlloc(BIGSIZE(LONG_LIMBS));
+    VAL cl = big_new(LONG_LIMBS, 0);
+    mpz_set_si(GETMPZ(cl), val);
     return cl;
 }
 
+typedef void (*BigOp)(mpz_ptr, mpz_srcptr, mpz_srcptr);
+
+// x `op` y, into a new Integer with room for 'limbs' limbs, and 'scratch'
+// bytes more for GMP
+static VAL big_op(VM* vm, BigOp op, VAL x, VAL y, size_t limbs,
+                  size_t scratch) {
+    VAL vals[2] = { x, y };
+    SmallMPZ sx, sy;
+    big_reserve(vm, BIGSIZE(limbs) + scratch, vals, 2);
+
+    VAL cl = big_new(limbs, 0);
+    op(GETMPZ(cl), to_mpz(vals[0], &sx), to_mpz(vals[1], &sy));
+    return big_settle(cl);
+}
+
+static size_t max_limbs(VAL x, VAL y) {
+    size_t xn = limbs_of(x);
+    size_t yn = limbs_of(y);
+    return xn > yn ? xn : yn;
+}
+
+// The product of x and y into big, which has room for it
+static void mul_into(mpz_ptr big, mpz_srcptr x, mpz_srcptr y) {
+    mp_size_t xn = mpz_size(x);
+    mp_size_t yn = mpz_size(y);
+    if (xn == 0 || yn == 0) {
+        big->_mp_size = 0;
+        return;
+    }
+    // mpn_mul wants the longer operand first
+    if (xn < yn) {
+        mpz_srcptr t = x; x = y; y = t;
+        mp_size_t tn = xn; xn = yn; yn = tn;
+    }
+    mpn_mul(big->_mp_d, x->_mp_d, xn, y->_mp_d, yn);
+    mp_size_t n = xn + yn;
+    if (big->_mp_d[n - 1] == 0) {
+        n--;
+    }
+    big->_mp_size = (x->_mp_size < 0) != (y->_mp_size < 0) ? -n : n;
+}
+
+VAL bigAdd(VM* vm, VAL x, VAL y) {
+    return big_op(vm, mpz_add, x, y, max_limbs(x, y) + 1, 0);
+}
+
+VAL bigSub(VM* vm, VAL x, VAL y) {
+    return big_op(vm, mpz_sub, x, y, max_limbs(x, y) + 1, 0);
+}
+
 VAL bigMul(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+    size_t limbs = limbs_of(x) + limbs_of(y);
+    VAL vals[2] = { x, y };
+    SmallMPZ sx, sy;
+    big_reserve(vm, BIGSIZE(limbs) + MUL_SCRATCH(limbs), vals, 2);
+
+    VAL cl = big_new(limbs, 0);
+    mul_into(GETMPZ(cl), to_mpz(vals[0], &sx), to_mpz(vals[1], &sy));
+    return demote(cl);
+}
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_mul(*bigint, GETMPZ(GETBIG(vm,x)), GETMPZ(GETBIG(vm,y)));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+// a + x*y, or a - x*y if 'sub' is set, into one new Integer
+static VAL bigMulAdd(VM* vm, VAL a, VAL x, VAL y, int sub) {
+    size_t pn = limbs_of(x) + limbs_of(y);
+    size_t an = limbs_of(a);
+    size_t limbs = (an > pn ? an : pn) + 1;
+    VAL vals[3] = { a, x, y };
+    SmallMPZ sa, sx, sy;
+    big_reserve(vm, BIGSIZE(limbs) + MUL_SCRATCH(pn), vals, 3);
+
+    VAL cl = big_new(limbs, 0);
+    mpz_ptr big = GETMPZ(cl);
+    mul_into(big, to_mpz(vals[1], &sx), to_mpz(vals[2], &sy));
+    if (sub) {
+        mpz_sub(big, to_mpz(vals[0], &sa), big);
+    } else {
+        mpz_add(big, to_mpz(vals[0], &sa), big);
+    }
+    return demote(cl);
 }
 
 VAL bigDiv(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
-
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_tdiv_q(*bigint, GETMPZ(GETBIG(vm,x)), GETMPZ(GETBIG(vm,y)));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+    size_t xn = limbs_of(x);
+    size_t yn = limbs_of(y);
+    return big_op(vm, mpz_tdiv_q, x, y, xn >= yn ? xn - yn + 1 : 1,
+                  GMP_SCRATCH(xn + yn));
 }
 
 VAL bigMod(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
-
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_mod(*bigint, GETMPZ(GETBIG(vm,x)), GETMPZ(GETBIG(vm,y)));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+    size_t xn = limbs_of(x);
+    size_t yn = limbs_of(y);
+    return big_op(vm, mpz_mod, x, y, yn, GMP_SCRATCH(xn + yn));
 }
 
 VAL bigAnd(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
-
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_and(*bigint, GETMPZ(GETBIG(vm,x)), GETMPZ(GETBIG(vm,y)));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+    size_t n = max_limbs(x, y);
+    return big_op(vm, mpz_and, x, y, n + 1, GMP_SCRATCH(2 * n));
 }
 
 VAL bigOr(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
-
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_ior(*bigint, GETMPZ(GETBIG(vm,x)), GETMPZ(GETBIG(vm,y)));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+    size_t n = max_limbs(x, y);
+    return big_op(vm, mpz_ior, x, y, n + 1, GMP_SCRATCH(2 * n));
 }
 
-VAL bigShiftLeft(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
+typedef void (*BigShift)(mpz_ptr, mpz_srcptr, mp_bitcnt_t);
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_mul_2exp(*bigint, GETMPZ(GETBIG(vm,x)), GETINT(y));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+// x shifted by 'bits', into a new Integer with room for 'limbs' limbs
+static VAL big_shift(VM* vm, BigShift shift, VAL x, i_int bits,
+                     size_t limbs) {
+    SmallMPZ sx;
+    big_reserve(vm, BIGSIZE(limbs) + GMP_SCRATCH(limbs), &x, 1);
+
+    VAL cl = big_new(limbs, 0);
+    shift(GETMPZ(cl), to_mpz(x, &sx), bits);
+    return big_settle(cl);
 }
 
+VAL bigShiftLeft(VM* vm, VAL x, VAL y) {
+    return big_shift(vm, mpz_mul_2exp, x, GETINT(y),
+                     limbs_of(x) + GETINT(y) / LIMB_BITS + 1);
+}
 
 VAL bigLShiftRight(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
-
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_fdiv_q_2exp(*bigint, GETMPZ(GETBIG(vm,x)), GETINT(y));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+    return big_shift(vm, mpz_fdiv_q_2exp, x, GETINT(y), limbs_of(x) + 1);
 }
 
 VAL bigAShiftRight(VM* vm, VAL x, VAL y) {
-    idris_requireAlloc(IDRIS_MAXGMP);
-
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    idris_doneAlloc();
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-    mpz_fdiv_q_2exp(*bigint, GETMPZ(GETBIG(vm,x)), GETINT(y));
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-    return cl;
+    return big_shift(vm, mpz_fdiv_q_2exp, x, GETINT(y), limbs_of(x) + 1);
 }
 
 VAL idris_bigAnd(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return INTOP(&, x, y);
     } else {
-        return bigAnd(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigAnd(vm, x, y);
     }
 }
 
@@ -274,80 +810,165 @@ VAL idris_bigOr(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return INTOP(|, x, y);
     } else {
-        return bigOr(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigOr(vm, x, y);
     }
 }
 
+// The fast paths work on the tagged values directly: for x = 2a+1 and
+// y = 2b+1, x + (y-1) = 2(a+b)+1, which overflows an i_int exactly when
+// a+b is too big to be small.
+
 VAL idris_bigPlus(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
-        i_int vx = GETINT(x);
-        i_int vy = GETINT(y);
-        if ((vx <= 0 && vy >=0) || (vx >=0 && vy <=0)) {
-            return ADD(x, y);
+        i_int res;
+#ifdef HAS_OVERFLOW_BUILTINS
+        if (!__builtin_add_overflow((i_int)x, (i_int)y - 1, &res)) {
+            return (VAL)res;
         }
-        i_int res = vx + vy;
-        if (res >= 1<<30 || res <= -(1 << 30)) {
-            return bigAdd(vm, GETBIG(vm, x), GETBIG(vm, y));
-        } else {
+#else
+        res = GETINT(x) + GETINT(y);
+        if (res >= IDRIS_SMALL_MIN && res <= IDRIS_SMALL_MAX) {
             return MKINT(res);
         }
-    } else {
-        return bigAdd(vm, GETBIG(vm, x), GETBIG(vm, y));
+#endif
     }
+    return bigAdd(vm, x, y);
 }
 
 VAL idris_bigMinus(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
-        i_int vx = GETINT(x);
-        i_int vy = GETINT(y);
-        if ((vx <= 0 && vy <=0) || (vx >=0 && vy <=0)) {
-            return INTOP(-, x, y);
+        i_int res;
+#ifdef HAS_OVERFLOW_BUILTINS
+        if (!__builtin_sub_overflow((i_int)x, (i_int)y - 1, &res)) {
+            return (VAL)res;
         }
-        i_int res = vx - vy;
-        if (res >= 1<<30 || res <= -(1 << 30)) {
-            return bigSub(vm, GETBIG(vm, x), GETBIG(vm, y));
-        } else {
+#else
+        res = GETINT(x) - GETINT(y);
+        if (res >= IDRIS_SMALL_MIN && res <= IDRIS_SMALL_MAX) {
             return MKINT(res);
         }
-    } else {
-        return bigSub(vm, GETBIG(vm, x), GETBIG(vm, y));
+#endif
     }
+    return bigSub(vm, x, y);
 }
 
 VAL idris_bigTimes(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
+        i_int res;
+#ifdef HAS_OVERFLOW_BUILTINS
+        // a * 2b = 2ab, so this overflows exactly when ab isn't small
+        if (!__builtin_mul_overflow(GETINT(x), (i_int)y - 1, &res)) {
+            return (VAL)(res + 1);
+        }
+#else
+        // Without the builtins, only multiply when both halves are small
+        // enough that the product can't overflow
         i_int vx = GETINT(x);
         i_int vy = GETINT(y);
-	// we could work out likelihood of overflow by checking the number
-	// of necessary bits. Here's a quick conservative hack instead.
-	if ((vx < (1<<15) && vy < (1<16)) ||
-	    (vx < (1<<16) && vy < (1<15)) ||
-	    (vx < (1<<20) && vy < (1<11)) ||
-	    (vx < (1<<11) && vy < (1<20)) ||
-	    (vx < (1<<23) && vy < (1<<8)) ||
-	    (vx < (1<<8) && vy < (1<<23))) { // ultra-conservative!
-	    return INTOP(*,x,y);
-        } else {
-            return bigMul(vm, GETBIG(vm, x), GETBIG(vm, y));
+        i_int half = (i_int)1 << (sizeof(i_int) * 4 - 1);
+        if (vx > -half && vx < half && vy > -half && vy < half) {
+            res = vx * vy;
+            return MKINT(res);
+        }
+#endif
+    }
+    return bigMul(vm, x, y);
+}
+
+// Multiply-adds, for code such as q*x + r, so that the product needs no
+// Integer of its own
+
+VAL idris_bigMulAdd(VM* vm, VAL a, VAL x, VAL y) {
+#ifdef HAS_OVERFLOW_BUILTINS
+    if (ISINT(a) && ISINT(x) && ISINT(y)) {
+        i_int prod, res;
+        if (!__builtin_mul_overflow(GETINT(x), (i_int)y - 1, &prod) &&
+            !__builtin_add_overflow((i_int)a, prod, &res)) {
+            return (VAL)res;
         }
-    } else {
-        return bigMul(vm, GETBIG(vm, x), GETBIG(vm, y));
     }
+#endif
+    return bigMulAdd(vm, a, x, y, 0);
+}
+
+VAL idris_bigMulSub(VM* vm, VAL a, VAL x, VAL y) {
+#ifdef HAS_OVERFLOW_BUILTINS
+    if (ISINT(a) && ISINT(x) && ISINT(y)) {
+        i_int prod, res;
+        if (!__builtin_mul_overflow(GETINT(x), (i_int)y - 1, &prod) &&
+            !__builtin_sub_overflow((i_int)a, prod, &res)) {
+            return (VAL)res;
+        }
+    }
+#endif
+    return bigMulAdd(vm, a, x, y, 1);
+}
+
+// In-place updates, for when the code generator knows that 'acc' was made
+// by one of the operations above and that nothing else refers to it. Its
+// limbs are overwritten if there is room for the result; otherwise these
+// are the same as the operations above.
+
+static int reusable(VAL acc, size_t limbs) {
+    return !ISINT(acc) && GETTY(acc) == CT_BIGINT &&
+           !HASFLAG(acc, HEAP_SHARED) && limbs <= BIGROOM(acc);
+}
+
+VAL idris_bigPlusInto(VM* vm, VAL acc, VAL y) {
+    if (reusable(acc, max_limbs(acc, y) + 1)) {
+        SmallMPZ sy;
+        mpz_add(GETMPZ(acc), GETMPZ(acc), to_mpz(y, &sy));
+        return demote(acc);
+    }
+    return idris_bigPlus(vm, acc, y);
+}
+
+VAL idris_bigMinusInto(VM* vm, VAL acc, VAL y) {
+    if (reusable(acc, max_limbs(acc, y) + 1)) {
+        SmallMPZ sy;
+        mpz_sub(GETMPZ(acc), GETMPZ(acc), to_mpz(y, &sy));
+        return demote(acc);
+    }
+    return idris_bigMinus(vm, acc, y);
+}
+
+VAL idris_bigTimesInto(VM* vm, VAL acc, VAL y) {
+    if (ISINT(y) && reusable(acc, limbs_of(acc) + 1)) {
+        i_int val = GETINT(y);
+        uintptr_t mag = val < 0 ? -(uintptr_t)val : (uintptr_t)val;
+        mpz_ptr big = GETMPZ(acc);
+        mp_size_t n = mpz_size(big);
+        // Only by a single limb, which can be done in place
+        if (mag != 0 && (mp_limb_t)mag == mag && n > 0) {
+            mp_limb_t carry = mpn_mul_1(big->_mp_d, big->_mp_d, n,
+                                        (mp_limb_t)mag);
+            if (carry != 0) {
+                big->_mp_d[n++] = carry;
+            }
+            big->_mp_size = (big->_mp_size < 0) != (val < 0) ? -n : n;
+            return acc;
+        }
+    }
+    return idris_bigTimes(vm, acc, y);
 }
 
 VAL idris_bigShiftLeft(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
-        return INTOP(<<, x, y);
-    } else {
-        return bigShiftLeft(vm, GETBIG(vm, x), GETBIG(vm, y));
+        i_int vx = GETINT(x);
+        i_int vy = GETINT(y);
+        if (vy >= 0 && vy < (i_int)(sizeof(i_int) * 8 - 1) &&
+            vx >= (IDRIS_SMALL_MIN >> vy) && vx <= (IDRIS_SMALL_MAX >> vy)) {
+            return MKINT(vx * ((i_int)1 << vy));
+        }
     }
+    return bigShiftLeft(vm, x, y);
 }
 
 VAL idris_bigAShiftRight(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return INTOP(>>, x, y);
     } else {
-        return bigAShiftRight(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigAShiftRight(vm, x, y);
     }
 }
 
@@ -355,15 +976,19 @@ VAL idris_bigLShiftRight(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return INTOP(>>, x, y);
     } else {
-        return bigLShiftRight(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigLShiftRight(vm, x, y);
     }
 }
 
 VAL idris_bigDivide(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
+        // The smallest small Integer divided by -1 isn't small
+        if (GETINT(y) == -1) {
+            return idris_bigMinus(vm, MKINT(0), x);
+        }
         return INTOP(/, x, y);
     } else {
-        return bigDiv(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigDiv(vm, x, y);
     }
 }
 
@@ -371,7 +996,7 @@ VAL idris_bigMod(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return INTOP(%, x, y);
     } else {
-        return bigMod(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigMod(vm, x, y);
     }
 }
 
@@ -383,31 +1008,36 @@ int bigEqConst(VAL x, int c) {
     }
 }
 
+static int big_cmp(VAL x, VAL y) {
+    SmallMPZ sx, sy;
+    return mpz_cmp(to_mpz(x, &sx), to_mpz(y, &sy));
+}
+
 VAL bigEq(VM* vm, VAL x, VAL y) {
-    return MKINT((i_int)(mpz_cmp(GETMPZ(x), GETMPZ(y)) == 0));
+    return MKINT((i_int)(big_cmp(x, y) == 0));
 }
 
 VAL bigLt(VM* vm, VAL x, VAL y) {
-    return MKINT((i_int)(mpz_cmp(GETMPZ(x), GETMPZ(y)) < 0));
+    return MKINT((i_int)(big_cmp(x, y) < 0));
 }
 
 VAL bigGt(VM* vm, VAL x, VAL y) {
-    return MKINT((i_int)(mpz_cmp(GETMPZ(x), GETMPZ(y)) > 0));
+    return MKINT((i_int)(big_cmp(x, y) > 0));
 }
 
 VAL bigLe(VM* vm, VAL x, VAL y) {
-    return MKINT((i_int)(mpz_cmp(GETMPZ(x), GETMPZ(y)) <= 0));
+    return MKINT((i_int)(big_cmp(x, y) <= 0));
 }
 
 VAL bigGe(VM* vm, VAL x, VAL y) {
-    return MKINT((i_int)(mpz_cmp(GETMPZ(x), GETMPZ(y)) >= 0));
+    return MKINT((i_int)(big_cmp(x, y) >= 0));
 }
 
 VAL idris_bigEq(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return MKINT((i_int)(GETINT(x) == GETINT(y)));
     } else {
-        return bigEq(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigEq(vm, x, y);
     }
 }
 
@@ -415,7 +1045,7 @@ VAL idris_bigLt(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return MKINT((i_int)(GETINT(x) < GETINT(y)));
     } else {
-        return bigLt(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigLt(vm, x, y);
     }
 }
 
@@ -423,7 +1053,7 @@ VAL idris_bigLe(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return MKINT((i_int)(GETINT(x) <= GETINT(y)));
     } else {
-        return bigLe(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigLe(vm, x, y);
     }
 }
 
@@ -431,7 +1061,7 @@ VAL idris_bigGt(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return MKINT((i_int)(GETINT(x) > GETINT(y)));
     } else {
-        return bigGt(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigGt(vm, x, y);
     }
 }
 
@@ -439,7 +1069,7 @@ VAL idris_bigGe(VM* vm, VAL x, VAL y) {
     if (ISINT(x) && ISINT(y)) {
         return MKINT((i_int)(GETINT(x) >= GETINT(y)));
     } else {
-        return bigGe(vm, GETBIG(vm, x), GETBIG(vm, y));
+        return bigGe(vm, x, y);
     }
 }
 
@@ -466,26 +1096,46 @@ VAL idris_castBigFloat(VM* vm, VAL i) {
 
 VAL idris_castFloatBig(VM* vm, VAL f) {
     double val = GETFLOAT(f);
+    int exp = 0;
+    if (isfinite(val)) {
+        frexp(val, &exp);
+    }
+    size_t limbs = exp > 0 ? exp / LIMB_BITS + 1 : 1;
+    idris_requireAlloc(BIGSIZE(limbs) + GMP_SCRATCH(limbs));
 
-    mpz_t* bigint;
-    VAL cl = allocate(sizeof(Closure) + sizeof(mpz_t), 0);
-    bigint = (mpz_t*)(((char*)cl) + sizeof(Closure));
-
-    mpz_init_set_d(*bigint, val);
-
-    SETTY(cl, CT_BIGINT);
-    cl -> info.ptr = (void*)bigint;
-
-    return cl;
+    VAL cl = big_new(limbs, 0);
+    mpz_set_d(GETMPZ(cl), val);
+    return big_settle(cl);
 }
 
 VAL idris_castStrBig(VM* vm, VAL i) {
+    // Room to parse it, and to gather the characters of a view or rope
+    size_t len = idris_strbytes(i);
+    big_reserve(vm, parse_room(len) + sizeof(Closure) + sizeof(StrHeader) +
+                    len + 8, &i, 1);
     return MKBIGC(vm, GETSTR(i));
 }
 
 VAL idris_castBigStr(VM* vm, VAL i) {
-    char* str = mpz_get_str(NULL, 10, GETMPZ(GETBIG(vm, i)));
-    return MKSTR(vm, str);
+    if (ISINT(i)) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%" PRIdPTR, GETINT(i));
+        return MKSTR(vm, buf);
+    }
+    // At most this many digits, since log10(2) < 0.30103. The string is
+    // made first, and the digits written straight into it.
+    size_t nd = (size_t)(mpz_sizeinbase(GETMPZ(i), 2) * 0.30103) + 2;
+    big_reserve(vm, sizeof(Closure) + sizeof(StrHeader) + nd + 16 +
+                    DECIMAL_SCRATCH(mpz_size(GETMPZ(i))), &i, 1);
+
+    VAL str = allocStr(vm, nd + 2, 0);
+#ifdef IDRIS_GMP
+    mpz_get_str(str->info.str, 10, GETMPZ(i));
+    STRHEADER(str)->len = strlen(str->info.str);
+#else
+    STRHEADER(str)->len = big_decimal(str->info.str, GETMPZ(i), nd);
+#endif
+    return str;
 }
 
 // Get 64 bits out of a big int with special handling
@@ -17,12 +17,27 @@ VAL MKBIGMc(VM* vm, void* bigint);
 VAL MKBIGUI(VM* vm, unsigned long val);
 VAL MKBIGSI(VM* vm, signed long val);
 
+// Parse the 'count' decimal literals in 'digits' once, into 'consts', as
+// Integers which live outside every heap and are never collected
+void idris_bigConsts(VAL* consts, const char* const* digits, int count);
+
 VAL idris_bigPlus(VM*, VAL x, VAL y);
 VAL idris_bigMinus(VM*, VAL x, VAL y);
 VAL idris_bigTimes(VM*, VAL x, VAL y);
 VAL idris_bigDivide(VM*, VAL x, VAL y);
 VAL idris_bigMod(VM*, VAL x, VAL y);
 
+// a + x*y and a - x*y, without an Integer for the product
+VAL idris_bigMulAdd(VM*, VAL a, VAL x, VAL y);
+VAL idris_bigMulSub(VM*, VAL a, VAL x, VAL y);
+
+// As idris_bigPlus, idris_bigMinus and idris_bigTimes, but 'acc' may be
+// overwritten with the result. Only for an 'acc' just made by one of the
+// operations above, which nothing else refers to.
+VAL idris_bigPlusInto(VM*, VAL acc, VAL y);
+VAL idris_bigMinusInto(VM*, VAL acc, VAL y);
+VAL idris_bigTimesInto(VM*, VAL acc, VAL y);
+
 int bigEqConst(VAL x, int c);
 
 VAL idris_bigEq(VM*, VAL x, VAL y);
@@ -45,6 +60,15 @@ VAL idris_bigShiftRight(VM* vm, VAL x, VAL y);
 
 uint64_t idris_truncBigB64(const mpz_t bi);
 
-#define GETMPZ(x) *((mpz_t*)((x)->info.ptr))
+// An Integer too big to be small is a CT_BIGINT holding an mpz_t, with
+// the limbs following it in the same object, so that it is made with one
+// allocation and moved by the collectors in one piece. info.size is the
+// size of the object after the Closure, which says how many limbs it has
+// room for.
+#define GETMPZ(x) (*(mpz_t*)((char*)(x) + sizeof(Closure)))
+#define BIGLIMBS(x) ((mp_limb_t*)((char*)(x) + sizeof(Closure) + sizeof(mpz_t)))
+#define BIGROOM(x) (((x)->info.size - sizeof(mpz_t)) / sizeof(mp_limb_t))
+#define BIGSIZE(limbs) (sizeof(Closure) + sizeof(mpz_t) + \
+                        (limbs) * sizeof(mp_limb_t))
 
 #endif
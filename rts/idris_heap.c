@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for mremap
+#endif
+
 #include "idris_heap.h"
 #include "idris_rts.h"
 #include "idris_gc.h"
@@ -7,6 +11,17 @@
 #include <stdio.h>
 #include <assert.h>
 
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__)
+#define HEAP_USE_MALLOC
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
 static void c_heap_free_item(CHeap * heap, CHeapItem * item)
 {
     assert(item->size <= heap->size);
@@ -106,17 +121,83 @@ void c_heap_destroy(CHeap * heap)
     }
 }
 
-/* Used for initializing the FP heap. */
-void alloc_heap(Heap * h, size_t heap_size, size_t growth, char * old)
-{
-    char * mem = malloc(heap_size);
-    if (mem == NULL) {
-        fprintf(stderr,
-                "RTS ERROR: Unable to allocate heap. Requested %zd bytes.\n",
-                heap_size);
-        exit(EXIT_FAILURE);
+/* *** Semispace memory **
+ * Heap spaces are mapped directly from the OS where possible, so that they
+ * can be kept between collections, grown in place and, depending on the
+ * release policy, handed back to the OS while they are not in use.
+ */
+
+static void heap_alloc_failed(size_t size) {
+    fprintf(stderr,
+            "RTS ERROR: Unable to allocate heap. Requested %zd bytes.\n",
+            size);
+    exit(EXIT_FAILURE);
+}
+
+static char * map_space(size_t size) {
+#ifdef HEAP_USE_MALLOC
+    char * mem = malloc(size);
+    if (mem == NULL) heap_alloc_failed(size);
+#else
+    char * mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) heap_alloc_failed(size);
+#endif
+    return mem;
+}
+
+static void unmap_space(char * mem, size_t size) {
+    if (mem == NULL) return;
+#ifdef HEAP_USE_MALLOC
+    free(mem);
+#else
+    munmap(mem, size);
+#endif
+}
+
+// Resize a space whose contents are no longer needed.
+static char * remap_space(char * mem, size_t old_size, size_t size) {
+#if defined(HEAP_USE_MALLOC)
+    free(mem);
+    return map_space(size);
+#elif defined(__linux__)
+    mem = mremap(mem, old_size, size, MREMAP_MAYMOVE);
+    if (mem == MAP_FAILED) heap_alloc_failed(size);
+    return mem;
+#else
+    munmap(mem, old_size);
+    return map_space(size);
+#endif
+}
+
+size_t release_space(char * from, char * to, int policy) {
+#ifdef HEAP_USE_MALLOC
+    return 0;
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char * start = (char *)ALIGN((uintptr_t)from, page);
+    char * end = (char *)((uintptr_t)to & ~(page - 1));
+
+    if (policy == HEAP_RELEASE_KEEP || start >= end) {
+        return 0;
     }
+#ifdef MADV_FREE
+    if (policy == HEAP_RELEASE_FREE) {
+        if (madvise(start, end - start, MADV_FREE) == 0) {
+            return end - start;
+        }
+        // Not supported by this kernel; fall back to MADV_DONTNEED
+    }
+#endif
+    if (madvise(start, end - start, MADV_DONTNEED) == 0) {
+        return end - start;
+    }
+    return 0;
+#endif
+}
 
+static void set_space(Heap * h, char * mem, size_t size)
+{
     h->heap = mem;
 #ifdef FORCE_ALIGNMENT
     if (((i_int)(h->heap)&1) == 1) {
@@ -126,20 +207,88 @@ void alloc_heap(Heap * h, size_t heap_size, size_t growth, char * old)
     {
         h->next = h->heap;
     }
-    h->end  = h->heap + heap_size;
+    h->end  = h->heap + size;
+}
+
+/* Used for initializing the FP heap. */
+void alloc_heap(Heap * h, size_t heap_size, size_t growth, char * old)
+{
+    set_space(h, map_space(heap_size), heap_size);
 
     h->size   = heap_size;
     h->growth = growth;
 
     h->old = old;
+    h->old_size = 0;
+
+    h->views = NULL;
+    h->views_count = 0;
+    h->views_size = 0;
 }
 
-void free_heap(Heap * h) {
-    free(h->heap);
+/* Flip the semispaces at the start of a collection. The space kept from
+ * the previous collection (h->old) becomes the new, empty, heap of at
+ * least heap_size bytes, and 'from' is kept in its place until the next
+ * flip, since pointers into it may still be read after this collection.
+ */
+void flip_heap(Heap * h, char * from, size_t from_size, size_t heap_size)
+{
+    char * mem = h->old;
+    size_t size = h->old_size;
+
+    if (mem == NULL) {
+        mem = map_space(heap_size);
+        size = heap_size;
+    } else if (size < heap_size) {
+        mem = remap_space(mem, size, heap_size);
+        size = heap_size;
+    }
+
+    set_space(h, mem, size);
+    h->size = heap_size;
+
+    h->old = from;
+    h->old_size = from_size;
+}
+
+/* Switch an initialised heap to generational mode. The existing space
+ * becomes the old generation; new objects are allocated in the nursery.
+ */
+void alloc_nursery(Heap * h, size_t nursery_size)
+{
+    if (nursery_size < MIN_NURSERY_SIZE) {
+        nursery_size = MIN_NURSERY_SIZE;
+    }
+    nursery_size = ALIGN(nursery_size, 8);
+
+    char * mem = map_space(2 * nursery_size);
+
+    h->gen_heap = h->heap;
+    h->gen_next = h->next;
+    h->gen_end  = h->end;
+
+    h->nursery_size = nursery_size;
+    h->nursery = mem;
+    h->heap = mem;
+    h->next = mem;
+    h->end  = mem + nursery_size;
 
-    if (h->old != NULL) {
-        free(h->old);
+    h->remembered = NULL;
+    h->remembered_count = 0;
+    h->remembered_size = 0;
+}
+
+void free_heap(Heap * h) {
+    if (h->nursery_size > 0) {
+        unmap_space(h->nursery, 2 * h->nursery_size);
+        unmap_space(h->gen_heap, h->gen_end - h->gen_heap);
+        free(h->remembered);
+    } else {
+        unmap_space(h->heap, h->end - h->heap);
     }
+
+    unmap_space(h->old, h->old_size);
+    free(h->views);
 }
 
 
@@ -165,7 +314,20 @@ int is_valid_ref(VAL v) {
     return (v != NULL) && !(ISINT(v));
 }
 
+// Nullary constructors are allocated once, outside the heap.
+static int is_nullary_con(VAL v) {
+    int i;
+    for(i = 0; i < 256; ++i) {
+        if (v == nullary_cons[i]) return 1;
+    }
+    return 0;
+}
+
 int ref_in_heap(Heap * heap, VAL v) {
+    if (heap->nursery_size > 0 &&
+        (VAL)heap->gen_heap <= v && v < (VAL)heap->gen_next) {
+        return 1;
+    }
     return ((VAL)heap->heap <= v) && (v < (VAL)heap->next);
 }
 
@@ -177,13 +339,24 @@ int ref_in_heap(Heap * heap, VAL v) {
 //      more recently allocated closure can point only to earlier allocated one.
 // 3. After gc there should be no forward references.
 //
-void heap_check_pointers(Heap * heap) {
+static void heap_check_ref(Heap * heap, VAL ptr) {
+    if (is_valid_ref(ptr) && !ref_in_heap(heap, ptr) &&
+        !is_nullary_con(ptr) && !HASFLAG(ptr, HEAP_SHARED)) {
+        fprintf(stderr,
+                "RTS ERROR: heap closure broken. "\
+                "<HEAP %p %p %p> <REF %p>\n",
+                heap->heap, heap->next, heap->end, ptr);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void heap_check_region(Heap * heap, char * from, char * to) {
     char* scan = NULL;
 
     size_t item_size = 0;
-    for(scan = heap->heap; scan < heap->next; scan += item_size) {
-       item_size = *((size_t*)scan);
-       VAL heap_item = (VAL)(scan + sizeof(size_t));
+    for(scan = from; scan < to; scan += item_size) {
+       VAL heap_item = (VAL)scan;
+       item_size = closure_size(heap_item);
 
        switch(GETTY(heap_item)) {
        case CT_CON:
@@ -195,13 +368,7 @@ void heap_check_pointers(Heap * heap) {
 
                  if (is_valid_ref(ptr)) {
                      // Check for closure.
-                     if (!ref_in_heap(heap, ptr)) {
-                         fprintf(stderr,
-                                 "RTS ERROR: heap closure broken. "\
-                                 "<HEAP %p %p %p> <REF %p>\n",
-                                 heap->heap, heap->next, heap->end, ptr);
-                         exit(EXIT_FAILURE);
-                     }
+                     heap_check_ref(heap, ptr);
 #if 0 // TODO macro
                      // Check for unidirectionality.
                      if (!(ptr < heap_item)) {
@@ -216,6 +383,11 @@ void heap_check_pointers(Heap * heap) {
              }
              break;
            }
+       case CT_ROPE:
+           // A flattened rope's characters may be outside the heap
+           heap_check_ref(heap, heap_item->info.rope->left);
+           heap_check_ref(heap, heap_item->info.rope->right);
+           break;
        case CT_FWD:
            // Check for artifacts after cheney gc.
            fprintf(stderr, "RTS ERROR: CT_FWD in working heap.\n");
@@ -227,6 +399,13 @@ void heap_check_pointers(Heap * heap) {
     }
 }
 
+void heap_check_pointers(Heap * heap) {
+    heap_check_region(heap, heap->heap, heap->next);
+    if (heap->nursery_size > 0) {
+        heap_check_region(heap, heap->gen_heap, heap->gen_next);
+    }
+}
+
 void heap_check_all(Heap * heap)
 {
     heap_check_underflow(heap);
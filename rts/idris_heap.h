@@ -12,6 +12,7 @@
  */
 
 struct VM;
+struct Closure;
 
 #define C_HEAP_GC_TRIGGER_SIZE(heap_size) \
     (heap_size < 2048    \
@@ -83,6 +84,11 @@ CHeapItem * c_heap_create_item(void * data, size_t size, CDataFinalizer * finali
 
 /* *** Idris heap **
  * Objects without finalizers. Cheney-collected.
+ *
+ * Optionally generational: with a nursery, new objects are bump-allocated
+ * in the nursery and a minor collection promotes its survivors into the
+ * old generation, so only the survivors are copied. The old generation
+ * is Cheney-collected (together with the nursery) by a major collection.
  */
 
 typedef struct {
@@ -92,13 +98,57 @@ typedef struct {
     size_t size;   // Size of _next_ heap. Size of current heap is /end - heap/.
     size_t growth; // Quantity of heap growth in bytes.
 
-    char* old;
+    char*  old;      // The other semispace, kept between collections.
+    size_t old_size; // Its size in bytes.
+    int    release;  // What to do with unused heap pages after a collection.
+
+    // Generational mode. next/heap/end then describe the active half of
+    // the nursery, while size/growth/old apply to the old generation.
+    size_t nursery_size; // Size of one nursery half; 0 if not generational.
+    char*  nursery;      // Both halves of the nursery. They alternate, so
+                         // that the evacuated half stays intact until the
+                         // next collection, as the old semispace does.
+    char*  gen_heap;     // Bottom of the old generation
+    char*  gen_next;     // Next free chunk in the old generation
+    char*  gen_end;      // Top of the old generation
+
+    // Old objects which have been updated in place (updateCon), and so may
+    // point into the nursery. Roots for a minor collection.
+    struct Closure ** remembered;
+    size_t remembered_count;
+    size_t remembered_size;
+
+    // Views (CT_STROFFSET) of long strings met during a full collection,
+    // whose strings are copied (or trimmed) once everything else has been.
+    struct Closure ** views;
+    size_t views_count;
+    size_t views_size;
 } Heap;
 
 
+// Policies for handing free heap pages back to the OS after a collection
+#define HEAP_RELEASE_KEEP     0 // Keep them (the default)
+#define HEAP_RELEASE_FREE     1 // MADV_FREE: the OS may reclaim them lazily
+#define HEAP_RELEASE_DONTNEED 2 // MADV_DONTNEED: give them back immediately
+
 void alloc_heap(Heap * heap, size_t heap_size, size_t growth, char * old);
+void flip_heap(Heap * heap, char * from, size_t from_size, size_t heap_size);
+// Apply a release policy to the pages in [from, to); returns bytes released.
+size_t release_space(char * from, char * to, int policy);
+// Switch to generational mode: the current heap becomes the old generation.
+void alloc_nursery(Heap * heap, size_t nursery_size);
 void free_heap(Heap * heap);
 
+// Smallest nursery we allow; must comfortably exceed what C code usually
+// asks idris_requireAlloc for, since its guarantees are served from the
+// nursery.
+#define MIN_NURSERY_SIZE 262144
+
+#define IN_NURSERY(h, p) ((char*)(p) >= (h)->nursery && \
+                          (char*)(p) < (h)->nursery + 2 * (h)->nursery_size)
+#define IN_OLD_GEN(h, p) ((char*)(p) >= (h)->gen_heap && \
+                          (char*)(p) < (h)->gen_end)
+
 
 #ifdef IDRIS_DEBUG
 void heap_check_all(Heap * heap);
@@ -0,0 +1,431 @@
+#include "idris_mailbox.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAS_PTHREAD
+
+#define INDEX_INIT_SIZE 16
+
+// pthread_cond_timedwait on Darwin only measures against the time of day
+#ifdef __APPLE__
+#define MAILBOX_CLOCK CLOCK_REALTIME
+#else
+#define MAILBOX_CLOCK CLOCK_MONOTONIC
+#endif
+
+static void out_of_memory(void) {
+    fprintf(stderr, "RTS ERROR: Unable to grow mailbox.\n");
+    exit(EXIT_FAILURE);
+}
+
+/******************** Lists ***************************************************/
+
+static void list_append(MsgList* list, Msg* msg, int l) {
+    msg->next[l] = NULL;
+    msg->prev[l] = list->last;
+    if (list->last == NULL) {
+        list->first = msg;
+    } else {
+        list->last->next[l] = msg;
+    }
+    list->last = msg;
+}
+
+static void list_unlink(MsgList* list, Msg* msg, int l) {
+    if (msg->prev[l] == NULL) {
+        list->first = msg->next[l];
+    } else {
+        msg->prev[l]->next[l] = msg->next[l];
+    }
+    if (msg->next[l] == NULL) {
+        list->last = msg->prev[l];
+    } else {
+        msg->next[l]->prev[l] = msg->prev[l];
+    }
+}
+
+/******************** Indexes *************************************************/
+
+static size_t bucket(MsgIndex* idx, uintptr_t key) {
+    uint64_t h = (uint64_t)key * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> 32) & (idx->size - 1);
+}
+
+static void index_init(MsgIndex* idx) {
+    idx->size = INDEX_INIT_SIZE;
+    idx->count = 0;
+    idx->buckets = calloc(idx->size, sizeof(MsgQueue*));
+    if (idx->buckets == NULL) {
+        out_of_memory();
+    }
+}
+
+static void index_grow(MsgIndex* idx) {
+    size_t old_size = idx->size;
+    MsgQueue** old = idx->buckets;
+    size_t i;
+
+    idx->size = old_size * 2;
+    idx->buckets = calloc(idx->size, sizeof(MsgQueue*));
+    if (idx->buckets == NULL) {
+        out_of_memory();
+    }
+    for(i = 0; i < old_size; ++i) {
+        MsgQueue* q = old[i];
+        while (q != NULL) {
+            MsgQueue* next = q->next;
+            size_t b = bucket(idx, q->key);
+            q->next = idx->buckets[b];
+            idx->buckets[b] = q;
+            q = next;
+        }
+    }
+    free(old);
+}
+
+// The queue for a key; if there is none, a new one if 'create' is set, or
+// otherwise NULL.
+static MsgQueue* index_get(MsgIndex* idx, uintptr_t key, int create) {
+    MsgQueue* q;
+    for(q = idx->buckets[bucket(idx, key)]; q != NULL; q = q->next) {
+        if (q->key == key) {
+            return q;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    if (idx->count >= idx->size) {
+        index_grow(idx);
+    }
+    q = malloc(sizeof(MsgQueue));
+    if (q == NULL) {
+        out_of_memory();
+    }
+    size_t b = bucket(idx, key);
+    q->key = key;
+    q->list.first = q->list.last = NULL;
+    q->next = idx->buckets[b];
+    idx->buckets[b] = q;
+    idx->count++;
+    return q;
+}
+
+static void index_drop(MsgIndex* idx, MsgQueue* q) {
+    MsgQueue** p = &idx->buckets[bucket(idx, q->key)];
+    while (*p != q) {
+        p = &(*p)->next;
+    }
+    *p = q->next;
+    idx->count--;
+    free(q);
+}
+
+static void index_free(MsgIndex* idx) {
+    size_t i;
+    for(i = 0; i < idx->size; ++i) {
+        MsgQueue* q = idx->buckets[i];
+        while (q != NULL) {
+            MsgQueue* next = q->next;
+            free(q);
+            q = next;
+        }
+    }
+    free(idx->buckets);
+    idx->buckets = NULL;
+}
+
+static uintptr_t channel_key(int channel_id) {
+    return (uintptr_t)(unsigned int)channel_id;
+}
+
+static uintptr_t sender_key(struct VM* sender) {
+    return (uintptr_t)sender;
+}
+
+/******************** Mailboxes ***********************************************/
+
+static int matches(int channel_id, struct VM* sender,
+                   int want_channel, struct VM* want_sender) {
+    return (want_channel == 0 || channel_id == want_channel) &&
+           (want_sender == NULL || sender == want_sender);
+}
+
+void mailbox_init(Mailbox* mb, size_t limit) {
+    mb->pushed = NULL;
+    mb->count = 0;
+    mb->limit = limit;
+    mb->nextid = 1;
+    mb->closed = 0;
+    mb->sleeping = 0;
+    mb->want_channel = 0;
+    mb->want_sender = NULL;
+    mb->blocked = 0;
+    mb->waiter = NULL;
+    mb->space_waiters = NULL;
+    pthread_mutex_init(&mb->lock, NULL);
+    mailbox_cond_init(&mb->arrived);
+    pthread_cond_init(&mb->space, NULL);
+
+    mb->all.first = mb->all.last = NULL;
+    index_init(&mb->by_channel);
+    index_init(&mb->by_sender);
+}
+
+// Let blocked senders look for room again. Called with the lock held.
+static void wake_senders(Mailbox* mb) {
+    SpaceWaiter* w = mb->space_waiters;
+    mb->space_waiters = NULL;
+    pthread_cond_broadcast(&mb->space);
+    while (w != NULL) {
+        SpaceWaiter* next = w->next; // w is on the stack of w->fiber
+        sched_wake(w->fiber);
+        w = next;
+    }
+}
+
+// Move new arrivals into the lists and indexes, oldest first
+static void collect(Mailbox* mb) {
+    Msg* msg = __atomic_exchange_n(&mb->pushed, NULL, __ATOMIC_ACQUIRE);
+    Msg* oldest = NULL;
+
+    // The stack is newest first, so reverse it
+    while (msg != NULL) {
+        Msg* next = msg->pushed;
+        msg->pushed = oldest;
+        oldest = msg;
+        msg = next;
+    }
+
+    for(msg = oldest; msg != NULL; msg = msg->pushed) {
+        list_append(&mb->all, msg, MSG_ALL);
+        list_append(&index_get(&mb->by_channel,
+                               channel_key(msg->channel_id >> 1), 1)->list,
+                    msg, MSG_CHANNEL);
+        list_append(&index_get(&mb->by_sender,
+                               sender_key(msg->sender), 1)->list,
+                    msg, MSG_SENDER);
+    }
+}
+
+int mailbox_put(Mailbox* mb, Msg* msg, int channel_id, int may_block) {
+    if (mb->limit > 0 && may_block &&
+        __atomic_load_n(&mb->count, __ATOMIC_SEQ_CST) >= mb->limit) {
+        Fiber* self = sched_self();
+        pthread_mutex_lock(&mb->lock);
+        __atomic_add_fetch(&mb->blocked, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&mb->count, __ATOMIC_SEQ_CST) >= mb->limit &&
+               !__atomic_load_n(&mb->closed, __ATOMIC_SEQ_CST) &&
+               !mb->sleeping) {
+            if (self != NULL) {
+                SpaceWaiter w = { self, mb->space_waiters };
+                mb->space_waiters = &w;
+                sched_park(self, &mb->lock, NULL);
+            } else {
+                pthread_cond_wait(&mb->space, &mb->lock);
+            }
+        }
+        __atomic_sub_fetch(&mb->blocked, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&mb->lock);
+    }
+
+    // A message which races with mailbox_close is never received, and
+    // is not freed, but the mailbox itself stays valid.
+    if (__atomic_load_n(&mb->closed, __ATOMIC_SEQ_CST)) {
+        return 0;
+    }
+
+    if (channel_id == 0) {
+        // Set lowest bit to indicate this message is initiating a channel
+        channel_id = 1 + (__atomic_fetch_add(&mb->nextid, 1,
+                                             __ATOMIC_RELAXED) << 1);
+    } else {
+        channel_id = channel_id << 1;
+    }
+    msg->channel_id = channel_id;
+    channel_id = channel_id >> 1;
+    // Once it is pushed, msg may be received and freed at any time
+    struct VM* sender = msg->sender;
+    __atomic_add_fetch(&mb->count, 1, __ATOMIC_SEQ_CST);
+
+    Msg* top = __atomic_load_n(&mb->pushed, __ATOMIC_RELAXED);
+    do {
+        msg->pushed = top;
+    } while (!__atomic_compare_exchange_n(&mb->pushed, &top, msg, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    // Wake up the receiver if it is (about to be) waiting for this message.
+    // It sets 'sleeping' before it last looks at 'pushed', so one of us
+    // sees the other's write.
+    if (__atomic_load_n(&mb->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&mb->lock);
+        if (mb->sleeping && matches(channel_id, sender,
+                                    mb->want_channel, mb->want_sender)) {
+            if (mb->waiter != NULL) {
+                sched_wake(mb->waiter);
+            } else {
+                pthread_cond_signal(&mb->arrived);
+            }
+        }
+        pthread_mutex_unlock(&mb->lock);
+    }
+    return channel_id;
+}
+
+Msg* mailbox_find(Mailbox* mb, int channel_id, struct VM* sender) {
+    collect(mb);
+
+    if (channel_id != 0) {
+        MsgQueue* q = index_get(&mb->by_channel, channel_key(channel_id), 0);
+        Msg* msg;
+        if (q == NULL) {
+            return NULL;
+        }
+        // Channels are almost always between one pair of VMs, so this
+        // rarely looks past the first message.
+        for(msg = q->list.first; msg != NULL; msg = msg->next[MSG_CHANNEL]) {
+            if (sender == NULL || msg->sender == sender) {
+                return msg;
+            }
+        }
+        return NULL;
+    }
+    if (sender != NULL) {
+        MsgQueue* q = index_get(&mb->by_sender, sender_key(sender), 0);
+        return q == NULL ? NULL : q->list.first;
+    }
+    return mb->all.first;
+}
+
+Msg* mailbox_find_init(Mailbox* mb) {
+    Msg* msg;
+    collect(mb);
+    for(msg = mb->all.first; msg != NULL; msg = msg->next[MSG_ALL]) {
+        if (msg->channel_id & 1) { // init bit set
+            return msg;
+        }
+    }
+    return NULL;
+}
+
+void mailbox_remove(Mailbox* mb, Msg* msg) {
+    MsgQueue* q;
+
+    list_unlink(&mb->all, msg, MSG_ALL);
+
+    q = index_get(&mb->by_channel, channel_key(msg->channel_id >> 1), 0);
+    list_unlink(&q->list, msg, MSG_CHANNEL);
+    if (q->list.first == NULL) {
+        index_drop(&mb->by_channel, q);
+    }
+
+    q = index_get(&mb->by_sender, sender_key(msg->sender), 0);
+    list_unlink(&q->list, msg, MSG_SENDER);
+    if (q->list.first == NULL) {
+        index_drop(&mb->by_sender, q);
+    }
+
+    __atomic_sub_fetch(&mb->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mb->blocked, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&mb->lock);
+        wake_senders(mb);
+        pthread_mutex_unlock(&mb->lock);
+    }
+}
+
+Msg* mailbox_wait(Mailbox* mb, int channel_id, struct VM* sender,
+                  const struct timespec* deadline) {
+    Msg* msg = mailbox_find(mb, channel_id, sender);
+    if (msg != NULL) {
+        return msg;
+    }
+
+    Fiber* self = sched_self();
+    pthread_mutex_lock(&mb->lock);
+    mb->want_channel = channel_id;
+    mb->want_sender = sender;
+    mb->waiter = self;
+    __atomic_store_n(&mb->sleeping, 1, __ATOMIC_SEQ_CST);
+    // Nothing waiting matches what the receiver wants, so blocked senders
+    // may hold what it is waiting for. Let them through.
+    if (__atomic_load_n(&mb->blocked, __ATOMIC_SEQ_CST) > 0) {
+        wake_senders(mb);
+    }
+    // Senders only take the lock to signal, so this can look at new
+    // arrivals while holding it.
+    while ((msg = mailbox_find(mb, channel_id, sender)) == NULL) {
+        if (self != NULL) {
+            if (deadline != NULL && mailbox_expired(deadline)) {
+                break;
+            }
+            sched_park(self, &mb->lock, deadline);
+        } else if (deadline == NULL) {
+            pthread_cond_wait(&mb->arrived, &mb->lock);
+        } else if (pthread_cond_timedwait(&mb->arrived, &mb->lock,
+                                          deadline) == ETIMEDOUT) {
+            msg = mailbox_find(mb, channel_id, sender);
+            break;
+        }
+    }
+    mb->waiter = NULL;
+    __atomic_store_n(&mb->sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&mb->lock);
+    return msg;
+}
+
+void mailbox_deadline(struct timespec* deadline, int64_t usecs) {
+    clock_gettime(MAILBOX_CLOCK, deadline);
+    deadline->tv_sec += usecs / 1000000;
+    deadline->tv_nsec += (usecs % 1000000) * 1000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+int mailbox_expired(const struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(MAILBOX_CLOCK, &now);
+    return now.tv_sec > deadline->tv_sec ||
+           (now.tv_sec == deadline->tv_sec &&
+            now.tv_nsec >= deadline->tv_nsec);
+}
+
+void mailbox_cond_init(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifndef __APPLE__
+    pthread_condattr_setclock(&attr, MAILBOX_CLOCK);
+#endif
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void mailbox_close(Mailbox* mb) {
+    __atomic_store_n(&mb->closed, 1, __ATOMIC_SEQ_CST);
+    collect(mb);
+
+    Msg* msg = mb->all.first;
+    while (msg != NULL) {
+        Msg* next = msg->next[MSG_ALL];
+        shared_set_free(&msg->shared);
+        free(msg); // its region is in the same block
+        msg = next;
+    }
+    mb->all.first = mb->all.last = NULL;
+    index_free(&mb->by_channel);
+    index_free(&mb->by_sender);
+
+    // Senders may still hold a pointer to the VM, so the lock and
+    // condition variables are kept.
+    pthread_mutex_lock(&mb->lock);
+    wake_senders(mb);
+    pthread_mutex_unlock(&mb->lock);
+}
+
+#endif
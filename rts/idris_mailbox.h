@@ -0,0 +1,142 @@
+#ifndef _IDRIS_MAILBOX_H
+#define _IDRIS_MAILBOX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "idris_shared.h"
+#ifdef HAS_PTHREAD
+#include <pthread.h>
+#include "idris_sched.h"
+#endif
+
+/* *** Mailboxes ***
+ * The messages waiting for a VM.
+ *
+ * Any thread may send: senders push onto a lock-free stack. Only the
+ * receiving VM's own thread takes messages out. It moves new arrivals off
+ * the stack, in the order they were sent, into a list of all messages and
+ * into queues per channel and per sender, so that selective receive finds
+ * the first match without scanning every message.
+ *
+ * A waiting receiver says which channel and sender it is waiting for, and
+ * senders only wake it up for a message which matches. Receivers and
+ * senders which are green threads park rather than block their worker.
+ *
+ * The mailbox grows as needed. If it has a limit, senders block once that
+ * many messages are waiting, unless the receiver is itself waiting: then
+ * none of the messages suit it, and the one it wants may be from a sender
+ * which would otherwise be blocked.
+ */
+
+struct VM;
+struct Closure;
+
+// Links of a message in the mailbox's lists
+#define MSG_ALL     0 // all messages, in the order they arrived
+#define MSG_CHANNEL 1 // messages on the same channel
+#define MSG_SENDER  2 // messages from the same sender
+#define MSG_LISTS   3
+
+struct Msg_t {
+    struct VM* sender;
+    // An identifier to say which conversation this message is part of.
+    // Lowest bit is set if the id is the first message in a conversation.
+    int channel_id;
+    struct Closure* msg;
+    // The sender's copy of the message lives in a block of its own, outside
+    // any heap; idris_getMsg moves it into the receiver's heap.
+    char* region;
+    size_t region_size;
+    // The shared regions which the message points into, rather than copies
+    SharedSet shared;
+
+    struct Msg_t* pushed;            // next on the stack of new arrivals
+    struct Msg_t* prev[MSG_LISTS];
+    struct Msg_t* next[MSG_LISTS];
+};
+
+typedef struct Msg_t Msg;
+
+#ifdef HAS_PTHREAD
+
+typedef struct {
+    Msg* first;
+    Msg* last;
+} MsgList;
+
+// The messages with one key (a channel or a sender)
+typedef struct MsgQueue {
+    uintptr_t key;
+    MsgList list;
+    struct MsgQueue* next; // in the same bucket
+} MsgQueue;
+
+// A green thread waiting for room in a mailbox
+typedef struct SpaceWaiter {
+    Fiber* fiber;
+    struct SpaceWaiter* next;
+} SpaceWaiter;
+
+typedef struct {
+    MsgQueue** buckets;
+    size_t size;  // number of buckets, a power of 2
+    size_t count; // number of queues
+} MsgIndex;
+
+typedef struct Mailbox {
+    // Shared with senders
+    Msg* pushed;       // new arrivals, newest first
+    size_t count;      // messages sent and not yet received
+    size_t limit;      // senders may block when count reaches this; 0 = never
+    int nextid;        // next channel id
+    int closed;        // the receiver has terminated
+    int sleeping;      // the receiver is waiting for a message
+    int want_channel;  // on this channel (0 for any)
+    struct VM* want_sender; // from this sender (NULL for any)
+    int blocked;       // number of senders waiting for room
+    Fiber* waiter;     // the receiver, if it is a green thread and sleeping
+    SpaceWaiter* space_waiters; // blocked senders which are green threads
+    pthread_mutex_t lock;
+    pthread_cond_t arrived; // signalled for a sleeping receiver
+    pthread_cond_t space;   // signalled for blocked senders
+
+    // Owned by the receiving thread
+    MsgList all;
+    MsgIndex by_channel;
+    MsgIndex by_sender;
+} Mailbox;
+
+void mailbox_init(Mailbox* mb, size_t limit);
+// Free any messages still waiting, and wake up blocked senders
+void mailbox_close(Mailbox* mb);
+
+// Sender side, from any thread. Returns the channel id of the message
+// (allocating one if channel_id is 0), or 0 if the mailbox is closed.
+// Blocks while the mailbox is full, unless the sender is also the receiver.
+int mailbox_put(Mailbox* mb, Msg* msg, int channel_id, int may_block);
+
+// Receiver side, from the receiving VM's thread only.
+// First message on the given channel (any if 0) from the given sender (any
+// if NULL), or NULL. The message is left in the mailbox.
+Msg* mailbox_find(Mailbox* mb, int channel_id, struct VM* sender);
+// First message which starts a conversation, or NULL
+Msg* mailbox_find_init(Mailbox* mb);
+void mailbox_remove(Mailbox* mb, Msg* msg);
+// As mailbox_find, but if there is no such message wait for one to arrive.
+// Returns NULL if the deadline (from mailbox_deadline; NULL for none)
+// passes first.
+Msg* mailbox_wait(Mailbox* mb, int channel_id, struct VM* sender,
+                  const struct timespec* deadline);
+
+// The deadline 'usecs' microseconds from now. It is measured on a
+// monotonic clock where there is one, so is not moved by changes to the
+// time of day.
+void mailbox_deadline(struct timespec* deadline, int64_t usecs);
+int mailbox_expired(const struct timespec* deadline);
+// Initialise a condition variable whose timed waits take such deadlines
+void mailbox_cond_init(pthread_cond_t* cond);
+
+#endif
+
+#endif // _IDRIS_MAILBOX_H
@@ -6,7 +6,13 @@
 RTSOpts opts = { 
     .init_heap_size = 16384000,
     .max_stack_size = 4096000,
-    .show_summary   = 0
+    .nursery_size   = 0,
+    .show_summary   = 0,
+    .trace_gc       = 0,
+    .heap_release   = HEAP_RELEASE_KEEP,
+    .gc_threads     = 1,
+    .inbox_limit    = 0,
+    .max_threads    = 0
 };
 
 int main(int argc, char* argv[]) {
@@ -15,7 +21,17 @@ int main(int argc, char* argv[]) {
     __idris_argc = argc;
     __idris_argv = argv;
 
-    VM* vm = init_vm(opts.max_stack_size, opts.init_heap_size, 1);
+    VM* vm = init_vm(opts.max_stack_size, opts.init_heap_size,
+                     opts.max_threads);
+    vm->heap.release = opts.heap_release;
+    vm->stats.trace = opts.trace_gc;
+#ifdef HAS_PTHREAD
+    vm->gc_threads = opts.gc_threads;
+    vm->inbox.limit = opts.inbox_limit;
+#endif
+    if (opts.nursery_size > 0) {
+        alloc_nursery(&vm->heap, opts.nursery_size);
+    }
     init_threadkeys();
     init_threaddata(vm);
     init_gmpalloc();
@@ -0,0 +1,153 @@
+#include "idris_mmap.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__)
+#define NO_MMAP
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static void mmap_free(void* data) {
+    FileMap* map = (FileMap*)data;
+#ifndef NO_MMAP
+    if (map->size > 0) {
+        munmap(map->addr, map->size);
+    }
+#endif
+    free(map);
+}
+
+void* idris_mmapOpen(void* h, int writable) {
+#ifdef NO_MMAP
+    errno = ENOSYS;
+    return NULL;
+#else
+    FILE* f = (FILE*)h;
+    // Anything written through the handle should be in the file first
+    if (fflush(f) != 0) {
+        return NULL;
+    }
+    int fd = fileno(f);
+    struct stat buf;
+    if (fstat(fd, &buf) != 0) {
+        return NULL;
+    }
+    if ((uintmax_t)buf.st_size > SIZE_MAX) {
+        errno = EFBIG;
+        return NULL;
+    }
+
+    FileMap* map = malloc(sizeof(FileMap));
+    if (map == NULL) {
+        return NULL;
+    }
+    map->addr = NULL;
+    map->size = buf.st_size;
+    if (map->size > 0) { // mmap rejects empty mappings
+        int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* addr = mmap(NULL, map->size, prot, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            int err = errno;
+            free(map);
+            errno = err;
+            return NULL;
+        }
+        map->addr = addr;
+    }
+    return map;
+#endif
+}
+
+CData idris_mmapManage(void* map) {
+    return cdata_manage(map, ((FileMap*)map)->size, mmap_free);
+}
+
+i_int idris_mmapSize(CData map) {
+    return ((FileMap*)map->data)->size;
+}
+
+uint8_t idris_mmapPeek(CData map, i_int offset) {
+    return ((FileMap*)map->data)->addr[offset];
+}
+
+void idris_mmapPoke(CData map, i_int offset, uint8_t byte) {
+    ((FileMap*)map->data)->addr[offset] = byte;
+}
+
+VAL idris_mmapString(VM* vm, CData map, i_int offset, i_int len) {
+    FileMap* m = (FileMap*)map->data;
+    if (offset < 0 || offset > m->size) {
+        offset = m->size;
+    }
+    if (len < 0 || len > m->size - offset) {
+        len = m->size - offset;
+    }
+    VAL str = allocStr(vm, len + 1, 0);
+    if (len > 0) {
+        memcpy(str->info.str, m->addr + offset, len);
+    }
+    str->info.str[len] = '\0';
+    STRHEADER(str)->len = len;
+    return str;
+}
+
+i_int idris_mmapFind(CData map, i_int offset, uint8_t c) {
+    FileMap* m = (FileMap*)map->data;
+    if (offset < 0) {
+        offset = 0;
+    }
+    if (offset >= m->size) {
+        return -1;
+    }
+    unsigned char* p = memchr(m->addr + offset, c, m->size - offset);
+    return p == NULL ? -1 : p - m->addr;
+}
+
+int idris_mmapAdvise(CData map, i_int offset, i_int len, int advice) {
+#ifdef NO_MMAP
+    return 0; // only a hint
+#else
+    FileMap* m = (FileMap*)map->data;
+    if (offset < 0 || offset > m->size) {
+        offset = m->size;
+    }
+    if (len < 0 || len > m->size - offset) {
+        len = m->size - offset;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    // madvise wants a page aligned start
+    i_int skew = offset % sysconf(_SC_PAGESIZE);
+    offset -= skew;
+    len += skew;
+
+    int hint;
+    switch (advice) {
+    case IDRIS_MMAP_SEQUENTIAL: hint = MADV_SEQUENTIAL; break;
+    case IDRIS_MMAP_RANDOM: hint = MADV_RANDOM; break;
+    case IDRIS_MMAP_WILLNEED: hint = MADV_WILLNEED; break;
+    case IDRIS_MMAP_DONTNEED: hint = MADV_DONTNEED; break;
+    default: hint = MADV_NORMAL; break;
+    }
+    return madvise(m->addr + offset, len, hint);
+#endif
+}
+
+int idris_mmapSync(CData map) {
+#ifdef NO_MMAP
+    return 0;
+#else
+    FileMap* m = (FileMap*)map->data;
+    if (m->size == 0) {
+        return 0;
+    }
+    return msync(m->addr, m->size, MS_SYNC);
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef _IDRIS_MMAP_H
+#define _IDRIS_MMAP_H
+
+#include "idris_rts.h"
+
+/* *** Mapped files ***
+ * A whole file mapped into memory, so that its bytes can be read (and, if
+ * it was opened for writing, written) without copying them through stdio.
+ * Mappings live in the C heap: the finalizer unmaps them once nothing
+ * refers to them. Sizes and offsets are i_int, so files over 2GB work on
+ * 64 bit systems.
+ */
+
+typedef struct {
+    unsigned char* addr;
+    i_int size;
+} FileMap;
+
+// Map the file open as the handle h, shared with the file, for reading or
+// (if 'writable' is nonzero, which h must allow) for reading and writing.
+// Returns NULL, with errno set, on failure. Pass the result straight to
+// idris_mmapManage.
+void* idris_mmapOpen(void* h, int writable);
+// Wrap a mapping as a C data block, which unmaps it when collected
+CData idris_mmapManage(void* map);
+
+i_int idris_mmapSize(CData map);
+uint8_t idris_mmapPeek(CData map, i_int offset);
+void idris_mmapPoke(CData map, i_int offset, uint8_t byte);
+// A string of the 'len' bytes at 'offset'
+VAL idris_mmapString(VM* vm, CData map, i_int offset, i_int len);
+// Where the next 'c' at or after 'offset' is, or -1 if there is none
+i_int idris_mmapFind(CData map, i_int offset, uint8_t c);
+
+// Hints for madvise: how the mapping will be read
+#define IDRIS_MMAP_NORMAL 0
+#define IDRIS_MMAP_SEQUENTIAL 1
+#define IDRIS_MMAP_RANDOM 2
+#define IDRIS_MMAP_WILLNEED 3
+#define IDRIS_MMAP_DONTNEED 4
+
+// Returns 0 on success, or -1 with errno set
+int idris_mmapAdvise(CData map, i_int offset, i_int len, int advice);
+// Write changes back to the file. Returns 0 on success, or -1 with errno set
+int idris_mmapSync(CData map);
+
+#endif
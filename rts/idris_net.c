@@ -1,8 +1,12 @@
 // C-Side of the Idris network library
 // (C) Simon Fowler, 2014
 // MIT Licensed. Have fun!
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for recvmmsg and sendmmsg
+#endif
 #include "idris_net.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -12,21 +16,33 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#ifdef HAS_PTHREAD
+#include <pthread.h>
+#endif
+#include "idris_buffer.h"
+
+// Whole 32 bit words only: any bytes left over are not touched. Written a
+// word at a time like this, compilers can vectorise the loop.
 void buf_htonl(void* buf, int len) {
-    int* buf_i = (int*) buf;
+    unsigned char* bytes = (unsigned char*) buf;
     int i;
-    for (i = 0; i < (len / sizeof(int)) + 1; i++) {
-        buf_i[i] = htonl(buf_i[i]);
+    for (i = 0; i + 4 <= len; i += 4) {
+        uint32_t word;
+        memcpy(&word, bytes + i, 4);
+        word = htonl(word);
+        memcpy(bytes + i, &word, 4);
     }
 }
 
 void buf_ntohl(void* buf, int len) {
-    int* buf_i = (int*) buf;
-    int i;
-    for (i = 0; i < (len / sizeof(int)) + 1; i++) {
-        buf_i[i] = ntohl(buf_i[i]);
-    }
+    buf_htonl(buf, len); // the same swap, either way
 }
 
 void* idrnet_malloc(int size) {
@@ -37,6 +53,103 @@ void idrnet_free(void* ptr) {
     free(ptr);
 }
 
+/* The results of idrnet_recv and idrnet_recvfrom each come in one block,
+ * along with their payload and remote address. Freed blocks are kept for
+ * reuse, a few per thread, so that a service receiving packet after packet
+ * does not malloc (and zero) anything after the first few.
+ */
+
+typedef struct recv_block {
+    struct recv_block* next; // in the pool
+    int size;                // room for the payload, not counting a 0
+    union {
+        idrnet_recv_result recv;
+        idrnet_recvfrom_result from;
+    } res;
+    struct sockaddr_storage addr;
+    char payload[];
+} recv_block;
+
+#define RECV_POOL_MAX 32
+
+typedef struct {
+    recv_block* first;
+    int count;
+} recv_pool;
+
+#define BLOCK_OF(res_struct) \
+    ((recv_block*)((char*)(res_struct) - offsetof(recv_block, res)))
+
+#ifdef HAS_PTHREAD
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void free_pool(void* data) {
+    recv_pool* pool = (recv_pool*)data;
+    while (pool->first != NULL) {
+        recv_block* next = pool->first->next;
+        free(pool->first);
+        pool->first = next;
+    }
+    free(pool);
+}
+
+static void create_pool_key(void) {
+    pthread_key_create(&pool_key, free_pool);
+}
+
+static recv_pool* get_pool(void) {
+    pthread_once(&pool_once, create_pool_key);
+    recv_pool* pool = pthread_getspecific(pool_key);
+    if (pool == NULL) {
+        pool = calloc(1, sizeof(recv_pool));
+        if (pool != NULL) {
+            pthread_setspecific(pool_key, pool);
+        }
+    }
+    return pool;
+}
+#else
+static recv_pool the_pool;
+
+static recv_pool* get_pool(void) {
+    return &the_pool;
+}
+#endif
+
+static recv_block* get_block(int len) {
+    recv_pool* pool = get_pool();
+    recv_block** p;
+    if (pool != NULL) {
+        // The same length is usually asked for every time, so this rarely
+        // looks past the first block
+        for (p = &pool->first; *p != NULL; p = &(*p)->next) {
+            if ((*p)->size >= len) {
+                recv_block* block = *p;
+                *p = block->next;
+                pool->count--;
+                return block;
+            }
+        }
+    }
+    recv_block* block = malloc(sizeof(recv_block) + len + 1);
+    if (block != NULL) {
+        block->size = len;
+    }
+    return block;
+}
+
+static void put_block(recv_block* block) {
+    recv_pool* pool = get_pool();
+    if (pool != NULL && pool->count < RECV_POOL_MAX) {
+        block->next = pool->first;
+        pool->first = block;
+        pool->count++;
+    } else {
+        free(block);
+    }
+}
+
 // We call this from quite a few functions. Given a textual host and an int port,
 // populates a struct addrinfo.
 int idrnet_getaddrinfo(struct addrinfo** address_res, char* host, int port,
@@ -125,42 +238,87 @@ int idrnet_accept(int sockfd, void* sockaddr) {
     return accept(sockfd, addr, &addr_size);
 }
 
+int idrnet_set_nonblocking(int sockfd) {
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+}
+
 int idrnet_send(int sockfd, char* data) {
     int len = strlen(data); // For now.
     return send(sockfd, (void*) data, len, 0);
 }
 
 int idrnet_send_buf(int sockfd, void* data, int len) {
-    void* buf_cpy = malloc(len);
-    memset(buf_cpy, 0, len);
-    memcpy(buf_cpy, data, len);
-    buf_htonl(buf_cpy, len);
-    int res = send(sockfd, buf_cpy, len, 0);
-    free(buf_cpy);
-    return res;
+    return send(sockfd, data, len, 0);
 }
 
 void* idrnet_recv(int sockfd, int len) {
-    idrnet_recv_result* res_struct =
-        (idrnet_recv_result*) malloc(sizeof(idrnet_recv_result));
-    char* buf = malloc(len + 1);
-    memset(buf, 0, len + 1);
-    int recv_res = recv(sockfd, buf, len, 0);
-    res_struct->result = recv_res;
-
-    if (recv_res > 0) { // Data was received
-        buf[recv_res + 1] = 0x00; // Null-term, so Idris can interpret it
+    if (len < 0) { // recv would take it as a huge size_t
+        len = 0;
+    }
+    recv_block* block = get_block(len);
+    if (block == NULL) {
+        return NULL;
     }
-    res_struct->payload = buf;
+    idrnet_recv_result* res_struct = &block->res.recv;
+    int recv_res = recv(sockfd, block->payload, len, 0);
+    res_struct->result = recv_res;
+    // Null-term, so Idris can interpret it
+    block->payload[recv_res > 0 ? recv_res : 0] = 0x00;
+    res_struct->payload = block->payload;
     return (void*) res_struct;
 }
 
 int idrnet_recv_buf(int sockfd, void* buf, int len) {
-    int recv_res = recv(sockfd, buf, len, 0);
-    if (recv_res != -1) {
-        buf_ntohl(buf, len);
+    return recv(sockfd, buf, len, 0);
+}
+
+void* idrnet_iov_new(int count) {
+    return calloc(count, sizeof(struct iovec));
+}
+
+void idrnet_iov_set(void* iov, int i, void* buf, int len) {
+    struct iovec* v = (struct iovec*) iov;
+    v[i].iov_base = buf;
+    v[i].iov_len = len;
+}
+
+int idrnet_writev(int sockfd, void* iov, int count) {
+    return writev(sockfd, (struct iovec*) iov, count);
+}
+
+int idrnet_readv(int sockfd, void* iov, int count) {
+    return readv(sockfd, (struct iovec*) iov, count);
+}
+
+i_int idrnet_sendfile(int sockfd, void* h, i_int offset, i_int len) {
+    int fd = fileno((FILE*) h);
+    i_int sent = 0;
+    while (sent < len) {
+#ifdef __linux__
+        off_t off = offset + sent;
+        ssize_t res = sendfile(sockfd, fd, &off, len - sent);
+#else
+        // Through a buffer, where there is no (Linux style) sendfile
+        char buf[65536];
+        size_t want = len - sent < (i_int) sizeof(buf) ? len - sent : sizeof(buf);
+        ssize_t res = pread(fd, buf, want, offset + sent);
+        if (res > 0) {
+            res = send(sockfd, buf, res, 0);
+        }
+#endif
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) { // an error, or the end of the file
+            return sent > 0 || res == 0 ? sent : -1;
+        }
+        sent += res;
     }
-    return recv_res;
+    return sent;
 }
 
 int idrnet_get_recv_res(void* res_struct) {
@@ -172,12 +330,9 @@ char* idrnet_get_recv_payload(void* res_struct) {
 }
 
 void idrnet_free_recv_struct(void* res_struct) {
-    idrnet_recv_result* i_res_struct =
-        (idrnet_recv_result*) res_struct;
-    if (i_res_struct->payload != NULL) {
-        free(i_res_struct->payload);
+    if (res_struct != NULL) {
+        put_block(BLOCK_OF(res_struct));
     }
-    free(res_struct);
 }
 
 int idrnet_errno() {
@@ -208,8 +363,6 @@ int idrnet_sendto_buf(int sockfd, void* buf, int buf_len, char* host, int port,
         return -1;
     }
 
-    buf_htonl(buf, buf_len);
-
     int send_res = sendto(sockfd, buf, buf_len, 0,
                         remote_host->ai_addr, remote_host->ai_addrlen);
     if (send_res == -1) {
@@ -226,58 +379,50 @@ void* idrnet_recvfrom(int sockfd, int len) {
  * int recvfrom(int sockfd, void *buf, int len, unsigned int flags,
              struct sockaddr *from, int *fromlen);
 */
-    // Allocate the required structures, and nuke them
-    struct sockaddr_storage* remote_addr =
-        (struct sockaddr_storage*) malloc(sizeof(struct sockaddr_storage));
-    char* buf = (char*) malloc(len + 1);
-    idrnet_recvfrom_result* ret =
-        (idrnet_recvfrom_result*) malloc(sizeof(idrnet_recvfrom_result));
-    memset(remote_addr, 0, sizeof(struct sockaddr_storage));
-    memset(buf, 0, len + 1);
-    memset(ret, 0, sizeof(idrnet_recvfrom_result));
+    if (len < 0) {
+        len = 0;
+    }
+    recv_block* block = get_block(len);
+    if (block == NULL) {
+        return NULL;
+    }
+    idrnet_recvfrom_result* ret = &block->res.from;
     socklen_t fromlen = sizeof(struct sockaddr_storage);
 
-    int recv_res = recvfrom(sockfd, buf, len, 0, (struct sockaddr*) remote_addr, &fromlen);
+    int recv_res = recvfrom(sockfd, block->payload, len, 0,
+                            (struct sockaddr*) &block->addr, &fromlen);
     ret->result = recv_res;
     // Check for failure...
     if (recv_res == -1) {
-        free(buf);
-        free(remote_addr);
+        ret->payload = NULL;
+        ret->remote_addr = NULL;
     } else {
         // If data was received, process and populate
-        ret->result = recv_res;
-        ret->remote_addr = remote_addr;
-        // Ensure the last byte is NULL, since in this mode we're sending strings
-        buf[len] = 0x00;
-        ret->payload = (void*) buf;
+        ret->remote_addr = &block->addr;
+        // Ensure the payload ends in NULL, since in this mode we're sending
+        // strings
+        block->payload[recv_res] = 0x00;
+        ret->payload = (void*) block->payload;
     }
 
     return ret;
 }
 
 void* idrnet_recvfrom_buf(int sockfd, void* buf, int len) {
-    // Allocate the required structures, and nuke them
-    struct sockaddr_storage* remote_addr =
-        (struct sockaddr_storage*) malloc(sizeof(struct sockaddr_storage));
-    idrnet_recvfrom_result* ret =
-        (idrnet_recvfrom_result*) malloc(sizeof(idrnet_recvfrom_result));
-    memset(remote_addr, 0, sizeof(struct sockaddr_storage));
-    memset(ret, 0, sizeof(idrnet_recvfrom_result));
-    socklen_t fromlen = 0;
-
-    int recv_res = recvfrom(sockfd, buf, len, 0, (struct sockaddr*) remote_addr, &fromlen);
-    // Check for failure... But don't free the buffer! Not our job.
-    ret->result = recv_res;
-    if (recv_res == -1) {
-        free(remote_addr);
+    recv_block* block = get_block(0);
+    if (block == NULL) {
+        return NULL;
     }
+    idrnet_recvfrom_result* ret = &block->res.from;
+    socklen_t fromlen = sizeof(struct sockaddr_storage);
+
+    int recv_res = recvfrom(sockfd, buf, len, 0,
+                            (struct sockaddr*) &block->addr, &fromlen);
+    ret->result = recv_res;
     // Payload will be NULL -- since it's been put into the user-specified buffer. We
     // still need the return struct to get our hands on the remote address, though.
-    if (recv_res > 0) {
-        buf_ntohl(buf, len);
-        ret->payload = NULL;
-        ret->remote_addr = remote_addr;
-    }
+    ret->payload = NULL;
+    ret->remote_addr = recv_res > 0 ? &block->addr : NULL;
     return ret;
 }
 
@@ -305,13 +450,151 @@ int idrnet_get_recvfrom_port(void* res_struct) {
 }
 
 void idrnet_free_recvfrom_struct(void* res_struct) {
-    idrnet_recvfrom_result* recv_struct = (idrnet_recvfrom_result*) res_struct;
-    if (recv_struct != NULL) {
-        if (recv_struct->payload != NULL) {
-            free(recv_struct->payload);
+    if (res_struct != NULL) {
+        put_block(BLOCK_OF(res_struct));
+    }
+}
+
+/* Batches of datagrams, sent and received with one call. The headers are
+ * kept from one call to the next, and the datagrams themselves are in an
+ * Idris Buffer, one per slot of a fixed size.
+ */
+
+#ifdef __linux__
+typedef struct mmsghdr idrnet_msg;
+#else
+// The same shape, for the loop which stands in for recvmmsg and sendmmsg
+typedef struct {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} idrnet_msg;
+#endif
+
+typedef struct {
+    int size;
+    struct sockaddr_storage* addrs;
+    idrnet_msg* msgs;
+    struct iovec* iovs;
+} idrnet_msgs;
+
+void* idrnet_msgs_new(int count) {
+    if (count < 1) {
+        count = 1;
+    }
+    // One block: the addresses first, as they need the most alignment
+    idrnet_msgs* batch = malloc(sizeof(idrnet_msgs) +
+                                count * (sizeof(struct sockaddr_storage) +
+                                         sizeof(idrnet_msg) +
+                                         sizeof(struct iovec)));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->size = count;
+    batch->addrs = (struct sockaddr_storage*)(batch + 1);
+    batch->msgs = (idrnet_msg*)(batch->addrs + count);
+    batch->iovs = (struct iovec*)(batch->msgs + count);
+    memset(batch->msgs, 0, count * sizeof(idrnet_msg));
+    return batch;
+}
+
+int idrnet_msgs_len(void* msgs, int i) {
+    idrnet_msgs* batch = (idrnet_msgs*) msgs;
+    return i >= 0 && i < batch->size ? (int)batch->msgs[i].msg_len : 0;
+}
+
+void idrnet_msgs_set_len(void* msgs, int i, int len) {
+    idrnet_msgs* batch = (idrnet_msgs*) msgs;
+    if (i >= 0 && i < batch->size) {
+        batch->msgs[i].msg_len = len > 0 ? len : 0;
+    }
+}
+
+void* idrnet_msgs_addr(void* msgs, int i) {
+    idrnet_msgs* batch = (idrnet_msgs*) msgs;
+    return i >= 0 && i < batch->size ? &batch->addrs[i] : NULL;
+}
+
+// How many whole slots there are, up to 'count', from 'loc' in buf
+static int msgs_slots(idrnet_msgs* batch, VAL buf, int loc, int slot,
+                      int count) {
+    i_int size = BUFFER_SIZE(buf);
+    if (loc < 0 || loc > size || slot <= 0) {
+        return 0;
+    }
+    i_int fit = (size - loc) / slot;
+    if (count > fit) {
+        count = (int)fit;
+    }
+    return count < batch->size ? count : batch->size;
+}
+
+int idrnet_recvmsgs(int sockfd, void* msgs, VAL buf, int loc, int slot,
+                    int count) {
+    idrnet_msgs* batch = (idrnet_msgs*) msgs;
+    int i;
+    count = msgs_slots(batch, buf, loc, slot, count);
+    if (count == 0) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        struct msghdr* hdr = &batch->msgs[i].msg_hdr;
+        batch->iovs[i].iov_base = BUFFER_DATA(buf) + loc + (size_t)i * slot;
+        batch->iovs[i].iov_len = slot;
+        memset(hdr, 0, sizeof(struct msghdr));
+        hdr->msg_name = &batch->addrs[i];
+        hdr->msg_namelen = sizeof(struct sockaddr_storage);
+        hdr->msg_iov = &batch->iovs[i];
+        hdr->msg_iovlen = 1;
+        batch->msgs[i].msg_len = 0;
+    }
+#ifdef __linux__
+    // Wait for the first datagram only, then take what has arrived
+    return recvmmsg(sockfd, batch->msgs, count, MSG_WAITFORONE, NULL);
+#else
+    for (i = 0; i < count; i++) {
+        ssize_t n = recvmsg(sockfd, &batch->msgs[i].msg_hdr,
+                            i == 0 ? 0 : MSG_DONTWAIT);
+        if (n < 0) {
+            return i == 0 ? -1 : i;
         }
-        if (recv_struct->remote_addr != NULL) {
-            free(recv_struct->remote_addr);
+        batch->msgs[i].msg_len = n;
+    }
+    return count;
+#endif
+}
+
+int idrnet_sendmsgs(int sockfd, void* msgs, VAL buf, int loc, int slot,
+                    int count, int reply) {
+    idrnet_msgs* batch = (idrnet_msgs*) msgs;
+    int i;
+    count = msgs_slots(batch, buf, loc, slot, count);
+    if (count == 0) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        struct msghdr* hdr = &batch->msgs[i].msg_hdr;
+        unsigned int len = batch->msgs[i].msg_len;
+        batch->iovs[i].iov_base = BUFFER_DATA(buf) + loc + (size_t)i * slot;
+        batch->iovs[i].iov_len = len < (unsigned int)slot ? len : slot;
+        // Replies go to where the last idrnet_recvmsgs left the address
+        // and its length
+        socklen_t namelen = reply ? hdr->msg_namelen : 0;
+        memset(hdr, 0, sizeof(struct msghdr));
+        hdr->msg_name = reply ? &batch->addrs[i] : NULL;
+        hdr->msg_namelen = namelen;
+        hdr->msg_iov = &batch->iovs[i];
+        hdr->msg_iovlen = 1;
+    }
+#ifdef __linux__
+    return sendmmsg(sockfd, batch->msgs, count, 0);
+#else
+    for (i = 0; i < count; i++) {
+        ssize_t n = sendmsg(sockfd, &batch->msgs[i].msg_hdr, 0);
+        if (n < 0) {
+            return i == 0 ? -1 : i;
         }
+        batch->msgs[i].msg_len = n;
     }
+    return count;
+#endif
 }
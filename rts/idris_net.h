@@ -1,8 +1,12 @@
 #ifndef IDRISNET_H
 #define IDRISNET_H
 
+#include <stdint.h>
+#include "idris_rts.h"
+
 struct sockaddr_storage;
 struct addrinfo;
+struct Closure;
 
 typedef struct idrnet_recv_result {
     int result;
@@ -39,6 +43,11 @@ void* idrnet_create_sockaddr();
 // Accept
 int idrnet_accept(int sockfd, void* sockaddr);
 
+// Make calls on the socket fail with EAGAIN (EWOULDBLOCK on Windows)
+// rather than wait, as they must for a socket watched by a reactor.
+// Returns 0 on success, or -1 with errno set.
+int idrnet_set_nonblocking(int sockfd);
+
 // Send
 int idrnet_send(int sockfd, char* data);
 int idrnet_send_buf(int sockfd, void* data, int len);
@@ -49,6 +58,23 @@ void* idrnet_recv(int sockfd, int len);
 // Receives directly into a buffer
 int idrnet_recv_buf(int sockfd, void* buf, int len);
 
+// Scatter/gather: an array of 'count' buffers, filled in with
+// idrnet_iov_set and freed with idrnet_free, to send or receive in one call
+void* idrnet_iov_new(int count);
+void idrnet_iov_set(void* iov, int i, void* buf, int len);
+int idrnet_writev(int sockfd, void* iov, int count);
+int idrnet_readv(int sockfd, void* iov, int count);
+
+// Send 'len' bytes of the file open as the handle h, from 'offset', without
+// copying them through user space where the system allows. Returns how
+// many were sent, or -1 if none were.
+i_int idrnet_sendfile(int sockfd, void* h, i_int offset, i_int len);
+
+// The buffers are sent and received as they are. Convert the byte order of
+// the whole 32 bit words in one, in place, if the protocol wants it.
+void buf_htonl(void* buf, int len);
+void buf_ntohl(void* buf, int len);
+
 // UDP Send
 int idrnet_sendto(int sockfd, char* data, char* host, int port, int family);
 int idrnet_sendto_buf(int sockfd, void* buf, int buf_len, char* host, int port, int family);
@@ -69,6 +95,28 @@ char* idrnet_get_recvfrom_payload(void* res_struct);
 void* idrnet_get_recvfrom_sockaddr(void* res_struct);
 void idrnet_free_recvfrom_struct(void* res_struct);
 
+// Batches of datagrams, received or sent in one call (recvmmsg and
+// sendmmsg on Linux). A batch holds the headers for 'count' datagrams, to
+// be used again and again, and is freed with idrnet_free. The datagrams
+// themselves are in a Buffer, datagram i in the 'slot' bytes from
+// loc + i * slot; there are as many as there are whole slots in the buffer,
+// up to 'count'.
+void* idrnet_msgs_new(int count);
+// How long datagram i is: as received, or as set to be sent
+int idrnet_msgs_len(void* msgs, int i);
+void idrnet_msgs_set_len(void* msgs, int i, int len);
+// Where datagram i came from, as a sockaddr
+void* idrnet_msgs_addr(void* msgs, int i);
+// Receive at least one datagram, waiting if need be, and then as many as
+// have arrived. Returns how many there were, or -1 if none.
+int idrnet_recvmsgs(int sockfd, void* msgs, struct Closure* buf, int loc,
+                    int slot, int count);
+// Send datagrams of the lengths which idrnet_msgs_len gives, to where they
+// came from if 'reply' is nonzero (or else on a connected socket).
+// Returns how many were sent, or -1 if none were.
+int idrnet_sendmsgs(int sockfd, void* msgs, struct Closure* buf, int loc,
+                    int slot, int count, int reply);
+
 
 int idrnet_getaddrinfo(struct addrinfo** address_res, char* host, 
     int port, int family, int socket_type);
@@ -1,4 +1,5 @@
 #include "idris_opts.h"
+#include "idris_heap.h"
 
 #include <stdlib.h>
 #include <stddef.h>
@@ -11,8 +12,20 @@
     "Options:\n\n"                                              \
     "  -?    Print this message and exits.\n"                   \
     "  -s    Summary GC statistics.\n"                          \
+    "  -S    Report the cost of each collection on stderr.\n"   \
     "  -H    Initial heap size. Egs: -H4M, -H500K, -H1G\n"      \
     "  -K    Sets the maximum stack size. Egs: -K8M\n"          \
+    "  -A    Use a generational heap with the given nursery\n"   \
+    "        size. Egs: -A1M\n"                                  \
+    "  -R    What to do with free heap pages after a GC: keep\n" \
+    "        them (default), or give them back to the OS with\n" \
+    "        free (lazily) or dontneed (at once). Egs: -Rfree\n" \
+    "  -N    Number of threads copying in a full collection.\n" \
+    "        Egs: -N4\n"                                         \
+    "  -Q    Number of messages which may wait in a process's\n" \
+    "        inbox before senders block. Egs: -Q10000\n"         \
+    "  -P    Run processes as green threads on the given\n"      \
+    "        number of worker threads. Egs: -P4\n"               \
     "\n"
 
 void print_usage(FILE * s) {
@@ -50,6 +63,35 @@ int read_size(char * str) {
 }
 
 
+int read_count(char * str) {
+    int n = 0;
+    char rest = ' ';
+
+    if (sscanf(str, "%d%c", &n, &rest) != 1 || n < 1) {
+        fprintf(stderr, "RTS Opts: Expected a positive number. Egs: 4.\n");
+        print_usage(stderr);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+int read_release(char * str) {
+    if (strcmp(str, "keep") == 0)
+        return HEAP_RELEASE_KEEP;
+    if (strcmp(str, "free") == 0)
+        return HEAP_RELEASE_FREE;
+    if (strcmp(str, "dontneed") == 0)
+        return HEAP_RELEASE_DONTNEED;
+
+    fprintf(stderr,
+            "RTS Opts: Unknown release policy `%s'.\n" \
+            "          Possible policies are keep, free or dontneed.\n",
+            str);
+    print_usage(stderr);
+    exit(EXIT_FAILURE);
+}
+
+
 int parse_args(RTSOpts * opts, int argc, char *argv[])
 {
     if (argc == 0)
@@ -81,6 +123,16 @@ int parse_args(RTSOpts * opts, int argc, char *argv[])
             opts->show_summary = 1;
             break;
 
+        case 'S':
+#ifdef IDRIS_ENABLE_STATS
+            opts->trace_gc = 1;
+#else
+            fprintf(stderr,
+                    "RTS Opts: -S needs an RTS built with IDRIS_ENABLE_STATS;" \
+                    " ignoring it.\n");
+#endif
+            break;
+
         case 'H':
             opts->init_heap_size = read_size(argv[i] + 2);
             break;
@@ -89,6 +141,26 @@ int parse_args(RTSOpts * opts, int argc, char *argv[])
             opts->max_stack_size = read_size(argv[i] + 2);
             break;
 
+        case 'A':
+            opts->nursery_size = read_size(argv[i] + 2);
+            break;
+
+        case 'N':
+            opts->gc_threads = read_count(argv[i] + 2);
+            break;
+
+        case 'Q':
+            opts->inbox_limit = read_count(argv[i] + 2);
+            break;
+
+        case 'P':
+            opts->max_threads = read_count(argv[i] + 2);
+            break;
+
+        case 'R':
+            opts->heap_release = read_release(argv[i] + 2);
+            break;
+
         default:
             printf("RTS opts: Wrong argument: %s\n", argv[i]);
             print_usage(stderr);
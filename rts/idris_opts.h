@@ -7,7 +7,13 @@
 typedef struct {
     size_t init_heap_size;
     size_t max_stack_size;
+    size_t nursery_size;   // 0 for a single, non-generational heap
     int    show_summary;
+    int    trace_gc;       // report each collection on stderr
+    int    heap_release;   // one of the HEAP_RELEASE_* policies
+    int    gc_threads;     // threads copying in a full collection
+    size_t inbox_limit;    // messages waiting before senders block; 0 = none
+    int    max_threads;    // workers running processes as green threads
 } RTSOpts;
 
 void print_usage(FILE * s);
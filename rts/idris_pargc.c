@@ -0,0 +1,566 @@
+#include "idris_rts.h"
+#include "idris_gc.h"
+#include "idris_gmp.h"
+#include "idris_pargc.h"
+
+#include <assert.h>
+
+#ifdef HAS_PTHREAD
+
+#define PLAB_SIZE 32768
+// Bigger objects are given their own piece of the to-space, which keeps the
+// space wasted at the end of each PLAB small.
+#define PLAB_MAX_OBJECT 1024
+// The smallest gap that can be filled with a dummy object, so that the
+// to-space can still be walked from start to end.
+#define MIN_FILLER (sizeof(Closure))
+// How many objects a thread scans between checks for idle threads
+#define SHARE_INTERVAL 64
+
+// Transient closure type of an object while a thread is copying it. Other
+// threads wait for it to become CT_FWD.
+#define CT_BUSY 0xffff
+
+typedef struct {
+    char* from;
+    char* to;
+} GrayRange;
+
+typedef struct GCWorkers {
+    int nthreads;
+    pthread_t* threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start; // a collection has started (or shut down)
+    pthread_cond_t work;  // a gray range has been shared (or all done)
+    pthread_cond_t done;  // a thread has finished its part
+    int epoch;            // number of collections started
+    int shutdown;
+    int running;          // threads still working on this collection
+
+    // State of the current collection
+    VM* vm;
+    char* from1;
+    char* from1_end;
+    char* from2;
+    char* from2_end;
+    char* next;           // shared allocation pointer into the to-space
+    char* end;
+
+    GrayRange* pool;      // copied objects which no thread is scanning
+    size_t pool_count;
+    size_t pool_size;
+    int idle;             // threads waiting for a gray range
+    int finished;         // no work is left anywhere
+} GCWorkers;
+
+typedef struct {
+    GCWorkers* g;
+    int id;
+    char* next;           // the thread's PLAB
+    char* end;
+    char* scan;           // copied but unscanned objects: [scan, next)
+    int since_share;
+} GCWorker;
+
+static void out_of_space(void) {
+    fprintf(stderr, "RTS ERROR: Parallel GC ran out of to-space.\n");
+    exit(EXIT_FAILURE);
+}
+
+size_t idris_par_slack(VM* vm, size_t used) {
+    // PLABs are retired when the next object does not fit, so each wastes
+    // less than PLAB_MAX_OBJECT bytes; and each thread has one PLAB open.
+    return used / (PLAB_SIZE / PLAB_MAX_OBJECT) + vm->gc_threads * PLAB_SIZE;
+}
+
+/******************** Gray range pool *****************************************/
+
+static void push_range(GCWorkers* g, char* from, char* to) {
+    if (from >= to) return;
+
+    pthread_mutex_lock(&g->lock);
+    if (g->pool_count == g->pool_size) {
+        g->pool_size = g->pool_size == 0 ? 256 : g->pool_size * 2;
+        g->pool = realloc(g->pool, g->pool_size * sizeof(GrayRange));
+        if (g->pool == NULL) {
+            fprintf(stderr, "RTS ERROR: Unable to grow GC work pool.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    g->pool[g->pool_count].from = from;
+    g->pool[g->pool_count].to = to;
+    g->pool_count++;
+    pthread_cond_signal(&g->work);
+    pthread_mutex_unlock(&g->lock);
+}
+
+// Take a range to scan, waiting for one if necessary. Returns 0 when every
+// thread is out of work, and so the copy is complete.
+static int take_range(GCWorkers* g, GrayRange* r) {
+    pthread_mutex_lock(&g->lock);
+    for(;;) {
+        if (g->pool_count > 0) {
+            *r = g->pool[--g->pool_count];
+            pthread_mutex_unlock(&g->lock);
+            return 1;
+        }
+        if (g->finished) {
+            pthread_mutex_unlock(&g->lock);
+            return 0;
+        }
+        // Updated atomically, since maybe_share peeks at it without the lock
+        if (__atomic_add_fetch(&g->idle, 1, __ATOMIC_RELAXED) == g->nthreads) {
+            g->finished = 1;
+            pthread_cond_broadcast(&g->work);
+            pthread_mutex_unlock(&g->lock);
+            return 0;
+        }
+        pthread_cond_wait(&g->work, &g->lock);
+        __atomic_sub_fetch(&g->idle, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/******************** To-space allocation *************************************/
+
+static char* shared_alloc(GCWorkers* g, size_t size) {
+    char* p = __atomic_fetch_add(&g->next, size, __ATOMIC_RELAXED);
+    if (p + size > g->end) {
+        out_of_space();
+    }
+    return p;
+}
+
+// Fill the end of a chunk with a dummy object
+static void fill(char* from, char* to) {
+    size_t size = to - from;
+    if (size == 0) return;
+
+    assert(size >= MIN_FILLER);
+    VAL cl = (VAL)from;
+    cl->ty = CT_RAWDATA;
+    cl->info.size = size - sizeof(Closure);
+}
+
+static void retire_plab(GCWorker* w) {
+    // Nobody else will scan what is left in this PLAB
+    push_range(w->g, w->scan, w->next);
+    fill(w->next, w->end);
+    w->next = w->end = w->scan = NULL;
+}
+
+static void new_plab(GCWorker* w) {
+    GCWorkers* g = w->g;
+    char* p = __atomic_fetch_add(&g->next, PLAB_SIZE, __ATOMIC_RELAXED);
+    if (p + MIN_FILLER > g->end) {
+        out_of_space();
+    }
+    w->next = w->scan = p;
+    w->end = p + PLAB_SIZE < g->end ? p + PLAB_SIZE : g->end;
+}
+
+// Objects have no size header, so a gap too small for a filler can't be
+// skipped over; an object fits only if it fills the PLAB exactly or leaves
+// room for a filler.
+static inline int plab_fits(GCWorker* w, size_t size) {
+    size_t room = w->end - w->next;
+    return size == room || size + MIN_FILLER <= room;
+}
+
+// Allocate a chunk for an object of the given size; *separate is set if it
+// is not in the thread's PLAB, and so will not be scanned unless shared.
+static VAL gc_alloc(GCWorker* w, size_t size, int* separate) {
+    if ((size & 7) != 0) {
+        size = 8 + ((size >> 3) << 3);
+    }
+    char* p;
+
+    if (size > PLAB_MAX_OBJECT) {
+        p = shared_alloc(w->g, size);
+        *separate = 1;
+    } else {
+        if (w->next == NULL || !plab_fits(w, size)) {
+            if (w->next != NULL) {
+                retire_plab(w);
+            }
+            new_plab(w);
+            if (!plab_fits(w, size)) {
+                out_of_space();
+            }
+        }
+        p = w->next;
+        w->next += size;
+        *separate = 0;
+    }
+
+    VAL cl = (VAL)p;
+    memset(cl, 0, size);
+    return cl;
+}
+
+/******************** Copying *************************************************/
+
+static inline int in_from_space(GCWorkers* g, VAL x) {
+    return ((char*)x >= g->from1 && (char*)x < g->from1_end) ||
+           ((char*)x >= g->from2 && (char*)x < g->from2_end);
+}
+
+static VAL par_copy(GCWorker* w, VAL x);
+
+// Build the copy of x (whose header was 'ty' before it was claimed).
+// As with copy(), but objects are allocated with gc_alloc, and the limbs of
+// big integers are copied directly rather than through GMP.
+static VAL par_build(GCWorker* w, VAL x, uint32_t ty) {
+    VAL cl = NULL;
+    int separate = 0;
+    int ar;
+
+    switch(ty & 0x0000ffff) {
+    case CT_CON:
+        ar = CARITY(x);
+        cl = gc_alloc(w, sizeof(Closure) + sizeof(VAL)*ar, &separate);
+        SETTY(cl, CT_CON);
+        cl->info.c.tag_arity = x->info.c.tag_arity;
+        memcpy(&(cl->info.c.args), &(x->info.c.args), sizeof(VAL)*ar);
+        if (separate) {
+            push_range(w->g, (char*)cl, (char*)cl + closure_size(cl));
+        }
+        break;
+    case CT_FLOAT:
+    case CT_PTR:
+    case CT_BITS32:
+    case CT_BITS64:
+        cl = gc_alloc(w, sizeof(Closure), &separate);
+        SETTY(cl, ty & 0x0000ffff);
+        cl->info = x->info;
+        break;
+    case CT_CDATA:
+        cl = gc_alloc(w, sizeof(Closure), &separate);
+        SETTY(cl, CT_CDATA);
+        cl->info.c_heap_item = x->info.c_heap_item;
+        c_heap_mark_item(x->info.c_heap_item);
+        break;
+    case CT_STRING:
+        {
+            size_t len = x->info.str == NULL ? 0 : strlen(x->info.str) + 1;
+            cl = gc_alloc(w, sizeof(Closure) + sizeof(StrHeader) + len,
+                          &separate);
+            SETTY(cl, CT_STRING);
+            STRALLOC(cl) = len;
+            STRHEADER(cl)->len = len == 0 ? 0 : len - 1;
+            STRHEADER(cl)->chars = STRHEADER(x)->chars;
+            STRHEADER(cl)->index = NULL;
+            if (x->info.str != NULL) {
+                cl->info.str = (char*)cl + sizeof(Closure) + sizeof(StrHeader);
+                memcpy(cl->info.str, x->info.str, len);
+            } else {
+                cl->info.str = NULL;
+            }
+        }
+        break;
+    case CT_STROFFSET:
+        cl = gc_alloc(w, sizeof(Closure) + sizeof(StrOffset), &separate);
+        SETTY(cl, CT_STROFFSET);
+        cl->info.str_offset = (StrOffset*)((char*)cl + sizeof(Closure));
+        *(cl->info.str_offset) = *(x->info.str_offset);
+        break;
+    case CT_ROPE:
+        if (x->info.rope->flat != NULL) {
+            // Only the characters survive. Those which did not fit in the
+            // heap are outside from-space, so are copied here.
+            VAL flat = x->info.rope->flat;
+            return in_from_space(w->g, flat)
+                       ? par_copy(w, flat)
+                       : par_build(w, flat, flat->ty);
+        }
+        cl = gc_alloc(w, sizeof(Closure) + sizeof(Rope), &separate);
+        SETTY(cl, CT_ROPE);
+        cl->info.rope = (Rope*)((char*)cl + sizeof(Closure));
+        *(cl->info.rope) = *(x->info.rope);
+        break;
+    case CT_MANAGEDPTR:
+        {
+            size_t size = x->info.mptr->size;
+            cl = gc_alloc(w, sizeof(Closure) + sizeof(ManagedPtr) + size,
+                          &separate);
+            SETTY(cl, CT_MANAGEDPTR);
+            cl->info.mptr = (ManagedPtr*)((char*)cl + sizeof(Closure));
+            cl->info.mptr->data = (char*)cl + sizeof(Closure) +
+                                  sizeof(ManagedPtr);
+            memcpy(cl->info.mptr->data, x->info.mptr->data, size);
+            cl->info.mptr->size = size;
+        }
+        break;
+    case CT_BIGINT:
+        {
+            // Only the limbs in use are copied, so that a result which was
+            // given room to grow shrinks to fit
+            mpz_srcptr big = GETMPZ(x);
+            size_t n = mpz_size(big);
+            if (n == 0) n = 1;
+            cl = gc_alloc(w, BIGSIZE(n), &separate);
+            SETTY(cl, CT_BIGINT);
+            cl->info.size = BIGSIZE(n) - sizeof(Closure);
+            memcpy(GETMPZ(cl), big, sizeof(mpz_t));
+            memcpy(BIGLIMBS(cl), big->_mp_d,
+                   mpz_size(big) * sizeof(mp_limb_t));
+            GETMPZ(cl)->_mp_d = BIGLIMBS(cl);
+            GETMPZ(cl)->_mp_alloc = n;
+        }
+        break;
+    case CT_RAWDATA:
+        {
+            size_t size = x->info.size + sizeof(Closure);
+            cl = gc_alloc(w, size, &separate);
+            memcpy(cl, x, size);
+            cl->ty = CT_RAWDATA;
+        }
+        break;
+    default:
+        break;
+    }
+    return cl;
+}
+
+static VAL par_copy(GCWorker* w, VAL x) {
+    if (x == NULL || ISINT(x)) {
+        return x;
+    }
+    if (!in_from_space(w->g, x)) {
+        if (HASFLAG(x, HEAP_SHARED)) {
+            shared_mark(&w->g->vm->shared, x);
+        }
+        return x;
+    }
+
+    uint32_t ty = __atomic_load_n(&x->ty, __ATOMIC_ACQUIRE);
+    for(;;) {
+        switch(ty & 0x0000ffff) {
+        case CT_FWD:
+            return x->info.ptr;
+        case CT_BUSY:
+            // Another thread is copying it
+            ty = __atomic_load_n(&x->ty, __ATOMIC_ACQUIRE);
+            continue;
+        default:
+            break;
+        }
+        if (__atomic_compare_exchange_n(&x->ty, &ty,
+                                        (ty & 0xffff0000) | CT_BUSY, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        // Lost the race; ty now holds the new header
+    }
+
+    VAL cl = par_build(w, x, ty);
+    x->info.ptr = cl;
+    __atomic_store_n(&x->ty, (ty & 0xffff0000) | CT_FWD, __ATOMIC_RELEASE);
+    return cl;
+}
+
+// Copy the objects a copied object refers to; returns its size.
+static size_t scan_object(GCWorker* w, char* chunk) {
+    VAL heap_item = (VAL)chunk;
+    int i, ar;
+
+    switch(GETTY(heap_item)) {
+    case CT_CON:
+        ar = CARITY(heap_item);
+        for(i = 0; i < ar; ++i) {
+            heap_item->info.c.args[i] = par_copy(w, heap_item->info.c.args[i]);
+        }
+        break;
+    case CT_STROFFSET:
+        {
+            // A copy made of the view (see GETSTROFF) may not have fitted
+            // in the heap. It is outside from-space, so is copied here,
+            // once for each view of it (there is rarely more than one).
+            VAL str = heap_item->info.str_offset->str;
+            heap_item->info.str_offset->str
+                = in_from_space(w->g, str) || HASFLAG(str, HEAP_SHARED)
+                      ? par_copy(w, str) : par_build(w, str, str->ty);
+        }
+        break;
+    case CT_ROPE:
+        heap_item->info.rope->left = par_copy(w, heap_item->info.rope->left);
+        heap_item->info.rope->right = par_copy(w, heap_item->info.rope->right);
+        break;
+    default:
+        break;
+    }
+    return closure_size(heap_item);
+}
+
+// If other threads are waiting for work, give them what we have not
+// scanned yet.
+static void maybe_share(GCWorker* w) {
+    if (++w->since_share < SHARE_INTERVAL) return;
+    w->since_share = 0;
+
+    GCWorkers* g = w->g;
+    if (__atomic_load_n(&g->idle, __ATOMIC_RELAXED) > 0 &&
+        w->next - w->scan > PLAB_MAX_OBJECT) {
+        push_range(g, w->scan, w->next);
+        w->scan = w->next;
+    }
+}
+
+static void copy_root_slice(GCWorker* w) {
+    GCWorkers* g = w->g;
+    VM* vm = g->vm;
+    size_t roots = vm->valstack_top - vm->valstack;
+    VAL* root = vm->valstack + roots * w->id / g->nthreads;
+    VAL* end = vm->valstack + roots * (w->id + 1) / g->nthreads;
+
+    for(; root < end; ++root) {
+        *root = par_copy(w, *root);
+    }
+
+    if (w->id == 0) {
+        vm->ret = par_copy(w, vm->ret);
+        vm->reg1 = par_copy(w, vm->reg1);
+    }
+}
+
+static void run_worker(GCWorkers* g, int id) {
+    GCWorker w;
+    GrayRange r;
+
+    memset(&w, 0, sizeof(GCWorker));
+    w.g = g;
+    w.id = id;
+
+    copy_root_slice(&w);
+
+    for(;;) {
+        // Our own copies first, since they are likely to be in cache
+        while (w.scan < w.next) {
+            char* chunk = w.scan;
+            w.scan += closure_size((VAL)chunk);
+            scan_object(&w, chunk);
+            maybe_share(&w);
+        }
+
+        if (!take_range(g, &r)) break;
+
+        while (r.from < r.to) {
+            r.from += scan_object(&w, r.from);
+        }
+    }
+
+    if (w.next != NULL) {
+        assert(w.scan == w.next);
+        fill(w.next, w.end);
+    }
+}
+
+static void* worker_thread(void* arg) {
+    GCWorker* self = arg;
+    GCWorkers* g = self->g;
+    int id = self->id;
+    int epoch = 0;
+    free(self);
+
+    pthread_mutex_lock(&g->lock);
+    for(;;) {
+        while (g->epoch == epoch && !g->shutdown) {
+            pthread_cond_wait(&g->start, &g->lock);
+        }
+        if (g->shutdown) break;
+        epoch = g->epoch;
+        pthread_mutex_unlock(&g->lock);
+
+        run_worker(g, id);
+
+        pthread_mutex_lock(&g->lock);
+        g->running--;
+        pthread_cond_signal(&g->done);
+    }
+    pthread_mutex_unlock(&g->lock);
+    return NULL;
+}
+
+static GCWorkers* start_workers(int nthreads) {
+    GCWorkers* g = malloc(sizeof(GCWorkers));
+    memset(g, 0, sizeof(GCWorkers));
+    g->nthreads = nthreads;
+    g->threads = malloc(nthreads * sizeof(pthread_t));
+
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->start, NULL);
+    pthread_cond_init(&g->work, NULL);
+    pthread_cond_init(&g->done, NULL);
+
+    // The calling thread is worker 0
+    int i;
+    for(i = 1; i < nthreads; ++i) {
+        GCWorker* w = malloc(sizeof(GCWorker));
+        w->g = g;
+        w->id = i;
+        pthread_create(&g->threads[i], NULL, worker_thread, w);
+    }
+    return g;
+}
+
+void idris_par_copy(VM* vm, char* from1, char* from1_end,
+                            char* from2, char* from2_end) {
+    if (vm->gc_workers == NULL) {
+        vm->gc_workers = start_workers(vm->gc_threads);
+    }
+    GCWorkers* g = vm->gc_workers;
+
+    pthread_mutex_lock(&g->lock);
+    g->vm = vm;
+    g->from1 = from1;
+    g->from1_end = from1_end;
+    g->from2 = from2;
+    g->from2_end = from2_end;
+    g->next = vm->heap.next;
+    g->end = vm->heap.end;
+    g->pool_count = 0;
+    g->idle = 0;
+    g->finished = 0;
+    g->running = g->nthreads - 1;
+    g->epoch++;
+    pthread_cond_broadcast(&g->start);
+    pthread_mutex_unlock(&g->lock);
+
+    run_worker(g, 0);
+
+    pthread_mutex_lock(&g->lock);
+    while (g->running > 0) {
+        pthread_cond_wait(&g->done, &g->lock);
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    // The last PLAB handed out may have been cut short by the end of the
+    // to-space.
+    vm->heap.next = g->next < g->end ? g->next : g->end;
+}
+
+void idris_par_free(VM* vm) {
+    GCWorkers* g = vm->gc_workers;
+    if (g == NULL) return;
+
+    pthread_mutex_lock(&g->lock);
+    g->shutdown = 1;
+    pthread_cond_broadcast(&g->start);
+    pthread_mutex_unlock(&g->lock);
+
+    int i;
+    for(i = 1; i < g->nthreads; ++i) {
+        pthread_join(g->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&g->lock);
+    pthread_cond_destroy(&g->start);
+    pthread_cond_destroy(&g->work);
+    pthread_cond_destroy(&g->done);
+    free(g->threads);
+    free(g->pool);
+    free(g);
+    vm->gc_workers = NULL;
+}
+
+#endif // HAS_PTHREAD
@@ -0,0 +1,32 @@
+#ifndef _IDRISPARGC_H
+#define _IDRISPARGC_H
+
+#include "idris_rts.h"
+
+#ifdef HAS_PTHREAD
+
+/* Parallel copying collection (+RTS -N<n>).
+ *
+ * The copy phase of a full collection is shared between vm->gc_threads
+ * threads. Each thread copies into its own chunk of the to-space (a PLAB,
+ * "parallel local allocation buffer"), objects are claimed by
+ * compare-and-swap on their header before being forwarded, and ranges of
+ * copied but not yet scanned objects are shared so that idle threads can
+ * take them over.
+ */
+
+// Extra to-space needed by a parallel copy of 'used' bytes, on top of the
+// space the copied objects themselves take.
+size_t idris_par_slack(VM* vm, size_t used);
+
+// Copy everything reachable from the roots out of the from-space, given as
+// up to two ranges, into the empty to-space at vm->heap.next.
+void idris_par_copy(VM* vm, char* from1, char* from1_end,
+                            char* from2, char* from2_end);
+
+// Stop the collector threads of a VM
+void idris_par_free(VM* vm);
+
+#endif
+
+#endif
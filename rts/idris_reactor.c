@@ -0,0 +1,422 @@
+#include "idris_reactor.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#else
+#define NO_REACTOR
+#endif
+
+#ifndef NO_REACTOR
+
+// How many ready descriptors one wait reports, at most
+#define REACTOR_BATCH 256
+
+// Marks the event data of a timer, above the descriptor
+#define TIMER_BIT ((uint64_t)1 << 32)
+// The event data of a descriptor unwatched, or a timer cancelled, since the
+// wait found it ready. Its number may have been reused already, so it is
+// not reported.
+#define CANCELLED ((uint64_t)1 << 33)
+
+typedef struct {
+    int epfd;
+    struct epoll_event events[REACTOR_BATCH];
+    int count; // found by the last wait
+    int next;  // the next of them to report
+    int ready; // flags of the one last reported
+
+    // Timers still open, closed along with the reactor
+    int* timers;
+    int ntimers;
+    int timers_size;
+
+#ifdef HAS_PTHREAD
+    // The watcher thread, for VMs which are green threads. It polls epfd
+    // while 'armed', and then disarms and wakes the 'waiter'.
+    int started;
+    int armed;
+    int signalled;
+    int stopping;
+    int stopfd; // an eventfd, to interrupt the poll
+    Fiber* waiter;
+    pthread_t watcher;
+    pthread_mutex_t lock;
+    pthread_cond_t arm;
+#endif
+} Reactor;
+
+#define REACTOR(r) ((Reactor*)(r)->data)
+
+static uint32_t epoll_events(int events) {
+    uint32_t ev = EPOLLET | EPOLLRDHUP;
+    if (events & IDRIS_REACTOR_READ) {
+        ev |= EPOLLIN;
+    }
+    if (events & IDRIS_REACTOR_WRITE) {
+        ev |= EPOLLOUT;
+    }
+    return ev;
+}
+
+static int ready_flags(uint32_t ev) {
+    int flags = 0;
+    if (ev & (EPOLLIN | EPOLLPRI)) {
+        flags |= IDRIS_REACTOR_READ;
+    }
+    if (ev & EPOLLOUT) {
+        flags |= IDRIS_REACTOR_WRITE;
+    }
+    if (ev & (EPOLLHUP | EPOLLRDHUP)) {
+        flags |= IDRIS_REACTOR_HUP;
+    }
+    if (ev & EPOLLERR) {
+        flags |= IDRIS_REACTOR_ERR;
+    }
+    return flags;
+}
+
+static int control(Reactor* r, int op, int fd, uint32_t ev, uint64_t data) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = ev;
+    event.data.u64 = data;
+    return epoll_ctl(r->epfd, op, fd, &event);
+}
+
+#ifdef HAS_PTHREAD
+static void* reactor_watch(void* arg) {
+    Reactor* r = (Reactor*)arg;
+    struct pollfd fds[2];
+    fds[0].fd = r->epfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = r->stopfd;
+    fds[1].events = POLLIN;
+
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (!r->armed && !r->stopping) {
+            pthread_cond_wait(&r->arm, &r->lock);
+        }
+        if (r->stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&r->lock);
+        int n = poll(fds, 2, -1);
+        pthread_mutex_lock(&r->lock);
+        if (r->stopping) {
+            break;
+        }
+        // If the waiter gave up meanwhile, wait to be armed again
+        if (n > 0 && (fds[0].revents & POLLIN) && r->armed) {
+            r->armed = 0;
+            r->signalled = 1;
+            if (r->waiter != NULL) {
+                sched_wake(r->waiter);
+            }
+        }
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+static int reactor_start(Reactor* r) {
+    r->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->stopfd < 0) {
+        return -1;
+    }
+    r->armed = 0;
+    r->signalled = 0;
+    r->waiter = NULL;
+    r->stopping = 0;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->arm, NULL);
+    if (pthread_create(&r->watcher, NULL, reactor_watch, r) != 0) {
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->arm);
+        close(r->stopfd);
+        return -1;
+    }
+    r->started = 1;
+    return 0;
+}
+
+static void reactor_stop(Reactor* r) {
+    pthread_mutex_lock(&r->lock);
+    r->stopping = 1;
+    pthread_cond_signal(&r->arm);
+    pthread_mutex_unlock(&r->lock);
+    uint64_t one = 1;
+    if (write(r->stopfd, &one, sizeof(one)) < 0) {
+        // It can only be full, in which case the watcher wakes anyway
+    }
+    pthread_join(r->watcher, NULL);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->arm);
+    close(r->stopfd);
+}
+#endif
+
+static void reactor_free(void* data) {
+    Reactor* r = (Reactor*)data;
+    int i;
+#ifdef HAS_PTHREAD
+    if (r->started) {
+        reactor_stop(r);
+    }
+#endif
+    for (i = 0; i < r->ntimers; i++) {
+        close(r->timers[i]);
+    }
+    free(r->timers);
+    close(r->epfd);
+    free(r);
+}
+
+void* idris_reactorNew(void) {
+    Reactor* r = malloc(sizeof(Reactor));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) {
+        int err = errno;
+        free(r);
+        errno = err;
+        return NULL;
+    }
+    r->count = 0;
+    r->next = 0;
+    r->ready = 0;
+    r->timers = NULL;
+    r->ntimers = 0;
+    r->timers_size = 0;
+#ifdef HAS_PTHREAD
+    r->started = 0;
+#endif
+    return r;
+}
+
+CData idris_reactorManage(void* reactor) {
+    return cdata_manage(reactor, sizeof(Reactor), reactor_free);
+}
+
+int idris_reactorAdd(CData reactor, int fd, int events) {
+    return control(REACTOR(reactor), EPOLL_CTL_ADD, fd, epoll_events(events),
+                   (uint32_t)fd);
+}
+
+int idris_reactorModify(CData reactor, int fd, int events) {
+    return control(REACTOR(reactor), EPOLL_CTL_MOD, fd, epoll_events(events),
+                   (uint32_t)fd);
+}
+
+// Stop reporting what the last wait found for the event data 'data'
+static void forget(Reactor* r, uint64_t data) {
+    int i;
+    for (i = r->next; i < r->count; i++) {
+        if (r->events[i].data.u64 == data) {
+            r->events[i].data.u64 = CANCELLED;
+        }
+    }
+}
+
+int idris_reactorRemove(CData reactor, int fd) {
+    Reactor* r = REACTOR(reactor);
+    forget(r, (uint32_t)fd);
+    return control(r, EPOLL_CTL_DEL, fd, 0, 0);
+}
+
+static void set_time(struct timespec* ts, i_int usecs) {
+    ts->tv_sec = usecs / 1000000;
+    ts->tv_nsec = (usecs % 1000000) * 1000;
+}
+
+int idris_reactorTimer(CData reactor, i_int usecs, i_int interval) {
+    Reactor* r = REACTOR(reactor);
+    if (r->ntimers == r->timers_size) {
+        int size = r->timers_size == 0 ? 16 : r->timers_size * 2;
+        int* timers = realloc(r->timers, size * sizeof(int));
+        if (timers == NULL) {
+            return -1;
+        }
+        r->timers = timers;
+        r->timers_size = size;
+    }
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct itimerspec spec;
+    // An all zero it_value would disarm the timer rather than fire it
+    set_time(&spec.it_value, usecs > 0 ? usecs : 1);
+    set_time(&spec.it_interval, interval > 0 ? interval : 0);
+    if (timerfd_settime(fd, 0, &spec, NULL) != 0 ||
+        control(r, EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLET,
+                TIMER_BIT | (uint32_t)fd) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    r->timers[r->ntimers++] = fd;
+    return fd;
+}
+
+int idris_reactorCancel(CData reactor, int timer) {
+    Reactor* r = REACTOR(reactor);
+    int i;
+    for (i = 0; i < r->ntimers; i++) {
+        if (r->timers[i] == timer) {
+            r->timers[i] = r->timers[--r->ntimers];
+            control(r, EPOLL_CTL_DEL, timer, 0, 0);
+            forget(r, TIMER_BIT | (uint32_t)timer);
+            return close(timer);
+        }
+    }
+    errno = EBADF;
+    return -1;
+}
+
+static int reactor_poll(Reactor* r, int timeout) {
+    int n = epoll_wait(r->epfd, r->events, REACTOR_BATCH, timeout);
+    if (n < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+        n = 0;
+    }
+    r->count = n;
+    return n;
+}
+
+#ifdef HAS_PTHREAD
+// Park the green thread until the watcher says that something is ready
+static int reactor_park(Fiber* self, Reactor* r, int timeout) {
+    if (!r->started && reactor_start(r) != 0) {
+        return reactor_poll(r, timeout);
+    }
+    struct timespec deadline;
+    if (timeout > 0) {
+        mailbox_deadline(&deadline, (int64_t)timeout * 1000);
+    }
+    pthread_mutex_lock(&r->lock);
+    r->signalled = 0;
+    r->armed = 1;
+    r->waiter = self;
+    pthread_cond_signal(&r->arm);
+    while (!r->signalled) {
+        if (timeout > 0 && mailbox_expired(&deadline)) {
+            break;
+        }
+        sched_park(self, &r->lock, timeout > 0 ? &deadline : NULL);
+    }
+    r->armed = 0;
+    r->waiter = NULL;
+    pthread_mutex_unlock(&r->lock);
+    return reactor_poll(r, 0);
+}
+#endif
+
+int idris_reactorWait(CData reactor, int timeout) {
+    Reactor* r = REACTOR(reactor);
+    r->count = 0;
+    r->next = 0;
+    int n = reactor_poll(r, 0);
+    if (n != 0 || timeout == 0) {
+        return n;
+    }
+#ifdef HAS_PTHREAD
+    Fiber* self = sched_self();
+    if (self != NULL) {
+        return reactor_park(self, r, timeout);
+    }
+#endif
+    return reactor_poll(r, timeout);
+}
+
+int idris_reactorNext(CData reactor) {
+    Reactor* r = REACTOR(reactor);
+    while (r->next < r->count && r->events[r->next].data.u64 == CANCELLED) {
+        r->next++;
+    }
+    if (r->next >= r->count) {
+        r->ready = 0;
+        return -1;
+    }
+    struct epoll_event* ev = &r->events[r->next++];
+    int fd = (int)(uint32_t)ev->data.u64;
+    if (ev->data.u64 & TIMER_BIT) {
+        uint64_t expired;
+        if (read(fd, &expired, sizeof(expired)) < 0) {
+            // Nothing to read if it was already read after this wait
+        }
+    }
+    r->ready = ready_flags(ev->events);
+    return fd;
+}
+
+int idris_reactorReady(CData reactor) {
+    return REACTOR(reactor)->ready;
+}
+
+#else
+
+void* idris_reactorNew(void) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+// No reactor can be made, so nothing else can be called
+
+CData idris_reactorManage(void* reactor) {
+    return cdata_manage(reactor, 0, free);
+}
+
+int idris_reactorAdd(CData reactor, int fd, int events) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int idris_reactorModify(CData reactor, int fd, int events) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int idris_reactorRemove(CData reactor, int fd) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int idris_reactorTimer(CData reactor, i_int usecs, i_int interval) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int idris_reactorCancel(CData reactor, int timer) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int idris_reactorWait(CData reactor, int timeout) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int idris_reactorNext(CData reactor) {
+    return -1;
+}
+
+int idris_reactorReady(CData reactor) {
+    return 0;
+}
+
+#endif
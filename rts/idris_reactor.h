@@ -0,0 +1,64 @@
+#ifndef _IDRIS_REACTOR_H
+#define _IDRIS_REACTOR_H
+
+#include "idris_rts.h"
+
+/* *** Reactors ***
+ * Wait for any of many file descriptors (such as non-blocking sockets) to
+ * be ready, and for timers, in one call, so that one VM can serve many
+ * connections. This uses epoll and timerfd, so is only available on Linux.
+ *
+ * Descriptors are watched edge-triggered: a descriptor is reported once
+ * each time it becomes ready, so whoever handles it should read or write
+ * until the call would block (EAGAIN) before waiting again.
+ *
+ * Waiting normally blocks the thread in epoll_wait. A VM which is a green
+ * thread instead parks, and the worker runs other green threads meanwhile,
+ * until a watcher thread (started the first time it waits) sees that
+ * something is ready and wakes it.
+ *
+ * A reactor lives in the C heap, and is closed once nothing refers to it.
+ * Remove a descriptor before closing it: its number may be reused.
+ */
+
+// What a descriptor is watched for, or is ready for
+#define IDRIS_REACTOR_READ  1
+#define IDRIS_REACTOR_WRITE 2
+#define IDRIS_REACTOR_HUP   4 // ready flag only: the other end has closed
+#define IDRIS_REACTOR_ERR   8 // ready flag only: an error is pending
+
+// A new reactor, or NULL with errno set. Pass the result straight to
+// idris_reactorManage.
+void* idris_reactorNew(void);
+// Wrap a reactor as a C data block, which closes it when collected
+CData idris_reactorManage(void* reactor);
+
+// Start, change and stop watching a descriptor. Return 0 on success, or -1
+// with errno set.
+int idris_reactorAdd(CData reactor, int fd, int events);
+int idris_reactorModify(CData reactor, int fd, int events);
+// Once removed, a descriptor is not reported by idris_reactorNext even if
+// the last wait found it ready.
+int idris_reactorRemove(CData reactor, int fd);
+
+// A timer which is ready for reading 'usecs' microseconds from now and
+// then, unless 'interval' is 0, every 'interval' microseconds. It is
+// watched straight away. Returns its descriptor, or -1 with errno set.
+// The descriptor stays open until the timer is cancelled, even once a timer
+// which goes off only once has done so.
+int idris_reactorTimer(CData reactor, i_int usecs, i_int interval);
+// Stop watching a timer and close it. If the last wait found it ready, and
+// it has not been reported yet, it no longer will be.
+int idris_reactorCancel(CData reactor, int timer);
+
+// Wait up to 'timeout' milliseconds (-1 for as long as it takes) for
+// watched descriptors to be ready. Returns how many are, 0 if the time ran
+// out (or a signal arrived), or -1 with errno set.
+int idris_reactorWait(CData reactor, int timeout);
+// The next descriptor which the last wait found ready, or -1 when there
+// are no more. Timers are read, so that they are reported once per wait.
+int idris_reactorNext(CData reactor);
+// What the descriptor which idris_reactorNext returned is ready for
+int idris_reactorReady(CData reactor);
+
+#endif
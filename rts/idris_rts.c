@@ -1,11 +1,14 @@
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "idris_rts.h"
 #include "idris_gc.h"
+#include "idris_pargc.h"
+#include "idris_sched.h"
 #include "idris_utf8.h"
 #include "idris_bitstring.h"
-#include "getline.h"
+#include "idris_gmp.h"
 
 #ifdef HAS_PTHREAD
 static pthread_key_t vm_key;
@@ -18,7 +21,7 @@ void free_key(VM *vm) {
 }
 
 VM* init_vm(int stack_size, size_t heap_size,
-            int max_threads // not implemented yet
+            int max_threads // green thread workers for processes; 0 for none
             ) {
 
     VM* vm = malloc(sizeof(VM));
@@ -33,36 +36,28 @@ VM* init_vm(int stack_size, size_t heap_size,
     vm->valstack_base = valstack;
     vm->stack_max = valstack + stack_size;
 
+    memset(&(vm->heap), 0, sizeof(Heap));
     alloc_heap(&(vm->heap), heap_size, heap_size, NULL);
 
     c_heap_init(&vm->c_heap);
+    shared_set_init(&vm->shared);
+    vm->spill = NULL;
+    vm->spill_size = 0;
+    vm->spill_retired = NULL;
+    vm->line_buf = NULL;
+    vm->line_size = 0;
 
     vm->ret = NULL;
     vm->reg1 = NULL;
 #ifdef HAS_PTHREAD
-    vm->inbox = malloc(1024*sizeof(VAL));
-    memset(vm->inbox, 0, 1024*sizeof(VAL));
-    vm->inbox_end = vm->inbox + 1024;
-    vm->inbox_write = vm->inbox;
-    vm->inbox_nextid = 1;
-
-    // The allocation lock must be reentrant. The lock exists to ensure that
-    // no memory is allocated during the message sending process, but we also
-    // check the lock in calls to allocate.
-    // The problem comes when we use requireAlloc to guarantee a chunk of memory
-    // first: this sets the lock, and since it is not reentrant, we get a deadlock.
-    pthread_mutexattr_t rec_attr;
-    pthread_mutexattr_init(&rec_attr);
-    pthread_mutexattr_settype(&rec_attr, PTHREAD_MUTEX_RECURSIVE);
-
-    pthread_mutex_init(&(vm->inbox_lock), NULL);
-    pthread_mutex_init(&(vm->inbox_block), NULL);
-    pthread_mutex_init(&(vm->alloc_lock), &rec_attr);
-    pthread_cond_init(&(vm->inbox_waiting), NULL);
+    mailbox_init(&vm->inbox, 0);
 
     vm->max_threads = max_threads;
     vm->processes = 0;
 
+    vm->gc_threads = 1;
+    vm->gc_workers = NULL;
+
 #else
     global_vm = vm;
 #endif
@@ -71,7 +66,7 @@ VM* init_vm(int stack_size, size_t heap_size,
 }
 
 VM* idris_vm() {
-    VM* vm = init_vm(4096000, 4096000, 1);
+    VM* vm = init_vm(4096000, 4096000, 0);
     init_threadkeys();
     init_threaddata(vm);
     init_gmpalloc();
@@ -123,16 +118,16 @@ Stats terminate(VM* vm) {
     Stats stats = vm->stats;
     STATS_ENTER_EXIT(stats)
 #ifdef HAS_PTHREAD
-    free(vm->inbox);
+    mailbox_close(&vm->inbox);
+    idris_par_free(vm);
 #endif
     free(vm->valstack);
     free_heap(&(vm->heap));
     c_heap_destroy(&(vm->c_heap));
-#ifdef HAS_PTHREAD
-    pthread_mutex_destroy(&(vm -> inbox_lock));
-    pthread_mutex_destroy(&(vm -> inbox_block));
-    pthread_cond_destroy(&(vm -> inbox_waiting));
-#endif
+    shared_set_free(&vm->shared);
+    idris_retire_spill(vm);
+    idris_retire_spill(vm);
+    free(vm->line_buf);
     // free(vm);
     // Set the VM as inactive, so that if any message gets sent to it
     // it will not get there, rather than crash the entire system.
@@ -162,29 +157,32 @@ void idris_requireAlloc(size_t size) {
     VM* vm = global_vm;
 #endif
 
-    if (!(vm->heap.next + size < vm->heap.end)) {
-        idris_gc(vm);
-    }
-#ifdef HAS_PTHREAD
-    int lock = vm->processes > 0;
-    if (lock) { // We only need to lock if we're in concurrent mode
-       pthread_mutex_lock(&vm->alloc_lock);
+    // At most one collection, since the caller may still be holding
+    // pointers from before it.
+    if (vm->heap.nursery_size > 0) {
+        if (!(vm->heap.next + size < vm->heap.end)) {
+            // A minor collection promotes the young objects into the old
+            // generation, and large objects then go straight there too, so
+            // there must be room for both. Otherwise a large object would
+            // collect again. A major collection empties the nursery and
+            // leaves room for 'size' besides.
+            size_t young = vm->heap.next - vm->heap.heap;
+            if (!(vm->heap.gen_next + young + size < vm->heap.gen_end)) {
+                idris_gc_reserve(vm, size);
+            } else {
+                idris_minor_gc(vm);
+            }
+        }
+    } else if (!(vm->heap.next + size < vm->heap.end)) {
+        idris_gc_reserve(vm, size);
     }
-#endif
 }
 
 void idris_doneAlloc() {
-#ifdef HAS_PTHREAD
-    VM* vm = pthread_getspecific(vm_key);
-    int lock = vm->processes > 0;
-    if (lock) { // We only need to lock if we're in concurrent mode
-       pthread_mutex_unlock(&vm->alloc_lock);
-    }
-#endif
 }
 
 int space(VM* vm, size_t size) {
-    return (vm->heap.next + size + sizeof(size_t) < vm->heap.end);
+    return (vm->heap.next + size < vm->heap.end);
 }
 
 void* idris_alloc(size_t size) {
@@ -203,16 +201,27 @@ void* idris_realloc(void* old, size_t old_size, size_t size) {
 void idris_free(void* ptr, size_t size) {
 }
 
-void* allocate(size_t size, int outerlock) {
+// Prepare a newly allocated chunk. Only the header is cleared unless 'zero'
+// is set, since SETTY keeps the flag bits; debug builds poison the rest so
+// that reads of uninitialised fields show up.
+static inline void init_chunk(void* ptr, size_t size, int zero) {
+    if (zero) {
+        memset(ptr, 0, size);
+    } else {
+#ifdef IDRIS_DEBUG
+        memset(ptr, IDRIS_POISON, size);
+#endif
+        ((Closure*)ptr)->ty = 0;
+    }
+}
+
+// Only the VM's own thread allocates in its heap (messages from other
+// threads arrive in regions of their own), so no lock is needed.
+static inline void* do_allocate(size_t size, int zero) {
 //    return malloc(size);
 
 #ifdef HAS_PTHREAD
     VM* vm = pthread_getspecific(vm_key);
-    int lock = vm->processes > 0 && !outerlock;
-
-    if (lock) { // not message passing
-       pthread_mutex_lock(&vm->alloc_lock);
-    }
 #else
     VM* vm = global_vm;
 #endif
@@ -221,35 +230,66 @@ void* allocate(size_t size, int outerlock) {
 	size = 8 + ((size >> 3) << 3);
     }
 
-    size_t chunk_size = size + sizeof(size_t);
-
-    if (vm->heap.next + chunk_size < vm->heap.end) {
-        STATS_ALLOC(vm->stats, chunk_size)
-        void* ptr = (void*)(vm->heap.next + sizeof(size_t));
-        *((size_t*)(vm->heap.next)) = chunk_size;
-        vm->heap.next += chunk_size;
+    if (vm->heap.next + size < vm->heap.end) {
+        STATS_ALLOC(vm->stats, size)
+        void* ptr = (void*)(vm->heap.next);
+        vm->heap.next += size;
 
         assert(vm->heap.next <= vm->heap.end);
 
-        memset(ptr, 0, size);
-#ifdef HAS_PTHREAD
-        if (lock) { // not message passing
-           pthread_mutex_unlock(&vm->alloc_lock);
+        init_chunk(ptr, size, zero);
+        return ptr;
+    } else if (vm->heap.nursery_size > 0 &&
+               size > vm->heap.nursery_size / 4) {
+        // Too big for the nursery; allocate directly in the old generation.
+        // It may be filled in with pointers to young objects, so remember it.
+        if (!(vm->heap.gen_next + size < vm->heap.gen_end)) {
+            idris_gc_reserve(vm, size);
         }
-#endif
+        STATS_ALLOC(vm->stats, size)
+        void* ptr = (void*)(vm->heap.gen_next);
+        vm->heap.gen_next += size;
+
+        assert(vm->heap.gen_next <= vm->heap.gen_end);
+
+        init_chunk(ptr, size, zero);
+        idris_remember(vm, (VAL)ptr);
         return ptr;
     } else {
-        idris_gc(vm);
-#ifdef HAS_PTHREAD
-        if (lock) { // not message passing
-           pthread_mutex_unlock(&vm->alloc_lock);
+        if (vm->heap.nursery_size > 0) {
+            idris_minor_gc(vm);
+        } else {
+            idris_gc_reserve(vm, size);
         }
-#endif
-        return allocate(size, 0);
+        return do_allocate(size, zero);
     }
 
 }
 
+void* allocate(size_t size, int outerlock) {
+    return do_allocate(size, 1);
+}
+
+void* allocate_uninit(size_t size, int outerlock) {
+    return do_allocate(size, 0);
+}
+
+void idris_remember(VM* vm, VAL x) {
+    Heap* h = &vm->heap;
+    if (h->remembered_count == h->remembered_size) {
+        h->remembered_size = h->remembered_size == 0 ? 1024
+                                                     : h->remembered_size * 2;
+        h->remembered = realloc(h->remembered,
+                                h->remembered_size * sizeof(VAL));
+        if (h->remembered == NULL) {
+            fprintf(stderr, "RTS ERROR: Unable to grow remembered set.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    SETFLAG(x, HEAP_REMEMBERED);
+    h->remembered[h->remembered_count++] = x;
+}
+
 /* Now a macro
 void* allocCon(VM* vm, int arity, int outer) {
     Closure* cl = allocate(vm, sizeof(Closure) + sizeof(VAL)*arity,
@@ -264,12 +304,28 @@ void* allocCon(VM* vm, int arity, int outer) {
 */
 
 VAL MKFLOAT(VM* vm, double val) {
-    Closure* cl = allocate(sizeof(Closure), 0);
+    Closure* cl = allocate_uninit(sizeof(Closure), 0);
     SETTY(cl, CT_FLOAT);
     cl -> info.f = val;
     return cl;
 }
 
+static inline void init_str(VAL cl, size_t len) {
+    SETTY(cl, CT_STRING);
+    STRALLOC(cl) = len;
+    STRHEADER(cl)->len = STR_UNKNOWN;
+    STRHEADER(cl)->chars = STR_UNKNOWN;
+    STRHEADER(cl)->index = NULL;
+    cl -> info.str = (char*)cl + sizeof(Closure) + sizeof(StrHeader);
+}
+
+VAL allocStr(VM* vm, size_t len, int outerlock) {
+    Closure* cl = allocate_uninit(sizeof(Closure) + sizeof(StrHeader) + len,
+                                  outerlock);
+    init_str(cl, len);
+    return cl;
+}
+
 VAL MKSTR(VM* vm, const char* str) {
     int len;
     if (str == NULL) {
@@ -277,27 +333,301 @@ VAL MKSTR(VM* vm, const char* str) {
     } else {
         len = strlen(str)+1;
     }
-    Closure* cl = allocate(sizeof(Closure) + // Type) + sizeof(char*) +
-                           sizeof(char)*len, 0);
-    SETTY(cl, CT_STRING);
-    cl -> info.str = (char*)cl + sizeof(Closure);
+    Closure* cl = allocStr(vm, len, 0);
     if (str == NULL) {
         cl->info.str = NULL;
+        STRHEADER(cl)->len = 0;
+        STRHEADER(cl)->chars = 0;
     } else {
-        strcpy(cl -> info.str, str);
+        memcpy(cl -> info.str, str, len);
+        STRHEADER(cl)->len = len - 1;
     }
     return cl;
 }
 
+size_t idris_strbytes(VAL str) {
+    switch(GETTY(str)) {
+    case CT_STRING:
+        {
+            StrHeader* h = STRHEADER(str);
+            if (h->len == STR_UNKNOWN) {
+                size_t len = str->info.str == NULL ? 0 : strlen(str->info.str);
+                if (HASFLAG(str, HEAP_SHARED)) {
+                    return len; // never written
+                }
+                h->len = len;
+            }
+            return h->len;
+        }
+    case CT_ROPE:
+        return str->info.rope->len;
+    default: // CT_STROFFSET
+        return str->info.str_offset->len;
+    }
+}
+
+// The characters of a string of any representation. Those of a view are
+// read in place, so are not terminated.
+static inline char* str_data(VAL str) {
+    if (GETTY(str) == CT_STROFFSET) {
+        StrOffset* off = str->info.str_offset;
+        return GETSTR(off->str) + off->offset;
+    }
+    return GETSTR(str);
+}
+
+// Whether a view runs to the end of its string
+static int view_is_tail(StrOffset* off) {
+    return off->offset + off->len == idris_strbytes(off->str);
+}
+
+// Code points in a string, if known without counting
+static size_t known_chars(VAL str) {
+    switch(GETTY(str)) {
+    case CT_STRING:
+        return STRHEADER(str)->chars;
+    case CT_ROPE:
+        return str->info.rope->chars;
+    default: // CT_STROFFSET
+        return str->info.str_offset->chars;
+    }
+}
+
+static size_t str_chars(VAL str) {
+    size_t chars = known_chars(str);
+    if (chars != STR_UNKNOWN) {
+        return chars;
+    }
+    if (GETTY(str) == CT_STROFFSET) {
+        StrOffset* off = str->info.str_offset;
+        if (known_chars(off->str) == idris_strbytes(off->str)) { // ASCII
+            chars = off->len;
+        } else if (off->before != STR_UNKNOWN && view_is_tail(off)) {
+            // Count (and cache) the whole string instead
+            chars = str_chars(off->str) - off->before;
+        }
+    }
+    if (chars == STR_UNKNOWN) {
+        char* s = str_data(str);
+        chars = s == NULL ? 0 : idris_utf8_count(s, idris_strbytes(str));
+    }
+    switch(GETTY(str)) {
+    case CT_STRING:
+        if (!HASFLAG(str, HEAP_SHARED)) {
+            STRHEADER(str)->chars = chars;
+        }
+        break;
+    case CT_ROPE:
+        str->info.rope->chars = chars;
+        break;
+    default: // CT_STROFFSET; views are never shared
+        str->info.str_offset->chars = chars;
+        break;
+    }
+    return chars;
+}
+
+static size_t add_chars(size_t x, size_t y) {
+    return x == STR_UNKNOWN || y == STR_UNKNOWN ? STR_UNKNOWN : x + y;
+}
+
+// Copy the characters of a string, and a terminator, to buf (which has
+// room for them). Ropes are walked rather than flattened, so this never
+// allocates. The walk fills buf from the end, since ropes built by
+// appending to an accumulator lean to the left.
+static void str_fill(char* buf, VAL str) {
+    VAL local[64];
+    VAL* stack = local;
+    size_t top = 0, size = 64;
+    char* end = buf + idris_strbytes(str);
+
+    *end = '\0';
+    stack[top++] = str;
+    while (top > 0) {
+        VAL x = stack[--top];
+        if (GETTY(x) == CT_ROPE && x->info.rope->flat == NULL) {
+            if (top + 2 > size) {
+                size *= 2;
+                if (stack == local) {
+                    stack = malloc(size * sizeof(VAL));
+                    memcpy(stack, local, top * sizeof(VAL));
+                } else {
+                    stack = realloc(stack, size * sizeof(VAL));
+                }
+                if (stack == NULL) {
+                    fprintf(stderr, "RTS ERROR: Unable to flatten string.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            stack[top++] = x->info.rope->left;
+            stack[top++] = x->info.rope->right;
+        } else {
+            size_t len = idris_strbytes(x);
+            end -= len;
+            if (len > 0) {
+                memcpy(end, str_data(x), len);
+            }
+        }
+    }
+    assert(end == buf);
+    if (stack != local) {
+        free(stack);
+    }
+}
+
+// Called when x, which may be old, has been made to refer to a young object
+static void remember_old(VM* vm, VAL x) {
+    if (vm->heap.nursery_size > 0 && !IN_NURSERY(&vm->heap, x) &&
+        !HASFLAG(x, HEAP_REMEMBERED)) {
+        idris_remember(vm, x);
+    }
+}
+
+// A CT_STRING with room for 'len' bytes and a terminator, to flatten a
+// string into. Collecting here would move whatever the caller holds, so if
+// the heap is full it goes outside it.
+static VAL alloc_flat(VM* vm, size_t len) {
+    size_t size = ALIGN(sizeof(Closure) + sizeof(StrHeader) + len + 1, 8);
+    VAL flat;
+    if (space(vm, size)) {
+        flat = allocStr(vm, len + 1, 0);
+    } else {
+        StrSpill* s = malloc(sizeof(StrSpill) + size);
+        if (s == NULL) {
+            fprintf(stderr, "RTS ERROR: Unable to flatten string.\n");
+            exit(EXIT_FAILURE);
+        }
+        s->next = vm->spill;
+        vm->spill = s;
+        vm->spill_size += size;
+        flat = (VAL)(s + 1);
+        flat->ty = 0;
+        init_str(flat, len + 1);
+    }
+    STRHEADER(flat)->len = len;
+    return flat;
+}
+
+char* GETROPE(VAL rope) {
+    Rope* r = rope->info.rope;
+    if (r->flat == NULL) {
+        VM* vm = get_vm();
+        VAL flat = alloc_flat(vm, r->len);
+        str_fill(flat->info.str, rope);
+        STRHEADER(flat)->chars = r->chars;
+
+        r->flat = flat;
+        r->left = NULL;
+        r->right = NULL;
+        remember_old(vm, rope);
+    }
+    return r->flat->info.str;
+}
+
 char* GETSTROFF(VAL stroff) {
-    // Assume STROFF
-    StrOffset* root = stroff->info.str_offset;
-    return (root->str->info.str + root->offset);
+    StrOffset* off = stroff->info.str_offset;
+    char* s = GETSTR(off->str) + off->offset;
+    if (view_is_tail(off)) {
+        return s; // the string's own terminator ends the view too
+    }
+    VM* vm = get_vm();
+    VAL flat = alloc_flat(vm, off->len);
+    memcpy(flat->info.str, s, off->len);
+    flat->info.str[off->len] = '\0';
+    STRHEADER(flat)->chars = off->chars;
+
+    // From now on, the view is of all of its copy
+    off->str = flat;
+    off->offset = 0;
+    off->before = 0;
+    remember_old(vm, stroff);
+    return flat->info.str;
+}
+
+// Strings shorter than this are scanned rather than indexed
+#define STR_INDEX_MIN 512
+
+// The index of a long CT_STRING (see StrHeader), or NULL if it has none
+// and there is no room to build one without collecting
+static size_t* str_index(VAL s) {
+    StrHeader* h = STRHEADER(s);
+    if (h->index == NULL) {
+        if (HASFLAG(s, HEAP_SHARED)) {
+            return NULL;
+        }
+        VM* vm = get_vm();
+        size_t entries = (h->chars - 1) / STR_INDEX_STEP + 1;
+        size_t size = sizeof(Closure) + entries * sizeof(size_t);
+        if (!space(vm, size)) {
+            return NULL;
+        }
+        VAL index = allocate_uninit(size, 0);
+        SETTY(index, CT_RAWDATA);
+        index->info.size = entries * sizeof(size_t);
+
+        size_t* offsets = (size_t*)((char*)index + sizeof(Closure));
+        size_t i;
+        offsets[0] = 0;
+        for(i = 1; i < entries; ++i) {
+            char* prev = s->info.str + offsets[i - 1];
+            offsets[i] = idris_utf8_advance(prev, STR_INDEX_STEP)
+                         - s->info.str;
+        }
+        h->index = index;
+        remember_old(vm, s);
+    }
+    return (size_t*)((char*)h->index + sizeof(Closure));
+}
+
+// The character i characters into str_data(str), without scanning from the
+// start of the string where possible. Stops at the end of the string (or
+// view).
+static char* str_advance(VAL str, i_int i) {
+    size_t before = 0;  // characters of the underlying string before str
+    char* end = NULL;   // the end of a view
+    char* p;
+    if (GETTY(str) == CT_STROFFSET) {
+        StrOffset* off = str->info.str_offset;
+        char* start = GETSTR(off->str) + off->offset;
+        end = start + off->len;
+        if (i <= 0 || off->before == STR_UNKNOWN) {
+            p = idris_utf8_advance(start, i > 0 ? i : 0);
+            return p < end ? p : end;
+        }
+        if ((size_t)i >= off->chars) { // STR_UNKNOWN is never reached
+            return end;
+        }
+        before = off->before;
+        str = off->str;
+    } else if (i <= 0) {
+        return idris_utf8_advance(GETSTR(str), 0);
+    }
+    if (GETTY(str) == CT_ROPE) {
+        GETROPE(str);
+        str = str->info.rope->flat;
+    }
+
+    char* base = str->info.str;
+    size_t len = idris_strbytes(str);
+    size_t chars = str_chars(str);
+    size_t c = before + i;
+    if (c >= chars) {
+        p = base + len;
+    } else if (chars == len) { // ASCII
+        p = base + c;
+    } else {
+        size_t* index = len >= STR_INDEX_MIN ? str_index(str) : NULL;
+        p = index == NULL
+                ? idris_utf8_advance(base, c)
+                : idris_utf8_advance(base + index[c / STR_INDEX_STEP],
+                                     c % STR_INDEX_STEP);
+    }
+    return end != NULL && p > end ? end : p;
 }
 
 VAL MKCDATA(VM* vm, CHeapItem * item) {
     c_heap_insert_if_needed(vm, &vm->c_heap, item);
-    Closure* cl = allocate(sizeof(Closure), 0);
+    Closure* cl = allocate_uninit(sizeof(Closure), 0);
     SETTY(cl, CT_CDATA);
     cl->info.c_heap_item = item;
     return cl;
@@ -305,22 +635,22 @@ VAL MKCDATA(VM* vm, CHeapItem * item) {
 
 VAL MKCDATAc(VM* vm, CHeapItem * item) {
     c_heap_insert_if_needed(vm, &vm->c_heap, item);
-    Closure* cl = allocate(sizeof(Closure), 1);
+    Closure* cl = allocate_uninit(sizeof(Closure), 1);
     SETTY(cl, CT_CDATA);
     cl->info.c_heap_item = item;
     return cl;
 }
 
 VAL MKPTR(VM* vm, void* ptr) {
-    Closure* cl = allocate(sizeof(Closure), 0);
+    Closure* cl = allocate_uninit(sizeof(Closure), 0);
     SETTY(cl, CT_PTR);
     cl -> info.ptr = ptr;
     return cl;
 }
 
 VAL MKMPTR(VM* vm, void* ptr, size_t size) {
-    Closure* cl = allocate(sizeof(Closure) +
-                           sizeof(ManagedPtr) + size, 0);
+    Closure* cl = allocate_uninit(sizeof(Closure) +
+                                  sizeof(ManagedPtr) + size, 0);
     SETTY(cl, CT_MANAGEDPTR);
     cl->info.mptr = (ManagedPtr*)((char*)cl + sizeof(Closure));
     cl->info.mptr->data = (char*)cl + sizeof(Closure) + sizeof(ManagedPtr);
@@ -330,32 +660,30 @@ VAL MKMPTR(VM* vm, void* ptr, size_t size) {
 }
 
 VAL MKFLOATc(VM* vm, double val) {
-    Closure* cl = allocate(sizeof(Closure), 1);
+    Closure* cl = allocate_uninit(sizeof(Closure), 1);
     SETTY(cl, CT_FLOAT);
     cl -> info.f = val;
     return cl;
 }
 
 VAL MKSTRc(VM* vm, char* str) {
-    Closure* cl = allocate(sizeof(Closure) + // Type) + sizeof(char*) +
-                           sizeof(char)*strlen(str)+1, 1);
-    SETTY(cl, CT_STRING);
-    cl -> info.str = (char*)cl + sizeof(Closure);
-
-    strcpy(cl -> info.str, str);
+    size_t len = strlen(str);
+    Closure* cl = allocStr(vm, len+1, 1);
+    memcpy(cl -> info.str, str, len+1);
+    STRHEADER(cl)->len = len;
     return cl;
 }
 
 VAL MKPTRc(VM* vm, void* ptr) {
-    Closure* cl = allocate(sizeof(Closure), 1);
+    Closure* cl = allocate_uninit(sizeof(Closure), 1);
     SETTY(cl, CT_PTR);
     cl -> info.ptr = ptr;
     return cl;
 }
 
 VAL MKMPTRc(VM* vm, void* ptr, size_t size) {
-    Closure* cl = allocate(sizeof(Closure) +
-                           sizeof(ManagedPtr) + size, 1);
+    Closure* cl = allocate_uninit(sizeof(Closure) +
+                                  sizeof(ManagedPtr) + size, 1);
     SETTY(cl, CT_MANAGEDPTR);
     cl->info.mptr = (ManagedPtr*)((char*)cl + sizeof(Closure));
     cl->info.mptr->data = (char*)cl + sizeof(Closure) + sizeof(ManagedPtr);
@@ -364,29 +692,17 @@ VAL MKMPTRc(VM* vm, void* ptr, size_t size) {
     return cl;
 }
 
-VAL MKB8(VM* vm, uint8_t bits8) {
-    Closure* cl = allocate(sizeof(Closure), 1);
-    SETTY(cl, CT_BITS8);
-    cl -> info.bits8 = bits8;
-    return cl;
-}
-
-VAL MKB16(VM* vm, uint16_t bits16) {
-    Closure* cl = allocate(sizeof(Closure), 1);
-    SETTY(cl, CT_BITS16);
-    cl -> info.bits16 = bits16;
-    return cl;
-}
-
+#ifndef BITS32_UNBOXED
 VAL MKB32(VM* vm, uint32_t bits32) {
-    Closure* cl = allocate(sizeof(Closure), 1);
+    Closure* cl = allocate_uninit(sizeof(Closure), 1);
     SETTY(cl, CT_BITS32);
     cl -> info.bits32 = bits32;
     return cl;
 }
+#endif
 
 VAL MKB64(VM* vm, uint64_t bits64) {
-    Closure* cl = allocate(sizeof(Closure), 1);
+    Closure* cl = allocate_uninit(sizeof(Closure), 1);
     SETTY(cl, CT_BITS64);
     cl -> info.bits64 = bits64;
     return cl;
@@ -425,6 +741,9 @@ void dumpVal(VAL v) {
     case CT_STRING:
         printf("STR[%s]", v->info.str);
         break;
+    case CT_ROPE:
+        printf("ROPE[%s]", GETSTR(v));
+        break;
     case CT_FWD:
         printf("CT_FWD ");
         dumpVal((VAL)(v->info.ptr));
@@ -483,40 +802,33 @@ void idris_memmove(void* dest, void* src, i_int dest_offset, i_int src_offset, i
 
 VAL idris_castIntStr(VM* vm, VAL i) {
     int x = (int) GETINT(i);
-    Closure* cl = allocate(sizeof(Closure) + sizeof(char)*16, 0);
-    SETTY(cl, CT_STRING);
-    cl -> info.str = (char*)cl + sizeof(Closure);
+    Closure* cl = allocStr(vm, 16, 0);
     sprintf(cl -> info.str, "%d", x);
     return cl;
 }
 
 VAL idris_castBitsStr(VM* vm, VAL i) {
     Closure* cl;
-    ClosureType ty = i->ty;
+    ClosureType ty;
+
+    if (ISINT(i)) {
+        // An unboxed Bits8, Bits16 or Bits32, of at most 10 digits
+        // (4,294,967,295)
+        cl = allocStr(vm, 11, 0);
+        sprintf(cl->info.str, "%" PRIu32, (uint32_t)GETINT(i));
+        return cl;
+    }
 
+    ty = GETTY(i);
     switch (ty) {
-    case CT_BITS8:
-        // max length 8 bit unsigned int str 3 chars (256)
-        cl = allocate(sizeof(Closure) + sizeof(char)*4, 0);
-        cl->info.str = (char*)cl + sizeof(Closure);
-        sprintf(cl->info.str, "%" PRIu8, (uint8_t)i->info.bits8);
-        break;
-    case CT_BITS16:
-        // max length 16 bit unsigned int str 5 chars (65,535)
-        cl = allocate(sizeof(Closure) + sizeof(char)*6, 0);
-        cl->info.str = (char*)cl + sizeof(Closure);
-        sprintf(cl->info.str, "%" PRIu16, (uint16_t)i->info.bits16);
-        break;
     case CT_BITS32:
         // max length 32 bit unsigned int str 10 chars (4,294,967,295)
-        cl = allocate(sizeof(Closure) + sizeof(char)*11, 0);
-        cl->info.str = (char*)cl + sizeof(Closure);
+        cl = allocStr(vm, 11, 0);
         sprintf(cl->info.str, "%" PRIu32, (uint32_t)i->info.bits32);
         break;
     case CT_BITS64:
         // max length 64 bit unsigned int str 20 chars (18,446,744,073,709,551,615)
-        cl = allocate(sizeof(Closure) + sizeof(char)*21, 0);
-        cl->info.str = (char*)cl + sizeof(Closure);
+        cl = allocStr(vm, 21, 0);
         sprintf(cl->info.str, "%" PRIu64, (uint64_t)i->info.bits64);
         break;
     default:
@@ -524,7 +836,6 @@ VAL idris_castBitsStr(VM* vm, VAL i) {
         exit(EXIT_FAILURE);
     }
 
-    SETTY(cl, CT_STRING);
     return cl;
 }
 
@@ -538,9 +849,7 @@ VAL idris_castStrInt(VM* vm, VAL i) {
 }
 
 VAL idris_castFloatStr(VM* vm, VAL i) {
-    Closure* cl = allocate(sizeof(Closure) + sizeof(char)*32, 0);
-    SETTY(cl, CT_STRING);
-    cl -> info.str = (char*)cl + sizeof(Closure);
+    Closure* cl = allocStr(vm, 32, 0);
     snprintf(cl -> info.str, 32, "%.16g", GETFLOAT(i));
     return cl;
 }
@@ -549,50 +858,177 @@ VAL idris_castStrFloat(VM* vm, VAL i) {
     return MKFLOAT(vm, strtod(GETSTR(i), NULL));
 }
 
+// Shorter results are copied, since a rope would cost about as much
+#define ROPE_MIN 256
+
 VAL idris_concat(VM* vm, VAL l, VAL r) {
-    char *rs = GETSTR(r);
-    char *ls = GETSTR(l);
-    // dumpVal(l);
-    // printf("\n");
-    Closure* cl = allocate(sizeof(Closure) + strlen(ls) + strlen(rs) + 1, 0);
-    SETTY(cl, CT_STRING);
-    cl -> info.str = (char*)cl + sizeof(Closure);
-    strcpy(cl -> info.str, ls);
-    strcat(cl -> info.str, rs);
+    size_t llen = idris_strbytes(l);
+    size_t rlen = idris_strbytes(r);
+    size_t chars = add_chars(known_chars(l), known_chars(r));
+
+    // If there's no room, copy instead, or we'll have a problem after gc
+    // moves l and r
+    if (llen + rlen >= ROPE_MIN &&
+        space(vm, sizeof(Closure) + sizeof(Rope))) {
+        Closure* cl = allocate_uninit(sizeof(Closure) + sizeof(Rope), 0);
+        SETTY(cl, CT_ROPE);
+        cl->info.rope = (Rope*)((char*)cl + sizeof(Closure));
+        cl->info.rope->left = l;
+        cl->info.rope->right = r;
+        cl->info.rope->len = llen + rlen;
+        cl->info.rope->chars = chars;
+        cl->info.rope->flat = NULL;
+        return cl;
+    }
+
+    char *rs = str_data(r);
+    char *ls = str_data(l);
+    Closure* cl = allocStr(vm, llen + rlen + 1, 0);
+    memcpy(cl -> info.str, ls, llen);
+    memcpy(cl -> info.str + llen, rs, rlen);
+    cl -> info.str[llen + rlen] = '\0';
+    STRHEADER(cl)->len = llen + rlen;
+    STRHEADER(cl)->chars = chars;
     return cl;
 }
 
-VAL idris_strlt(VM* vm, VAL l, VAL r) {
-    char *ls = GETSTR(l);
-    char *rs = GETSTR(r);
+// As strcmp, but views need not be copied to terminate them
+static int str_compare(VAL l, VAL r) {
+    size_t llen = idris_strbytes(l);
+    size_t rlen = idris_strbytes(r);
+    int cmp = 0;
+    if (llen > 0 && rlen > 0) {
+        cmp = memcmp(str_data(l), str_data(r), llen < rlen ? llen : rlen);
+    }
+    if (cmp == 0) {
+        cmp = llen < rlen ? -1 : llen > rlen;
+    }
+    return cmp;
+}
 
-    return MKINT((i_int)(strcmp(ls, rs) < 0));
+VAL idris_strlt(VM* vm, VAL l, VAL r) {
+    return MKINT((i_int)(str_compare(l, r) < 0));
 }
 
 VAL idris_streq(VM* vm, VAL l, VAL r) {
-    char *ls = GETSTR(l);
-    char *rs = GETSTR(r);
-
-    return MKINT((i_int)(strcmp(ls, rs) == 0));
+    if (idris_strbytes(l) != idris_strbytes(r)) {
+        return MKINT(0);
+    }
+    return MKINT((i_int)(str_compare(l, r) == 0));
 }
 
 VAL idris_strlen(VM* vm, VAL l) {
-    return MKINT((i_int)(idris_utf8_strlen(GETSTR(l))));
+    return MKINT((i_int)(str_chars(l)));
+}
+
+// Free heap space wanted before reading a line straight into the heap
+#define LINE_ROOM 4096
+
+// Read whole lines from h into buf, which has room for 'size' bytes, after
+// the 'len' bytes already there, until there are 'max' bytes (at least one
+// line) or the file ends. Returns 0 if buf fills up in the middle of a line.
+static int read_lines_into(FILE* h, char* buf, size_t size, size_t* len,
+                           size_t max) {
+    while (*len + 1 < size) {
+        size_t n = size - *len;
+        if (n > INT_MAX) {
+            n = INT_MAX;
+        }
+        if (fgets(buf + *len, (int)n, h) == NULL) {
+            return 1; // end of file, or an error
+        }
+        // A NUL ends the line early, as it always has
+        size_t got = strlen(buf + *len);
+        *len += got;
+        if (got + 1 == n && buf[*len - 1] != '\n') {
+            continue; // the line goes on
+        }
+        if (*len >= max) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void line_buf_reserve(VM* vm, size_t size) {
+    if (vm->line_size < size) {
+        vm->line_buf = realloc(vm->line_buf, size);
+        vm->line_size = size;
+        if (vm->line_buf == NULL) {
+            fprintf(stderr, "RTS ERROR: Unable to allocate line buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Lines are read straight into the heap's free space, and the string is
+// built around them there, so they are not copied. Reading allocates
+// nothing until then, so there is nothing to keep safe from a collection
+// beforehand. A line too long for the free space goes on in a buffer the
+// VM keeps for the purpose, and is copied from there.
+static VAL read_lines(VM* vm, FILE* h, size_t max) {
+    size_t hdr = sizeof(Closure) + sizeof(StrHeader);
+    size_t want = hdr + max + LINE_ROOM;
+    if (vm->heap.nursery_size > 0 && want > vm->heap.nursery_size / 2) {
+        // Even an empty nursery would not have room, so don't collect for
+        // more than it can hold; the rest goes in the buffer.
+        want = vm->heap.nursery_size / 2;
+    }
+    if (!space(vm, want)) {
+        idris_requireAlloc(want);
+    }
+
+    char* buf = vm->heap.next + hdr;
+    size_t room = space(vm, want) ? vm->heap.end - buf - 8 : 0;
+    size_t len = 0;
+    if (read_lines_into(h, buf, room, &len, max)) {
+        size_t size = ALIGN(hdr + len + 1, 8);
+        Closure* cl = (Closure*)vm->heap.next;
+        vm->heap.next += size;
+        assert(vm->heap.next <= vm->heap.end);
+        STATS_ALLOC(vm->stats, size)
+
+        cl->ty = 0;
+        init_str(cl, len + 1);
+        STRHEADER(cl)->len = len;
+        return cl;
+    }
+
+    // The line goes on past the free space, so carry on in the VM's buffer
+    line_buf_reserve(vm, len + LINE_ROOM);
+    memcpy(vm->line_buf, buf, len);
+    buf = vm->line_buf;
+    while (!read_lines_into(h, buf, vm->line_size, &len, max)) {
+        line_buf_reserve(vm, vm->line_size * 2);
+        buf = vm->line_buf;
+    }
+
+    Closure* cl = allocStr(vm, len + 1, 0);
+    memcpy(cl->info.str, buf, len);
+    cl->info.str[len] = '\0';
+    STRHEADER(cl)->len = len;
+    return cl;
 }
 
 VAL idris_readStr(VM* vm, FILE* h) {
-    VAL ret;
-    char *buffer = NULL;
-    size_t n = 0;
-    ssize_t len;
-    len = getline(&buffer, &n, h);
-    if (len <= 0) {
-        ret = MKSTR(vm, "");
-    } else {
-        ret = MKSTR(vm, buffer);
+    return read_lines(vm, h, 0);
+}
+
+VAL idris_readLines(VM* vm, FILE* h, i_int size) {
+    return read_lines(vm, h, size > 0 ? size : 0);
+}
+
+i_int idris_lineEnd(VAL str, i_int from) {
+    size_t len = idris_strbytes(str);
+    if (from < 0) {
+        from = 0;
     }
-    free(buffer);
-    return ret;
+    if ((size_t)from >= len) {
+        return len;
+    }
+    char* s = str_data(str);
+    char* nl = memchr(s + from, '\n', len - from);
+    return nl == NULL ? (i_int)len : nl + 1 - s;
 }
 
 VAL idris_strHead(VM* vm, VAL str) {
@@ -600,89 +1036,181 @@ VAL idris_strHead(VM* vm, VAL str) {
 }
 
 VAL MKSTROFFc(VM* vm, StrOffset* off) {
-    Closure* cl = allocate(sizeof(Closure) + sizeof(StrOffset), 1);
+    Closure* cl = allocate_uninit(sizeof(Closure) + sizeof(StrOffset), 1);
     SETTY(cl, CT_STROFFSET);
     cl->info.str_offset = (StrOffset*)((char*)cl + sizeof(Closure));
 
-    cl->info.str_offset->str = off->str;
-    cl->info.str_offset->offset = off->offset;
-
+    *(cl->info.str_offset) = *off;
     return cl;
 }
 
-VAL idris_strTail(VM* vm, VAL str) {
-    // If there's no room, just copy the string, or we'll have a problem after
-    // gc moves str
-    if (space(vm, sizeof(Closure) + sizeof(StrOffset))) {
-        Closure* cl = allocate(sizeof(Closure) + sizeof(StrOffset), 0);
-        SETTY(cl, CT_STROFFSET);
-        cl->info.str_offset = (StrOffset*)((char*)cl + sizeof(Closure));
+// Substrings shorter than this are copied, since a view would take about
+// as much room, and may need copying later anyway
+#define VIEW_MIN 32
+
+// A view of 'len' bytes of str, starting 'from' bytes (and 'before'
+// characters) in and holding 'chars' characters. The caller has checked
+// that there is room.
+static VAL str_view(VM* vm, VAL str, size_t from, size_t len,
+                    size_t before, size_t chars) {
+    if (GETTY(str) == CT_STROFFSET) { // a view of the underlying string
+        StrOffset* off = str->info.str_offset;
+        from += off->offset;
+        before = add_chars(off->before, before);
+        str = off->str;
+    }
+    if (known_chars(str) == idris_strbytes(str)) { // ASCII
+        before = from;
+        chars = len;
+    }
+    Closure* cl = allocate_uninit(sizeof(Closure) + sizeof(StrOffset), 0);
+    SETTY(cl, CT_STROFFSET);
+    cl->info.str_offset = (StrOffset*)((char*)cl + sizeof(Closure));
+    cl->info.str_offset->str = str;
+    cl->info.str_offset->offset = from;
+    cl->info.str_offset->len = len;
+    cl->info.str_offset->before = before;
+    cl->info.str_offset->chars = chars;
+    return cl;
+}
 
-        int offset = 0;
-        VAL root = str;
+// Make room for 'size' bytes, collecting if there is none, and return x,
+// which the collection may have moved. There is still no room afterwards
+// if x could not be kept on the stack meanwhile.
+static VAL make_room(VM* vm, size_t size, VAL x) {
+    if (!space(vm, size) && vm->valstack_top < vm->stack_max) {
+        *(vm->valstack_top++) = x;
+        idris_requireAlloc(size);
+        x = *(--vm->valstack_top);
+    }
+    return x;
+}
 
-        while(root!=NULL && !ISSTR(root)) { // find the root, carry on.
-                              // In theory, at most one step here!
-            offset += root->info.str_offset->offset;
-            root = root->info.str_offset->str;
-        }
+VAL idris_strTail(VM* vm, VAL str) {
+    str = make_room(vm, sizeof(Closure) + sizeof(StrOffset), str);
 
-        cl->info.str_offset->str = root;
-        cl->info.str_offset->offset = offset+idris_utf8_charlen(GETSTR(str));
+    char* s = str_data(str);
+    size_t len = idris_strbytes(str);
+    size_t head = len == 0 ? 0 : idris_utf8_charlen(s);
+    if (head > len) { // truncated character
+        head = len;
+    }
+    size_t skipped = idris_utf8_count(s, head);
+    size_t chars = known_chars(str);
+    if (chars != STR_UNKNOWN) {
+        chars -= skipped;
+    }
 
-        return cl;
-    } else {
-        char* nstr = GETSTR(str);
-        return MKSTR(vm, nstr+idris_utf8_charlen(nstr));
+    if (space(vm, sizeof(Closure) + sizeof(StrOffset))) {
+        return str_view(vm, str, head, len - head, skipped, chars);
     }
+    // No room even so, so copy: a collection now would move str
+    Closure* cl = allocStr(vm, len - head + 1, 0);
+    memcpy(cl->info.str, s + head, len - head);
+    cl->info.str[len - head] = '\0';
+    STRHEADER(cl)->len = len - head;
+    STRHEADER(cl)->chars = chars;
+    return cl;
 }
 
 VAL idris_strCons(VM* vm, VAL x, VAL xs) {
-    char *xstr = GETSTR(xs);
+    size_t len = idris_strbytes(xs);
+    size_t chars = add_chars(known_chars(xs), 1);
+    char *xstr = str_data(xs);
     int xval = GETINT(x);
+    Closure* cl;
     if ((xval & 0x80) == 0) { // ASCII char
-        Closure* cl = allocate(sizeof(Closure) +
-                               strlen(xstr) + 2, 0);
-        SETTY(cl, CT_STRING);
-        cl -> info.str = (char*)cl + sizeof(Closure);
+        cl = allocStr(vm, len + 2, 0);
         cl -> info.str[0] = (char)(GETINT(x));
-        strcpy(cl -> info.str+1, xstr);
-        return cl;
+        memcpy(cl -> info.str+1, xstr, len);
+        cl -> info.str[len + 1] = '\0';
+        STRHEADER(cl)->len = len + 1;
     } else {
         char *init = idris_utf8_fromChar(xval);
-        Closure* cl = allocate(sizeof(Closure) + strlen(init) + strlen(xstr) + 1, 0);
-        SETTY(cl, CT_STRING);
-        cl -> info.str = (char*)cl + sizeof(Closure);
-        strcpy(cl -> info.str, init);
-        strcat(cl -> info.str, xstr);
+        size_t ilen = strlen(init);
+        cl = allocStr(vm, ilen + len + 1, 0);
+        memcpy(cl -> info.str, init, ilen);
+        memcpy(cl -> info.str + ilen, xstr, len);
+        cl -> info.str[ilen + len] = '\0';
+        STRHEADER(cl)->len = ilen + len;
         free(init);
-        return cl;
     }
+    STRHEADER(cl)->chars = chars;
+    return cl;
 }
 
 VAL idris_strIndex(VM* vm, VAL str, VAL i) {
-    int idx = idris_utf8_index(GETSTR(str), GETINT(i));
-    return MKINT((i_int)idx);
+    char* p = str_advance(str, GETINT(i));
+    if (p == str_data(str) + idris_strbytes(str)) {
+        return MKINT(0); // past the end; a view is not terminated here
+    }
+    return MKINT((i_int)idris_utf8_index(p, 0));
+}
+
+// Bytes 'start' to 'start + len' of str, holding 'chars' characters after
+// 'before' others: a view if it is long enough to be worth one, and there
+// is room, or a copy otherwise
+static VAL str_part(VM* vm, VAL str, size_t start, size_t len,
+                    size_t before, size_t chars) {
+    if (len >= VIEW_MIN) {
+        str = make_room(vm, sizeof(Closure) + sizeof(StrOffset), str);
+        if (space(vm, sizeof(Closure) + sizeof(StrOffset))) {
+            return str_view(vm, str, start, len, before, chars);
+        }
+    }
+
+    char* data = str_data(str);
+    Closure* newstr = allocStr(vm, len + 1, 0);
+    memcpy(newstr -> info.str, data + start, len);
+    *(newstr -> info.str + len) = '\0';
+    STRHEADER(newstr)->len = len;
+    if (known_chars(str) == idris_strbytes(str)) { // ASCII
+        STRHEADER(newstr)->chars = len;
+    }
+    return newstr;
 }
 
 VAL idris_substr(VM* vm, VAL offset, VAL length, VAL str) {
-    char *start = idris_utf8_advance(GETSTR(str), GETINT(offset));
-    char *end = idris_utf8_advance(start, GETINT(length));
-    Closure* newstr = allocate(sizeof(Closure) + (end - start) +1, 0);
-    SETTY(newstr, CT_STRING);
-    newstr -> info.str = (char*)newstr + sizeof(Closure);
-    memcpy(newstr -> info.str, start, end - start);
-    *(newstr -> info.str + (end - start) + 1) = '\0';
-    return newstr;
+    i_int from = GETINT(offset) > 0 ? GETINT(offset) : 0;
+    char* data = str_data(str);
+    size_t start = str_advance(str, from) - data;
+    size_t end = GETINT(length) > 0
+                     ? str_advance(str, from + GETINT(length)) - data
+                     : start;
+    size_t len = end - start;
+    size_t chars = known_chars(str);
+
+    // If it is not empty, 'from' characters come before it
+    size_t in_view = STR_UNKNOWN;
+    if (len > 0 && chars != STR_UNKNOWN) {
+        in_view = chars - from < (size_t)GETINT(length)
+                      ? chars - from : (size_t)GETINT(length);
+    }
+    return str_part(vm, str, start, len, from, in_view);
+}
+
+VAL idris_strSlice(VM* vm, VAL str, i_int from, i_int to) {
+    size_t len = idris_strbytes(str);
+    size_t start = from > 0 ? (size_t)from : 0;
+    size_t end = to > 0 ? (size_t)to : 0;
+    if (end > len) {
+        end = len;
+    }
+    if (start > end) {
+        start = end;
+    }
+    return str_part(vm, str, start, end - start,
+                    start == 0 ? 0 : STR_UNKNOWN, STR_UNKNOWN);
 }
 
 VAL idris_strRev(VM* vm, VAL str) {
+    size_t len = idris_strbytes(str);
+    size_t chars = known_chars(str);
     char *xstr = GETSTR(str);
-    Closure* cl = allocate(sizeof(Closure) +
-                           strlen(xstr) + 1, 0);
-    SETTY(cl, CT_STRING);
-    cl->info.str = (char*)cl + sizeof(Closure);
+    Closure* cl = allocStr(vm, len + 1, 0);
     idris_utf8_rev(xstr, cl->info.str);
+    STRHEADER(cl)->len = len;
+    STRHEADER(cl)->chars = chars;
     return cl;
 }
 
@@ -703,18 +1231,268 @@ typedef struct {
     VM* vm; // thread's VM
     VM* callvm; // calling thread's VM
     func fn;
-    VAL arg;
+    Msg* arg; // copied like a message, and moved in once the thread runs
 } ThreadData;
 
+/******************** Message regions *****************************************/
+// A message is deep copied by its sender into a block of memory of its own,
+// rather than into the receiver's heap, so that no thread ever allocates in
+// another VM's heap. The receiver moves the block into its heap in one piece.
+//
+// Shared regions are built the same way, but are not moved.
+
+// Limbs kept when copying an Integer: only those in use
+static size_t limbs_kept(VAL x) {
+    size_t n = mpz_size(GETMPZ(x));
+    return n == 0 ? 1 : n;
+}
+
+// Bytes needed in a region for a copy of x. Shared objects are left where
+// they are if 'keep_shared' is set.
+static size_t region_size(VAL x, int keep_shared) {
+    int i, ar;
+    size_t size;
+
+    if (x == NULL || ISINT(x) || (keep_shared && HASFLAG(x, HEAP_SHARED))) {
+        return 0;
+    }
+    switch(GETTY(x)) {
+    case CT_CON:
+        ar = CARITY(x);
+        if (ar == 0 && CTAG(x) < 256) { // globally allocated
+            return 0;
+        }
+        size = closure_size(x);
+        for(i = 0; i < ar; ++i) {
+            size += region_size(x->info.c.args[i], keep_shared);
+        }
+        return size;
+    case CT_STRING:
+    case CT_STROFFSET: // flattened to a string
+    case CT_ROPE:
+        size = ISSTR(x) && x->info.str == NULL ? 0 : idris_strbytes(x) + 1;
+        return ALIGN(sizeof(Closure) + sizeof(StrHeader) + size, 8);
+    case CT_BIGINT:
+        return ALIGN(BIGSIZE(limbs_kept(x)), 8);
+    case CT_CDATA:
+    case CT_FWD:
+        assert(0); // C heap items belong to the sender
+        return 0;
+    default:
+        return closure_size(x);
+    }
+}
+
+// Copy x into the region at *next, moving *next past the copy. If 'refs'
+// is given, shared objects are left where they are, and 'refs' is given a
+// reference to each region they are in; 'from' holds those regions.
+static VAL region_copy(char** next, VAL x, SharedSet* from, SharedSet* refs) {
+    int i, ar;
+    size_t size;
+    VAL cl;
+
+    if (x == NULL || ISINT(x)) {
+        return x;
+    }
+    if (refs != NULL && HASFLAG(x, HEAP_SHARED)) {
+        shared_set_ref(refs, from, x);
+        return x;
+    }
+    switch(GETTY(x)) {
+    case CT_CON:
+        ar = CARITY(x);
+        if (ar == 0 && CTAG(x) < 256) { // globally allocated
+            return x;
+        }
+        cl = (VAL)*next;
+        *next += closure_size(x);
+        cl->ty = CT_CON;
+        cl->info.c.tag_arity = x->info.c.tag_arity;
+        for(i = 0; i < ar; ++i) {
+            cl->info.c.args[i] = region_copy(next, x->info.c.args[i],
+                                             from, refs);
+        }
+        break;
+    case CT_STRING:
+    case CT_STROFFSET:
+    case CT_ROPE:
+        size = ISSTR(x) && x->info.str == NULL ? 0 : idris_strbytes(x) + 1;
+        cl = (VAL)*next;
+        *next += ALIGN(sizeof(Closure) + sizeof(StrHeader) + size, 8);
+        cl->ty = 0;
+        init_str(cl, size);
+        STRHEADER(cl)->chars = known_chars(x);
+        if (size == 0) {
+            cl->info.str = NULL;
+            STRHEADER(cl)->len = 0;
+            STRHEADER(cl)->chars = 0;
+        } else {
+            str_fill(cl->info.str, x);
+            STRHEADER(cl)->len = size - 1;
+            if (STRHEADER(cl)->chars == STR_UNKNOWN) {
+                // Shared strings can't cache it later
+                STRHEADER(cl)->chars = idris_utf8_count(cl->info.str,
+                                                        size - 1);
+            }
+        }
+        break;
+    case CT_MANAGEDPTR:
+        cl = (VAL)*next;
+        *next += closure_size(x);
+        cl->ty = CT_MANAGEDPTR;
+        cl->info.mptr = (ManagedPtr*)((char*)cl + sizeof(Closure));
+        cl->info.mptr->data = (char*)cl + sizeof(Closure) + sizeof(ManagedPtr);
+        cl->info.mptr->size = x->info.mptr->size;
+        memcpy(cl->info.mptr->data, x->info.mptr->data, x->info.mptr->size);
+        break;
+    case CT_BIGINT:
+        size = limbs_kept(x);
+        cl = (VAL)*next;
+        *next += ALIGN(BIGSIZE(size), 8);
+        cl->ty = CT_BIGINT;
+        cl->info.size = BIGSIZE(size) - sizeof(Closure);
+        memcpy(GETMPZ(cl), GETMPZ(x), sizeof(mpz_t));
+        memcpy(BIGLIMBS(cl), GETMPZ(x)->_mp_d,
+               mpz_size(GETMPZ(x)) * sizeof(mp_limb_t));
+        GETMPZ(cl)->_mp_d = BIGLIMBS(cl);
+        GETMPZ(cl)->_mp_alloc = size;
+        break;
+    default:
+        size = closure_size(x);
+        cl = (VAL)*next;
+        *next += size;
+        memcpy(cl, x, size);
+        cl->ty = GETTY(x);
+        break;
+    }
+    return cl;
+}
+
+// Move a region into the current VM's heap, returning the new location of
+// 'root'. Pointers within the region are adjusted by the distance moved.
+static VAL region_move(VM* vm, char* region, size_t size, VAL root) {
+    char* end = region + size;
+    if ((char*)root < region || (char*)root >= end) {
+        return root; // an integer or a nullary constructor
+    }
+
+    char* heap = allocate_uninit(size, 0);
+    memcpy(heap, region, size);
+    ptrdiff_t delta = heap - region;
+#define MOVED(p) ((char*)(p) >= region && (char*)(p) < end \
+                  ? (void*)((char*)(p) + delta) : (void*)(p))
+
+    char* scan = heap;
+    while(scan < heap + size) {
+        VAL cl = (VAL)scan;
+        int i, ar;
+        switch(GETTY(cl)) {
+        case CT_CON:
+            ar = CARITY(cl);
+            for(i = 0; i < ar; ++i) {
+                if (!ISINT(cl->info.c.args[i])) {
+                    cl->info.c.args[i] = MOVED(cl->info.c.args[i]);
+                }
+            }
+            break;
+        case CT_STRING:
+            cl->info.str = MOVED(cl->info.str);
+            break;
+        case CT_MANAGEDPTR:
+            cl->info.mptr = MOVED(cl->info.mptr);
+            cl->info.mptr->data = MOVED(cl->info.mptr->data);
+            break;
+        case CT_BIGINT:
+            GETMPZ(cl)->_mp_d = BIGLIMBS(cl);
+            break;
+        default:
+            break;
+        }
+        scan += closure_size(cl);
+    }
+#undef MOVED
+    return (VAL)((char*)root + delta);
+}
+
+// Whether x holds bytes which can be written in place (a Buffer, or the
+// data of a managed pointer), which other threads must not see change
+static int has_mutable(VAL x) {
+    int i, ar;
+    if (x == NULL || ISINT(x) || HASFLAG(x, HEAP_SHARED)) {
+        return 0;
+    }
+    switch(GETTY(x)) {
+    case CT_RAWDATA:
+    case CT_MANAGEDPTR:
+        return 1;
+    case CT_CON:
+        ar = CARITY(x);
+        for(i = 0; i < ar; ++i) {
+            if (has_mutable(x->info.c.args[i])) {
+                return 1;
+            }
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+VAL idris_share(VM* vm, VAL x) {
+    if (x == NULL || ISINT(x) || HASFLAG(x, HEAP_SHARED) || has_mutable(x)) {
+        return x;
+    }
+    // Shared objects inside x are copied too, so that the new region
+    // only refers to itself.
+    size_t size = region_size(x, 0);
+    if (size == 0) {
+        return x; // a nullary constructor
+    }
+
+    SharedRegion* r = shared_region_new(size);
+    char* next = SHARED_START(r);
+    VAL root = region_copy(&next, x, NULL, NULL);
+    assert(next == SHARED_END(r));
+    shared_region_seal(r);
+    shared_set_add(&vm->shared, r);
+    return root;
+}
+
 #ifdef HAS_PTHREAD
-void* runThread(void* arg) {
+// Copy a message into a region of its own, just after the Msg. This is
+// done by the sending thread without touching the destination's heap, so
+// it needs no lock, and neither does the destination when it allocates.
+static Msg* message_new(VM* sender, VAL msg) {
+    size_t size = region_size(msg, 1);
+    Msg* m = malloc(sizeof(Msg) + size);
+    if (m == NULL) {
+        fprintf(stderr, "RTS ERROR: Unable to allocate message.\n");
+        exit(EXIT_FAILURE);
+    }
+    m->sender = sender;
+    m->region = size > 0 ? (char*)(m + 1) : NULL;
+    m->region_size = size;
+    shared_set_init(&m->shared);
+
+    char* next = m->region;
+    m->msg = region_copy(&next, msg, &sender->shared, &m->shared);
+    assert(next == m->region + size);
+    return m;
+}
+
+// Heap of a process which runs as a green thread. There may be a great
+// many of them, so they start small and grow as they need to.
+#define GREEN_HEAP_SIZE 65536
+
+static void runProcess(void* arg) {
     ThreadData* td = (ThreadData*)arg;
     VM* vm = td->vm;
     VM* callvm = td->callvm;
 
     init_threaddata(vm);
 
-    TOP(0) = td->arg;
+    TOP(0) = idris_getMsg(td->arg);
+    idris_freeMsg(td->arg);
     BASETOP(0);
     ADDTOP(1);
     td->fn(vm, NULL);
@@ -725,13 +1503,29 @@ void* runThread(void* arg) {
     //    Stats stats =
     terminate(vm);
     //    aggregate_stats(&(td->vm->stats), &stats);
+}
+
+void* runThread(void* arg) {
+    runProcess(arg);
     return NULL;
 }
 
 void* vmThread(VM* callvm, func f, VAL arg) {
-    VM* vm = init_vm(callvm->stack_max - callvm->valstack, callvm->heap.size,
+    int green = callvm->max_threads > 0;
+    VM* vm = init_vm(callvm->stack_max - callvm->valstack,
+                     green ? GREEN_HEAP_SIZE : callvm->heap.size,
                      callvm->max_threads);
+    if (green) {
+        vm->heap.growth = callvm->heap.growth;
+    }
     vm->processes=1; // since it can send and receive messages
+    vm->heap.release = callvm->heap.release;
+    vm->stats.trace = callvm->stats.trace;
+    vm->inbox.limit = callvm->inbox.limit;
+    vm->gc_threads = callvm->gc_threads;
+    if (callvm->heap.nursery_size > 0) {
+        alloc_nursery(&vm->heap, callvm->heap.nursery_size);
+    }
     pthread_t t;
     pthread_attr_t attr;
 //    size_t stacksize;
@@ -744,10 +1538,13 @@ void* vmThread(VM* callvm, func f, VAL arg) {
     td->vm = vm;
     td->callvm = callvm;
     td->fn = f;
-    td->arg = copyTo(vm, arg);
+    td->arg = message_new(callvm, arg);
 
     callvm->processes++;
 
+    if (green && sched_spawn(callvm->max_threads, vm, runProcess, td)) {
+        return vm;
+    }
     pthread_create(&t, &attr, runThread, td);
 //    usleep(100);
     return vm;
@@ -783,8 +1580,14 @@ VAL doCopyTo(VM* vm, VAL x) {
     case CT_STRING:
         cl = MKSTRc(vm, x->info.str);
         break;
+    case CT_STROFFSET:
+    case CT_ROPE:
+        cl = allocStr(vm, idris_strbytes(x) + 1, 1);
+        str_fill(cl->info.str, x);
+        STRHEADER(cl)->len = idris_strbytes(x);
+        break;
     case CT_BIGINT:
-        cl = MKBIGMc(vm, x->info.ptr);
+        cl = MKBIGMc(vm, &GETMPZ(x));
         break;
     case CT_PTR:
         cl = MKPTRc(vm, x->info.ptr);
@@ -792,12 +1595,6 @@ VAL doCopyTo(VM* vm, VAL x) {
     case CT_MANAGEDPTR:
         cl = MKMPTRc(vm, x->info.mptr->data, x->info.mptr->size);
         break;
-    case CT_BITS8:
-        cl = idris_b8CopyForGC(vm, x);
-        break;
-    case CT_BITS16:
-        cl = idris_b16CopyForGC(vm, x);
-        break;
     case CT_BITS32:
         cl = idris_b32CopyForGC(vm, x);
         break;
@@ -807,7 +1604,7 @@ VAL doCopyTo(VM* vm, VAL x) {
     case CT_RAWDATA:
         {
             size_t size = x->info.size + sizeof(Closure);
-            cl = allocate(size, 0);
+            cl = allocate_uninit(size, 0);
             memcpy(cl, x, size);
         }
         break;
@@ -827,62 +1624,17 @@ VAL copyTo(VM* vm, VAL x) {
 
 // Add a message to another VM's message queue
 int idris_sendMessage(VM* sender, int channel_id, VM* dest, VAL msg) {
-    // FIXME: If GC kicks in in the middle of the copy, we're in trouble.
-    // Probably best check there is enough room in advance. (How?)
-
-    // Also a problem if we're allocating at the same time as the
-    // destination thread (which is very likely)
-    // Should the inbox be a different memory space?
-
-    // So: we try to copy, if a collection happens, we do the copy again
-    // under the assumption there's enough space this time.
-
     if (dest->active == 0) { return 0; } // No VM to send to
 
-    int gcs = dest->stats.collections;
-    pthread_mutex_lock(&dest->alloc_lock);
-    VAL dmsg = copyTo(dest, msg);
-    pthread_mutex_unlock(&dest->alloc_lock);
-
-    if (dest->stats.collections > gcs) {
-        // a collection will have invalidated the copy
-        pthread_mutex_lock(&dest->alloc_lock);
-        dmsg = copyTo(dest, msg); // try again now there's room...
-        pthread_mutex_unlock(&dest->alloc_lock);
-    }
-
-    pthread_mutex_lock(&(dest->inbox_lock));
+    Msg* m = message_new(sender, msg);
 
-    if (dest->inbox_write >= dest->inbox_end) {
-        // FIXME: This is obviously bad in the long run. This should
-        // either block, make the inbox bigger, or return an error code,
-        // or possibly make it user configurable
-        fprintf(stderr, "Inbox full");
-        exit(-1);
-    }
-
-    dest->inbox_write->msg = dmsg;
+    // Blocks if the destination's inbox is full, but never on our own
+    channel_id = mailbox_put(&dest->inbox, m, channel_id, sender != dest);
     if (channel_id == 0) {
-        // Set lowest bit to indicate this message is initiating a channel
-        channel_id = 1 + ((dest->inbox_nextid++) << 1);
-    } else {
-        channel_id = channel_id << 1;
+        shared_set_free(&m->shared);
+        free(m);
     }
-    dest->inbox_write->channel_id = channel_id;
-
-    dest->inbox_write->sender = sender;
-    dest->inbox_write++;
-
-    // Wake up the other thread
-    pthread_mutex_lock(&dest->inbox_block);
-    pthread_cond_signal(&dest->inbox_waiting);
-    pthread_mutex_unlock(&dest->inbox_block);
-
-//    printf("Sending [signalled]...\n");
-
-    pthread_mutex_unlock(&(dest->inbox_lock));
-//    printf("Sending [unlock]...\n");
-    return channel_id >> 1;
+    return channel_id;
 }
 
 VM* idris_checkMessages(VM* vm) {
@@ -890,63 +1642,30 @@ VM* idris_checkMessages(VM* vm) {
 }
 
 Msg* idris_checkInitMessages(VM* vm) {
-    Msg* msg;
-
-    for (msg = vm->inbox; msg < vm->inbox_end && msg->msg != NULL; ++msg) {
-        if (msg->channel_id && 1 == 1) { // init bit set
-            return msg;
-        }
-    }
-    return 0;
+    return mailbox_find_init(&vm->inbox);
 }
 
 VM* idris_checkMessagesFrom(VM* vm, int channel_id, VM* sender) {
-    Msg* msg;
-
-    for (msg = vm->inbox; msg < vm->inbox_end && msg->msg != NULL; ++msg) {
-        if (sender == NULL || msg->sender == sender) {
-            if (channel_id == 0 || channel_id == msg->channel_id >> 1) {
-                return msg->sender;
-            }
-        }
-    }
-    return 0;
+    Msg* msg = mailbox_find(&vm->inbox, channel_id, sender);
+    return msg == NULL ? NULL : msg->sender;
 }
 
-VM* idris_checkMessagesTimeout(VM* vm, int delay) {
-    VM* sender = idris_checkMessagesFrom(vm, 0, NULL);
-    if (sender != NULL) {
-        return sender;
-    }
-
-    struct timespec timeout;
-    int status;
+static VM* checkMessagesWithin(VM* vm, int channel_id, VM* sender,
+                               int64_t usecs) {
+    struct timespec deadline;
+    mailbox_deadline(&deadline, usecs);
 
-    // Wait either for a timeout or until we get a signal that a message
-    // has arrived.
-    pthread_mutex_lock(&vm->inbox_block);
-    timeout.tv_sec = time (NULL) + delay;
-    timeout.tv_nsec = 0;
-    status = pthread_cond_timedwait(&vm->inbox_waiting, &vm->inbox_block,
-                               &timeout);
-    (void)(status); //don't emit 'unused' warning
-    pthread_mutex_unlock(&vm->inbox_block);
-
-    return idris_checkMessagesFrom(vm, 0, NULL);
+    Msg* msg = mailbox_wait(&vm->inbox, channel_id, sender, &deadline);
+    return msg == NULL ? NULL : msg->sender;
 }
 
+VM* idris_checkMessagesTimeout(VM* vm, int delay) {
+    return checkMessagesWithin(vm, 0, NULL, (int64_t)delay * 1000000);
+}
 
-Msg* idris_getMessageFrom(VM* vm, int channel_id, VM* sender) {
-    Msg* msg;
-
-    for (msg = vm->inbox; msg < vm->inbox_write; ++msg) {
-        if (sender == NULL || msg->sender == sender) {
-            if (channel_id == 0 || channel_id == msg->channel_id >> 1) {
-                return msg;
-            }
-        }
-    }
-    return NULL;
+VM* idris_checkMessagesFromTimeout(VM* vm, int channel_id, VM* sender,
+                                   int usecs) {
+    return checkMessagesWithin(vm, channel_id, sender, usecs);
 }
 
 // block until there is a message in the queue
@@ -955,64 +1674,21 @@ Msg* idris_recvMessage(VM* vm) {
 }
 
 Msg* idris_recvMessageFrom(VM* vm, int channel_id, VM* sender) {
-    Msg* msg;
-    Msg* ret = malloc(sizeof(Msg));
-
-    struct timespec timeout;
-    int status;
-    
     if (sender && sender->active == 0) { return NULL; } // No VM to receive from
 
-    pthread_mutex_lock(&vm->inbox_block);
-    msg = idris_getMessageFrom(vm, channel_id, sender);
-
-    while (msg == NULL) {
-//        printf("No message yet\n");
-//        printf("Waiting [lock]...\n");
-        timeout.tv_sec = time (NULL) + 3;
-        timeout.tv_nsec = 0;
-        status = pthread_cond_timedwait(&vm->inbox_waiting, &vm->inbox_block,
-                               &timeout);
-        (void)(status); //don't emit 'unused' warning
-//        printf("Waiting [unlock]... %d\n", status);
-        msg = idris_getMessageFrom(vm, channel_id, sender);
-    }
-    pthread_mutex_unlock(&vm->inbox_block);
-
-    if (msg != NULL) {
-        ret->msg = msg->msg;
-        ret->sender = msg->sender;
-
-        pthread_mutex_lock(&(vm->inbox_lock));
-
-        // Slide everything down after the message in the inbox,
-        // Move the inbox_write pointer down, and clear the value at the
-        // end - O(n) but it's easier since the message from a specific
-        // sender could be anywhere in the inbox
-
-        for(;msg < vm->inbox_write; ++msg) {
-            if (msg+1 != vm->inbox_end) {
-                msg->sender = (msg + 1)->sender;
-                msg->msg = (msg + 1)->msg;
-            }
-        }
-
-        vm->inbox_write->msg = NULL;
-        vm->inbox_write->sender = NULL;
-        vm->inbox_write--;
+    // Only a message which matches wakes us up
+    Msg* msg = mailbox_wait(&vm->inbox, channel_id, sender, NULL);
 
-        pthread_mutex_unlock(&(vm->inbox_lock));
-    } else {
-        fprintf(stderr, "No messages waiting");
-        exit(-1);
-    }
-
-    return ret;
+    // The Msg itself is handed to the caller, who frees it
+    mailbox_remove(&vm->inbox, msg);
+    return msg;
 }
 #endif
 
 VAL idris_getMsg(Msg* msg) {
-    return msg->msg;
+    VM* vm = get_vm();
+    shared_set_move(&vm->shared, &msg->shared);
+    return region_move(vm, msg->region, msg->region_size, msg->msg);
 }
 
 VM* idris_getSender(Msg* msg) {
@@ -1024,7 +1700,8 @@ int idris_getChannel(Msg* msg) {
 }
 
 void idris_freeMsg(Msg* msg) {
-    free(msg);
+    shared_set_free(&msg->shared);
+    free(msg); // its region is in the same block
 }
 
 int idris_errno() {
@@ -1043,7 +1720,9 @@ void init_nullaries() {
     nullary_cons = malloc(256 * sizeof(VAL));
     for(i = 0; i < 256; ++i) {
         cl = malloc(sizeof(Closure));
-        SETTY(cl, CT_CON);
+        // Made once, outside any heap, like Integer constants
+        cl->ty = CT_CON;
+        SETFLAG(cl, HEAP_SHARED | HEAP_STATIC);
         cl->info.c.tag_arity = i << 8;
         nullary_cons[i] = cl;
     }
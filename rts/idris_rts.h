@@ -14,6 +14,8 @@
 #endif
 
 #include "idris_heap.h"
+#include "idris_shared.h"
+#include "idris_mailbox.h"
 #include "idris_stats.h"
 
 #ifndef EXIT_SUCCESS
@@ -26,8 +28,8 @@
 // Closures
 typedef enum {
     CT_CON, CT_INT, CT_BIGINT, CT_FLOAT, CT_STRING, CT_STROFFSET,
-    CT_BITS8, CT_BITS16, CT_BITS32, CT_BITS64, CT_UNIT, CT_PTR, CT_FWD,
-    CT_MANAGEDPTR, CT_RAWDATA, CT_CDATA
+    CT_BITS32, CT_BITS64, CT_UNIT, CT_PTR, CT_FWD,
+    CT_MANAGEDPTR, CT_RAWDATA, CT_CDATA, CT_ROPE
 } ClosureType;
 
 typedef struct Closure *VAL;
@@ -37,11 +39,57 @@ typedef struct {
     VAL args[];
 } con;
 
+// A view of part of another string (never itself a view), sharing its
+// characters. substr and strTail return views rather than copies. A view
+// which runs to the end of its string is read in place; any other is
+// copied once, the first time it is needed as a C string, since it has no
+// terminator (see GETSTROFF).
 typedef struct {
     VAL str;
-    size_t offset;
+    size_t offset; // in bytes
+    size_t len;    // bytes in view
+    size_t before; // characters of str before the offset, or STR_UNKNOWN
+    size_t chars;  // characters in view, or STR_UNKNOWN
 } StrOffset;
 
+// Stored in front of the characters of a CT_STRING, since heap objects
+// carry no size header. The lengths are worked out when first needed; a
+// string with as many characters as bytes is ASCII, and is indexed
+// directly.
+typedef struct {
+    size_t alloc; // bytes allocated for the characters, with the terminator
+    size_t len;   // bytes before the terminator, or STR_UNKNOWN
+    size_t chars; // code points, or STR_UNKNOWN
+    // A CT_RAWDATA holding the byte offset of every STR_INDEX_STEP'th
+    // character of a long string, built the first time it is indexed.
+    // Collectors drop it rather than copying it.
+    VAL index;
+} StrHeader;
+
+#define STR_INDEX_STEP 64
+
+#define STR_UNKNOWN ((size_t)-1)
+
+// The concatenation of two long strings (of any representation), so that
+// repeated ++ does not copy. Its characters are gathered into a CT_STRING
+// the first time they are needed, after which the pieces are dropped; the
+// collector replaces a flattened rope with its CT_STRING.
+typedef struct {
+    VAL left;
+    VAL right;
+    size_t len;   // bytes
+    size_t chars; // code points, or STR_UNKNOWN
+    VAL flat;     // NULL until flattened
+} Rope;
+
+// A flattened rope or view which did not fit in the heap (see GETROPE). It
+// is freed at the second full collection after it was made, by which time
+// it has been replaced by a copy and any C pointers into it are gone.
+typedef struct StrSpill {
+    struct StrSpill* next;
+    // followed by a CT_STRING
+} StrSpill;
+
 // A foreign pointer, managed by the idris GC
 typedef struct {
     size_t size;
@@ -61,9 +109,8 @@ typedef struct Closure {
         double f;
         char* str;
         StrOffset* str_offset;
+        Rope* rope;
         void* ptr;
-        uint8_t bits8;
-        uint16_t bits16;
         uint32_t bits32;
         uint64_t bits64;
         ManagedPtr* mptr;
@@ -72,18 +119,6 @@ typedef struct Closure {
     } info;
 } Closure;
 
-struct VM;
-
-struct Msg_t {
-    struct VM* sender;
-    // An identifier to say which conversation this message is part of.
-    // Lowest bit is set if the id is the first message in a conversation.
-    int channel_id;
-    VAL msg;
-};
-
-typedef struct Msg_t Msg;
-
 struct VM {
     int active; // 0 if no longer running; keep for message passing
                 // TODO: If we're going to have lots of concurrent threads,
@@ -95,20 +130,22 @@ struct VM {
     VAL* stack_max;
 
     CHeap c_heap;
+    SharedSet shared; // the shared regions this VM has been given
     Heap heap;
+    StrSpill* spill;         // strings flattened since the last full GC
+    size_t spill_size;       // bytes in them, which that GC copies in
+    StrSpill* spill_retired; // and before it
+    char* line_buf; // lines too long for the heap's free space are read here
+    size_t line_size;
 #ifdef HAS_PTHREAD
-    pthread_mutex_t inbox_lock;
-    pthread_mutex_t inbox_block;
-    pthread_mutex_t alloc_lock;
-    pthread_cond_t inbox_waiting;
-
-    Msg* inbox; // Block of memory for storing messages
-    Msg* inbox_end; // End of block of memory
-    int inbox_nextid; // Next channel id
-    Msg* inbox_write; // Location of next message to write
+    Mailbox inbox;
 
     int processes; // Number of child processes
-    int max_threads; // maximum number of threads to run in parallel
+    int max_threads; // worker threads running processes as green threads;
+                     // 0 to give each process an OS thread
+
+    int gc_threads; // Number of threads copying in a full collection
+    struct GCWorkers* gc_workers; // Started on the first parallel collection
 #endif
     Stats stats;
 
@@ -182,15 +219,32 @@ typedef void(*func)(VM*, VAL*);
 #define ALIGN(__p, __alignment) ((__p + __alignment - 1) & ~(__alignment - 1))
 
 // Retrieving values
-#define GETSTR(x) (ISSTR(x) ? (((VAL)(x))->info.str) : GETSTROFF(x))
+#define GETSTR(x) (ISSTR(x) ? (((VAL)(x))->info.str) : \
+                   GETTY(x) == CT_ROPE ? GETROPE(x) : GETSTROFF(x))
 #define GETPTR(x) (((VAL)(x))->info.ptr)
 #define GETMPTR(x) (((VAL)(x))->info.mptr->data)
 #define GETFLOAT(x) (((VAL)(x))->info.f)
 #define GETCDATA(x) (((VAL)(x))->info.c_heap_item)
 
-#define GETBITS8(x) (((VAL)(x))->info.bits8)
-#define GETBITS16(x) (((VAL)(x))->info.bits16)
+#define STRHEADER(x) ((StrHeader*)((char*)(x) + sizeof(Closure)))
+// Bytes allocated for the characters of a CT_STRING (including the
+// terminator)
+#define STRALLOC(x) (STRHEADER(x)->alloc)
+
+// Bits8 and Bits16 values are held in the VAL itself, tagged like an Int,
+// so making one never allocates. So are Bits32 values, where an Int has
+// room. Bits64 values are always boxed.
+#if UINTPTR_MAX > UINT32_MAX
+#define BITS32_UNBOXED
+#endif
+
+#define GETBITS8(x) ((uint8_t)GETINT(x))
+#define GETBITS16(x) ((uint16_t)GETINT(x))
+#ifdef BITS32_UNBOXED
+#define GETBITS32(x) ((uint32_t)GETINT(x))
+#else
 #define GETBITS32(x) (((VAL)(x))->info.bits32)
+#endif
 #define GETBITS64(x) (((VAL)(x))->info.bits64)
 
 #define TAG(x) (ISINT(x) || x == NULL ? (-1) : ( GETTY(x) == CT_CON ? (x)->info.c.tag_arity >> 8 : (-1)) )
@@ -209,6 +263,15 @@ typedef void(*func)(VM*, VAL*);
 #define GETHEAP(x) ((x)->ty >> 16)
 #define SETHEAP(x,y) (x)->ty = (((x)->ty & 0x0000ffff) | ((y) << 16))
 
+// Flags kept in the top 16 bits
+#define HEAP_REMEMBERED 0x1 // in the remembered set of a generational heap
+#define HEAP_SHARED     0x2 // in a shared region, so never moved or written
+#define HEAP_STATIC     0x4 // (with HEAP_SHARED) made once, outside any region
+
+#define HASFLAG(x,f) ((GETHEAP(x) & (f)) != 0)
+#define SETFLAG(x,f) (x)->ty = ((x)->ty | ((f) << 16))
+#define CLEARFLAG(x,f) (x)->ty = ((x)->ty & ~((uint32_t)(f) << 16))
+
 // Integers, floats and operators
 
 typedef intptr_t i_int;
@@ -243,9 +306,13 @@ VAL MKFLOAT(VM* vm, double val);
 VAL MKSTR(VM* vm, const char* str);
 VAL MKPTR(VM* vm, void* ptr);
 VAL MKMPTR(VM* vm, void* ptr, size_t size);
-VAL MKB8(VM* vm, uint8_t b);
-VAL MKB16(VM* vm, uint16_t b);
+#define MKB8(vm, b) MKINT((i_int)(uint8_t)(b))
+#define MKB16(vm, b) MKINT((i_int)(uint16_t)(b))
+#ifdef BITS32_UNBOXED
+#define MKB32(vm, b) MKINT((i_int)(uint32_t)(b))
+#else
 VAL MKB32(VM* vm, uint32_t b);
+#endif
 VAL MKB64(VM* vm, uint64_t b);
 VAL MKCDATA(VM* vm, CHeapItem * item);
 
@@ -257,7 +324,14 @@ VAL MKPTRc(VM* vm, void* ptr);
 VAL MKMPTRc(VM* vm, void* ptr, size_t size);
 VAL MKCDATAc(VM* vm, CHeapItem * item);
 
+// Copies the characters in view, if they do not run to the end of the
+// string. As with GETROPE, this never collects.
 char* GETSTROFF(VAL stroff);
+// Flattens the rope if needed. This never collects: if the heap is full,
+// the characters go outside it.
+char* GETROPE(VAL rope);
+// Bytes in a string of any representation, not counting the terminator
+size_t idris_strbytes(VAL str);
 
 // #define SETTAG(x, a) (x)->info.c.tag = (a)
 #define SETARG(x, i, a) ((x)->info.c.args)[i] = ((VAL)(a))
@@ -268,7 +342,21 @@ char* GETSTROFF(VAL stroff);
 #define SLIDE(vm, args) \
     memcpy(&(LOC(0)), &(TOP(0)), sizeof(VAL)*args)
 
+#ifdef IDRIS_DEBUG
+// Byte pattern written over freshly allocated, uninitialised objects
+#define IDRIS_POISON 0xa5
+#endif
+
+// Allocate a zeroed heap object of the given size. Only the VM's own thread
+// allocates in its heap, so 'outerlock' is no longer used.
 void* allocate(size_t size, int outerlock);
+// As allocate, but only the header is cleared; the caller must fill in
+// every field before the next allocation. Used by the constructors below
+// and by generated code.
+void* allocate_uninit(size_t size, int outerlock);
+// Allocate a CT_STRING with room for len characters (including the
+// terminator). The characters are uninitialised, and the lengths unknown.
+VAL allocStr(VM* vm, size_t len, int outerlock);
 // void* allocCon(VM* vm, int arity, int outerlock);
 
 // When allocating from C, call 'idris_requireAlloc' with a size to
@@ -288,14 +376,28 @@ void* idris_realloc(void* old, size_t old_size, size_t size);
 void idris_free(void* ptr, size_t size);
 
 #define allocCon(cl, vm, t, a, o) \
-  cl = allocate(sizeof(Closure) + sizeof(VAL)*a, o); \
+  cl = allocate_uninit(sizeof(Closure) + sizeof(VAL)*a, o); \
   SETTY(cl, CT_CON); \
   cl->info.c.tag_arity = ((t) << 8) | (a);
 
+// Add an old generation object to the remembered set, since it has been
+// updated in place and may now refer to objects in the nursery.
+void idris_remember(VM* vm, VAL x);
+
+#define WRITE_BARRIER(vm, cl) \
+  if (IN_OLD_GEN(&(vm)->heap, cl) && !HASFLAG(cl, HEAP_REMEMBERED)) { \
+      idris_remember(vm, cl); \
+  }
+
 #define updateCon(cl, old, t, a) \
-  cl = old; \
-  SETTY(cl, CT_CON); \
-  cl->info.c.tag_arity = ((t) << 8) | (a);
+  if (HASFLAG(old, HEAP_SHARED)) { \
+      allocCon(cl, vm, t, a, 0); \
+  } else { \
+      cl = old; \
+      SETTY(cl, CT_CON); \
+      cl->info.c.tag_arity = ((t) << 8) | (a); \
+      WRITE_BARRIER(vm, cl) \
+  }
 
 #define NULL_CON(x) nullary_cons[x]
 
@@ -313,6 +415,12 @@ void* vmThread(VM* callvm, func f, VAL arg);
 // Copy a structure to another vm's heap
 VAL copyTo(VM* newVM, VAL x);
 
+// Promote a value into a shared region of its own (see idris_shared.h), so
+// that messages containing it pass a pointer rather than a copy. Returns
+// the shared copy, or x itself if it holds a Buffer or managed pointer,
+// whose bytes can be written in place and so must not be shared.
+VAL idris_share(VM* vm, VAL x);
+
 // Add a message to another VM's message queue
 int idris_sendMessage(VM* sender, int channel_id, VM* dest, VAL msg);
 // Check whether there are any messages in the queue and return PID of
@@ -323,15 +431,22 @@ VM* idris_checkMessages(VM* vm);
 Msg* idris_checkInitMessages(VM* vm);
 // Check whether there are any messages in the queue
 VM* idris_checkMessagesFrom(VM* vm, int channel_id, VM* sender);
-// Check whether there are any messages in the queue, and wait if not
+// Check whether there are any messages in the queue, and wait up to
+// 'timeout' seconds if not
 VM* idris_checkMessagesTimeout(VM* vm, int timeout);
+// Check whether there are any messages in the queue on the given channel
+// (any if 0) from the given sender (any if NULL), and wait up to 'usecs'
+// microseconds if not
+VM* idris_checkMessagesFromTimeout(VM* vm, int channel_id, VM* sender,
+                                   int usecs);
 // block until there is a message in the queue
 Msg* idris_recvMessage(VM* vm);
 // block until there is a message in the queue
 Msg* idris_recvMessageFrom(VM* vm, int channel_id, VM* sender);
 
 // Query/free structure used to return message data (recvMessage will malloc,
-// so needs an explicit free)
+// so needs an explicit free). idris_getMsg copies the message into the
+// current VM's heap.
 VAL idris_getMsg(Msg* msg);
 VM* idris_getSender(Msg* msg);
 int idris_getChannel(Msg* msg);
@@ -369,6 +484,14 @@ VAL idris_strlt(VM* vm, VAL l, VAL r);
 VAL idris_streq(VM* vm, VAL l, VAL r);
 VAL idris_strlen(VM* vm, VAL l);
 VAL idris_readStr(VM* vm, FILE* h);
+// Whole lines from h: at least one (unless the file has ended), and then
+// more until there are 'size' bytes of them
+VAL idris_readLines(VM* vm, FILE* h, i_int size);
+// Where the line which starts 'from' bytes into str ends, just past its
+// newline
+i_int idris_lineEnd(VAL str, i_int from);
+// Bytes 'from' to 'to' of str
+VAL idris_strSlice(VM* vm, VAL str, i_int from, i_int to);
 
 VAL idris_strHead(VM* vm, VAL str);
 VAL idris_strTail(VM* vm, VAL str);
@@ -0,0 +1,406 @@
+#ifdef __APPLE__
+#define _XOPEN_SOURCE 600 // for ucontext
+#define _DARWIN_C_SOURCE  // and still MAP_ANON
+#endif
+
+#include "idris_sched.h"
+#include "idris_rts.h"
+#include "idris_mailbox.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAS_PTHREAD
+
+#if defined(WIN32) || defined(__WIN32) || defined(__WIN32__)
+#define SCHED_UNAVAILABLE
+#else
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
+
+#ifndef SCHED_UNAVAILABLE
+
+// Each fiber's C stack, as much as the main thread usually gets. It is
+// reserved rather than committed, so a fiber which does not recurse deeply
+// only takes the few pages it touches.
+#define FIBER_STACK_SIZE (8 << 20)
+
+struct Fiber {
+    ucontext_t context;
+    char* stack;
+    struct VM* vm;
+    void (*run)(void*);
+    void* arg;
+
+    int parked;            // waiting for sched_wake
+    int done;
+    // Parked with a deadline; the worker adds it to the timers once the
+    // fiber has stopped running.
+    int wants_timer;
+    int timed;             // in the list of timers
+    struct timespec deadline;
+
+    Fiber* next;           // in a run queue
+    Fiber* next_timer;
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    Fiber* first;
+    Fiber* last;
+} RunQueue;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    ucontext_t context;        // the worker's own loop
+    Fiber* current;
+    pthread_mutex_t* release;  // unlock once 'current' has stopped running
+    RunQueue queue;
+} Worker;
+
+typedef struct {
+    int nworkers;
+    Worker* workers;
+    unsigned next_worker;      // for fibers made ready by other threads
+    size_t ready;              // fibers in all the run queues
+
+    pthread_mutex_t lock;      // for idle and timers
+    pthread_cond_t wakeup;     // signalled for idle workers
+    int idle;                  // workers waiting on wakeup
+    Fiber* timers;             // parked with a deadline, soonest first
+} Pool;
+
+static Pool* pool = NULL;
+static pthread_mutex_t pool_start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t worker_key;
+
+static void* worker_thread(void* arg);
+
+/******************** Run queues **********************************************/
+
+static void queue_push(RunQueue* q, Fiber* f) {
+    f->next = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->last == NULL) {
+        __atomic_store_n(&q->first, f, __ATOMIC_RELAXED);
+    } else {
+        q->last->next = f;
+    }
+    q->last = f;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static Fiber* queue_pop(RunQueue* q) {
+    Fiber* f;
+    // Thieves look at every queue, so don't lock the empty ones
+    if (__atomic_load_n(&q->first, __ATOMIC_RELAXED) == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&q->lock);
+    f = q->first;
+    if (f != NULL) {
+        __atomic_store_n(&q->first, f->next, __ATOMIC_RELAXED);
+        if (f->next == NULL) {
+            q->last = NULL;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return f;
+}
+
+// Add a fiber to the queue of the worker running this thread, or share
+// them out if this is not a worker.
+static void make_ready(Fiber* f) {
+    Worker* w = pthread_getspecific(worker_key);
+    if (w == NULL) {
+        unsigned i = __atomic_fetch_add(&pool->next_worker, 1,
+                                        __ATOMIC_RELAXED);
+        w = &pool->workers[i % pool->nworkers];
+    }
+    queue_push(&w->queue, f);
+
+    // An idle worker counts itself before it last looks at 'ready', so
+    // one of us sees the other's write.
+    __atomic_add_fetch(&pool->ready, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wakeup);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/******************** Timers **************************************************/
+
+static int before(const struct timespec* a, const struct timespec* b) {
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void add_timer(Fiber* f) {
+    Fiber** p;
+    pthread_mutex_lock(&pool->lock);
+    for(p = &pool->timers; *p != NULL; p = &(*p)->next_timer) {
+        if (before(&f->deadline, &(*p)->deadline)) break;
+    }
+    f->next_timer = *p;
+    *p = f;
+    f->timed = 1;
+    // Idle workers may be waiting for a later deadline, or for none
+    if (pool->timers == f && pool->idle > 0) {
+        pthread_cond_signal(&pool->wakeup);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void cancel_timer(Fiber* f) {
+    Fiber** p;
+    pthread_mutex_lock(&pool->lock);
+    if (f->timed) {
+        for(p = &pool->timers; *p != f; p = &(*p)->next_timer);
+        *p = f->next_timer;
+        f->timed = 0;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Wake the fibers whose deadlines have passed onto w's queue. Called with
+// the pool lock held. Returns the number woken.
+static int fire_timers(Worker* w) {
+    int woken = 0;
+    while (pool->timers != NULL && mailbox_expired(&pool->timers->deadline)) {
+        Fiber* f = pool->timers;
+        pool->timers = f->next_timer;
+        f->timed = 0;
+        if (__atomic_exchange_n(&f->parked, 0, __ATOMIC_SEQ_CST)) {
+            queue_push(&w->queue, f);
+            __atomic_add_fetch(&pool->ready, 1, __ATOMIC_SEQ_CST);
+            woken++;
+        }
+    }
+    return woken;
+}
+
+/******************** Workers *************************************************/
+
+static Fiber* take_fiber(Worker* w) {
+    Fiber* f = queue_pop(&w->queue);
+    int i;
+    for(i = 1; f == NULL && i < pool->nworkers; ++i) {
+        f = queue_pop(&pool->workers[(w->id + i) % pool->nworkers].queue);
+    }
+    if (f != NULL) {
+        __atomic_sub_fetch(&pool->ready, 1, __ATOMIC_SEQ_CST);
+    }
+    return f;
+}
+
+static Fiber* find_work(Worker* w) {
+    for(;;) {
+        if (__atomic_load_n(&pool->timers, __ATOMIC_RELAXED) != NULL) {
+            pthread_mutex_lock(&pool->lock);
+            fire_timers(w);
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        Fiber* f = take_fiber(w);
+        if (f != NULL) {
+            return f;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pool->ready, __ATOMIC_SEQ_CST) == 0 &&
+            fire_timers(w) == 0) {
+            if (pool->timers == NULL) {
+                pthread_cond_wait(&pool->wakeup, &pool->lock);
+            } else {
+                pthread_cond_timedwait(&pool->wakeup, &pool->lock,
+                                       &pool->timers->deadline);
+            }
+        }
+        __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void free_fiber(Fiber* f) {
+    munmap(f->stack, FIBER_STACK_SIZE);
+    free(f);
+}
+
+static void run_fiber(Worker* w, Fiber* f) {
+    w->current = f;
+    init_threaddata(f->vm);
+    swapcontext(&w->context, &f->context);
+    w->current = NULL;
+
+    // The fiber has finished or parked. Nobody can wake it until the lock
+    // it parked with is released.
+    if (f->done) {
+        free_fiber(f);
+        return;
+    }
+    if (f->wants_timer) {
+        f->wants_timer = 0;
+        add_timer(f);
+    }
+    if (w->release != NULL) {
+        pthread_mutex_unlock(w->release);
+        w->release = NULL;
+    }
+}
+
+static void* worker_thread(void* arg) {
+    Worker* w = (Worker*)arg;
+    pthread_setspecific(worker_key, w);
+    for(;;) {
+        run_fiber(w, find_work(w));
+    }
+    return NULL;
+}
+
+static void start_pool(int nworkers) {
+    pthread_mutex_lock(&pool_start_lock);
+    if (pool == NULL) {
+        Pool* p = malloc(sizeof(Pool));
+        int i;
+
+        pthread_key_create(&worker_key, NULL);
+        p->nworkers = nworkers;
+        p->workers = malloc(nworkers * sizeof(Worker));
+        p->next_worker = 0;
+        p->ready = 0;
+        pthread_mutex_init(&p->lock, NULL);
+        mailbox_cond_init(&p->wakeup);
+        p->idle = 0;
+        p->timers = NULL;
+        for(i = 0; i < nworkers; ++i) {
+            Worker* w = &p->workers[i];
+            w->id = i;
+            w->current = NULL;
+            w->release = NULL;
+            pthread_mutex_init(&w->queue.lock, NULL);
+            w->queue.first = w->queue.last = NULL;
+        }
+        __atomic_store_n(&pool, p, __ATOMIC_RELEASE);
+
+        for(i = 0; i < nworkers; ++i) {
+            pthread_create(&p->workers[i].thread, NULL, worker_thread,
+                           &p->workers[i]);
+        }
+    }
+    pthread_mutex_unlock(&pool_start_lock);
+}
+
+/******************** Fibers **************************************************/
+
+static void fiber_main(void) {
+    Worker* w = pthread_getspecific(worker_key);
+    Fiber* f = w->current;
+
+    f->run(f->arg);
+    f->done = 1;
+
+    // It may have moved to another worker while it ran
+    w = pthread_getspecific(worker_key);
+    setcontext(&w->context);
+}
+
+static char* map_stack(void) {
+    char* mem = mmap(NULL, FIBER_STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "RTS ERROR: Unable to allocate a process stack.\n");
+        exit(EXIT_FAILURE);
+    }
+    // Overflowing the stack hits this page, rather than whatever is below
+    mprotect(mem, (size_t)sysconf(_SC_PAGESIZE), PROT_NONE);
+    return mem;
+}
+
+int sched_spawn(int workers, struct VM* vm, void (*run)(void*), void* arg) {
+    start_pool(workers);
+
+    Fiber* f = malloc(sizeof(Fiber));
+    f->stack = map_stack();
+    f->vm = vm;
+    f->run = run;
+    f->arg = arg;
+    f->parked = 0;
+    f->done = 0;
+    f->wants_timer = 0;
+    f->timed = 0;
+
+    getcontext(&f->context);
+    f->context.uc_stack.ss_sp = f->stack;
+    f->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+    f->context.uc_link = NULL;
+    makecontext(&f->context, fiber_main, 0);
+
+    make_ready(f);
+    return 1;
+}
+
+Fiber* sched_self(void) {
+    Worker* w;
+    if (__atomic_load_n(&pool, __ATOMIC_ACQUIRE) == NULL) {
+        return NULL;
+    }
+    w = pthread_getspecific(worker_key);
+    return w == NULL ? NULL : w->current;
+}
+
+void sched_park(Fiber* self, pthread_mutex_t* lock,
+                const struct timespec* deadline) {
+    Worker* w = pthread_getspecific(worker_key);
+
+    __atomic_store_n(&self->parked, 1, __ATOMIC_SEQ_CST);
+    if (deadline != NULL) {
+        self->deadline = *deadline;
+        self->wants_timer = 1;
+    }
+    w->release = lock;
+    swapcontext(&self->context, &w->context);
+
+    // Woken, perhaps on another worker
+    if (deadline != NULL) {
+        cancel_timer(self);
+    }
+    pthread_mutex_lock(lock);
+}
+
+void sched_wake(Fiber* fiber) {
+    if (__atomic_exchange_n(&fiber->parked, 0, __ATOMIC_SEQ_CST)) {
+        make_ready(fiber);
+    }
+}
+
+#else // SCHED_UNAVAILABLE
+
+int sched_spawn(int workers, struct VM* vm, void (*run)(void*), void* arg) {
+    return 0;
+}
+
+Fiber* sched_self(void) {
+    return NULL;
+}
+
+void sched_park(Fiber* self, pthread_mutex_t* lock,
+                const struct timespec* deadline) {
+}
+
+void sched_wake(Fiber* fiber) {
+}
+
+#endif // SCHED_UNAVAILABLE
+
+#endif // HAS_PTHREAD
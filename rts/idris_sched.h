@@ -0,0 +1,48 @@
+#ifndef _IDRIS_SCHED_H
+#define _IDRIS_SCHED_H
+
+#ifdef HAS_PTHREAD
+
+#include <pthread.h>
+#include <time.h>
+
+/* *** Green threads (+RTS -P<n>) ***
+ * Rather than an OS thread each, processes can run as green threads
+ * ("fibers") on a pool of n worker threads. Each fiber has a C stack of its
+ * own, of which only the pages it touches take up memory.
+ *
+ * A fiber runs until it finishes or waits for something (a message, or
+ * room in a full inbox). It then parks, giving its worker to another fiber,
+ * until it is woken. Each worker has a queue of fibers ready to run, and a
+ * worker with nothing to do steals from the others.
+ *
+ * Calls which block in the OS (such as reading a file) still block the
+ * whole worker.
+ */
+
+struct VM;
+typedef struct Fiber Fiber;
+
+// Run 'run(arg)' for the VM in a new fiber. The pool is started, with
+// 'workers' threads, the first time. Returns 0 if green threads are not
+// available on this platform.
+int sched_spawn(int workers, struct VM* vm, void (*run)(void*), void* arg);
+
+// The fiber running on this thread, or NULL if this is not a worker
+Fiber* sched_self(void);
+
+// Park the current fiber until sched_wake is called for it, or until the
+// deadline (from mailbox_deadline; NULL for none) passes. 'lock' is held
+// by the caller; it is released once the fiber has stopped running, so
+// anyone who wakes the fiber while holding it knows that it is parked.
+// The lock is held again when this returns.
+void sched_park(Fiber* self, pthread_mutex_t* lock,
+                const struct timespec* deadline);
+
+// Make a parked fiber ready to run. Does nothing if it has already been
+// woken.
+void sched_wake(Fiber* fiber);
+
+#endif
+
+#endif // _IDRIS_SCHED_H
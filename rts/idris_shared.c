@@ -0,0 +1,145 @@
+#include "idris_shared.h"
+#include "idris_rts.h"
+#include "idris_gc.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SET_INIT_SIZE 4
+
+static void out_of_memory(void) {
+    fprintf(stderr, "RTS ERROR: Unable to allocate shared region.\n");
+    exit(EXIT_FAILURE);
+}
+
+SharedRegion* shared_region_new(size_t size) {
+    SharedRegion* r = malloc(sizeof(SharedRegion) + size);
+    if (r == NULL) {
+        out_of_memory();
+    }
+    r->refs = 1;
+    r->size = size;
+    return r;
+}
+
+void shared_region_seal(SharedRegion* r) {
+    char* scan = SHARED_START(r);
+    while (scan < SHARED_END(r)) {
+        VAL cl = (VAL)scan;
+        SETFLAG(cl, HEAP_SHARED);
+        scan += closure_size(cl);
+    }
+}
+
+static void shared_release(SharedRegion* r) {
+    if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(r);
+    }
+}
+
+/******************** Sets ****************************************************/
+
+void shared_set_init(SharedSet* s) {
+    s->refs = NULL;
+    s->count = 0;
+    s->size = 0;
+}
+
+void shared_set_free(SharedSet* s) {
+    size_t i;
+    for(i = 0; i < s->count; ++i) {
+        shared_release(s->refs[i].region);
+    }
+    free(s->refs);
+    shared_set_init(s);
+}
+
+// The index of the first region at or after 'p'
+static size_t lower_bound(SharedSet* s, char* p) {
+    size_t lo = 0, hi = s->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (SHARED_START(s->refs[mid].region) < p) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static SharedRef* find(SharedSet* s, VAL x) {
+    size_t i = lower_bound(s, (char*)x + 1);
+    if (i == 0) {
+        return NULL;
+    }
+    SharedRef* ref = &s->refs[i - 1];
+    return (char*)x < SHARED_END(ref->region) ? ref : NULL;
+}
+
+void shared_set_add(SharedSet* s, SharedRegion* r) {
+    size_t i = lower_bound(s, SHARED_START(r));
+    if (i < s->count && s->refs[i].region == r) {
+        shared_release(r); // already held
+        return;
+    }
+    if (s->count == s->size) {
+        s->size = s->size == 0 ? SET_INIT_SIZE : s->size * 2;
+        s->refs = realloc(s->refs, s->size * sizeof(SharedRef));
+        if (s->refs == NULL) {
+            out_of_memory();
+        }
+    }
+    memmove(&s->refs[i + 1], &s->refs[i], (s->count - i) * sizeof(SharedRef));
+    s->refs[i].region = r;
+    s->refs[i].marked = 0;
+    s->count++;
+}
+
+void shared_set_move(SharedSet* to, SharedSet* from) {
+    size_t i;
+    for(i = 0; i < from->count; ++i) {
+        shared_set_add(to, from->refs[i].region);
+    }
+    free(from->refs);
+    shared_set_init(from);
+}
+
+void shared_set_ref(SharedSet* to, SharedSet* from, VAL x) {
+    if (HASFLAG(x, HEAP_STATIC)) {
+        return;
+    }
+    SharedRef* ref = find(from, x);
+    assert(ref != NULL);
+    __atomic_add_fetch(&ref->region->refs, 1, __ATOMIC_RELAXED);
+    shared_set_add(to, ref->region);
+}
+
+/******************** Collection **********************************************/
+
+void shared_mark(SharedSet* s, VAL x) {
+    if (HASFLAG(x, HEAP_STATIC)) {
+        return;
+    }
+    SharedRef* ref = find(s, x);
+    assert(ref != NULL); // a VM only reaches the regions it holds
+    if (ref != NULL && !__atomic_load_n(&ref->marked, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&ref->marked, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void shared_sweep(SharedSet* s) {
+    size_t i, kept = 0;
+    for(i = 0; i < s->count; ++i) {
+        if (s->refs[i].marked) {
+            s->refs[kept].region = s->refs[i].region;
+            s->refs[kept].marked = 0;
+            kept++;
+        } else {
+            shared_release(s->refs[i].region);
+        }
+    }
+    s->count = kept;
+}
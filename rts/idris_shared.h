@@ -0,0 +1,65 @@
+#ifndef _IDRIS_SHARED_H
+#define _IDRIS_SHARED_H
+
+#include <stddef.h>
+
+/* *** Shared regions ***
+ * An immutable value can be promoted, once, into a shared region outside
+ * any VM's heap (see idris_share). Its objects are flagged HEAP_SHARED.
+ * Collectors leave them where they are, and messages pass pointers to them
+ * rather than copies.
+ *
+ * A region is closed: its objects only refer to each other (or to nullary
+ * constructors), so a VM can only reach a region through a pointer it was
+ * given. Each VM keeps the set of regions it has been given, holding one
+ * reference to each. A full collection marks the regions the VM still
+ * reaches, and drops the others. A message in flight holds references to
+ * the regions it points into, which pass to the receiver with it.
+ */
+
+struct Closure;
+
+typedef struct SharedRegion {
+    int refs;
+    size_t size;
+    // followed by the objects
+} SharedRegion;
+
+#define SHARED_START(r) ((char*)((r) + 1))
+#define SHARED_END(r) (SHARED_START(r) + (r)->size)
+
+typedef struct {
+    SharedRegion* region;
+    int marked;
+} SharedRef;
+
+// Sorted by address, so that the region an object is in can be found
+typedef struct {
+    SharedRef* refs;
+    size_t count;
+    size_t size;
+} SharedSet;
+
+// A new region, with room for 'size' bytes of objects and one reference
+SharedRegion* shared_region_new(size_t size);
+// Flag the objects copied into a region as shared
+void shared_region_seal(SharedRegion* r);
+
+void shared_set_init(SharedSet* s);
+// Drop every reference in the set
+void shared_set_free(SharedSet* s);
+// Add a reference to the set, which takes it over
+void shared_set_add(SharedSet* s, SharedRegion* r);
+// Move every reference from one set to another
+void shared_set_move(SharedSet* to, SharedSet* from);
+// Give 'to' a new reference to the region which x (a shared object, which
+// 'from' reaches) is in
+void shared_set_ref(SharedSet* to, SharedSet* from, struct Closure* x);
+
+// During a full collection, the VM reaches the shared object x. Safe to
+// call from several collector threads at once.
+void shared_mark(SharedSet* s, struct Closure* x);
+// After a full collection, drop the regions which were not marked
+void shared_sweep(SharedSet* s);
+
+#endif // _IDRIS_SHARED_H
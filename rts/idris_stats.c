@@ -31,6 +31,7 @@ void print_stats(const Stats * stats) {
     printf("\n");
     printf("%'20" PRIu64 " bytes allocated in the heap\n",  stats->allocations);
     printf("%'20" PRIu64 " bytes copied during GC\n",       stats->copied);
+    printf("%'20" PRIu64 " bytes released to the OS\n",     stats->released);
     printf("%'20" PRIu32 " maximum heap size\n",            stats->max_heap_size);
     printf("%'20" PRIu32 " chunks allocated in the heap\n", stats->alloc_count);
     printf("%'20" PRIu64 " average chunk size\n\n",         avg_chunk);
@@ -50,6 +51,15 @@ void print_stats(const Stats * stats) {
     printf("Productivity %.2f%%\n", productivity);
 }
 
+void print_gc_trace(const Stats * stats, clock_t pause, size_t heap_size,
+                    size_t copied, uint64_t released) {
+    fprintf(stderr,
+            "GC %5" PRIu32 ": %8.3fms, %12zu bytes copied, "
+            "%12zu bytes heap, %12" PRIu64 " bytes released\n",
+            stats->collections, 1000.0 * (double)pause / CLOCKS_PER_SEC,
+            copied, heap_size, released);
+}
+
 void aggregate_stats(Stats * stats1, const Stats * stats2) {
     fprintf(stderr, "RTS error: aggregate_stats not implemented");
 }
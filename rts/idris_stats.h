@@ -7,6 +7,7 @@
 
 #include <inttypes.h>
 #include <stdint.h>
+#include <stddef.h>
 
 
 // TODO: measure user time, exclusive/inclusive stats
@@ -15,6 +16,7 @@ typedef struct {
     uint64_t allocations;       // Size of allocated space in bytes for all execution time.
     uint32_t alloc_count;       // How many times alloc is called.
     uint64_t copied;            // Size of space copied during GC.
+    uint64_t released;          // Size of heap pages given back to the OS.
     uint32_t max_heap_size;     // Maximum heap size achieved.
 
     clock_t init_time;     // Time spent for vm initialization.
@@ -24,11 +26,18 @@ typedef struct {
     clock_t start_time;    // Time of rts entry point.
 #endif // IDRIS_ENABLE_STATS
     uint32_t collections;       // How many times gc called.
+    int trace;                  // Report each collection on stderr.
 } Stats; // without start time it's a monoid, can we remove start_time it somehow?
 
 void print_stats(const Stats * stats);
 void aggregate_stats(Stats * stats1, const Stats * stats2);
 
+#ifdef IDRIS_ENABLE_STATS
+// One line on stderr with the cost of a single collection
+void print_gc_trace(const Stats * stats, clock_t pause, size_t heap_size,
+                    size_t copied, uint64_t released);
+#endif
+
 
 #ifdef IDRIS_ENABLE_STATS
 
@@ -50,8 +59,12 @@ void aggregate_stats(Stats * stats1, const Stats * stats2);
 #define STATS_ENTER_EXIT(stats) clock_t _start_time = clock();
 #define STATS_LEAVE_EXIT(stats) stats.exit_time = clock() - _start_time;
 
+#define STATS_RELEASE(stats, size)              \
+    stats.released += size;
+
 #define STATS_ENTER_GC(stats, heap_size)                        \
     clock_t _start_time = clock();                              \
+    uint64_t _released = stats.released;                        \
     stats.max_heap_size = MAX(stats.max_heap_size, heap_size);
 #define STATS_LEAVE_GC(stats, heap_size, heap_occuped)          \
     clock_t _pause = clock() - _start_time;                     \
@@ -59,7 +72,11 @@ void aggregate_stats(Stats * stats1, const Stats * stats2);
     stats.max_gc_pause = MAX(_pause, stats.max_gc_pause);       \
     stats.max_heap_size = MAX(stats.max_heap_size, heap_size);  \
     stats.copied     += heap_occuped;                           \
-    stats.collections = stats.collections + 1;
+    stats.collections = stats.collections + 1;                  \
+    if (stats.trace) {                                          \
+        print_gc_trace(&stats, _pause, heap_size, heap_occuped, \
+                       stats.released - _released);             \
+    }
 
 #else
 #define STATS_INIT_STATS(stats) memset(&stats, 0, sizeof(Stats));
@@ -68,6 +85,7 @@ void aggregate_stats(Stats * stats1, const Stats * stats2);
 #define STATS_ENTER_EXIT(stats)
 #define STATS_LEAVE_EXIT(stats)
 #define STATS_ALLOC(stats, size)
+#define STATS_RELEASE(stats, size) (void)(size);
 #define STATS_ENTER_GC(stats, heap_size)
 #define STATS_LEAVE_GC(stats, heap_size, heap_occuped)  \
     stats.collections = stats.collections + 1;
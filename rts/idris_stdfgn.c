@@ -41,13 +41,13 @@ int fileError(void* h) {
     return ferror(f);
 }
 
-int fileSize(void* h) {
+i_int fileSize(void* h) {
     FILE* f = (FILE*)h;
     int fd = fileno(f);
 
     struct stat buf;
     if (fstat(fd, &buf) == 0) {
-        return (int)(buf.st_size);
+        return (i_int)(buf.st_size);
     } else {
         return -1;
     }
@@ -13,7 +13,7 @@ void fileClose(void* h);
 int fileEOF(void* h);
 int fileError(void* h);
 // Returns a negative number if not a file (e.g. directory or device)
-int fileSize(void* h);
+i_int fileSize(void* h);
 
 // return 0 on success
 int idris_writeStr(void*h, char* str);
@@ -1,15 +1,268 @@
 #include "idris_utf8.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+/* The scans below work on a block of bytes at a time, using AVX2 or SSE2
+   where the CPU has them (checked once, at run time) and 8 byte words
+   otherwise. A byte starts a character unless its top bits are 10, which
+   as a signed char means it is less than -64. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTF8_X86
+#include <immintrin.h>
+#endif
+
+enum { UTF8_WORDS, UTF8_SSE2, UTF8_AVX2 };
+
+static int utf8_level(void) {
+    static int level = -1;
+    int l = __atomic_load_n(&level, __ATOMIC_RELAXED);
+    if (l < 0) {
+        l = UTF8_WORDS;
+#ifdef UTF8_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            l = UTF8_AVX2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            l = UTF8_SSE2;
+        }
+#endif
+        __atomic_store_n(&level, l, __ATOMIC_RELAXED);
+    }
+    return l;
+}
+
+#ifdef UTF8_X86
+__attribute__((target("avx2")))
+static size_t starts_avx2(__m256i acc) {
+    uint64_t sums[4];
+    acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+    _mm256_storeu_si256((__m256i*)sums, acc);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+// 0x01 in each byte of the block which starts a character
+__attribute__((target("avx2")))
+static __m256i block_avx2(const char* p) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    return _mm256_sub_epi8(_mm256_setzero_si256(),
+                           _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65)));
+}
+
+// Count the characters in whole blocks from p, returning where it stopped
+__attribute__((target("avx2")))
+static const char* count_avx2(const char* p, const char* end, size_t* n) {
+    while (end - p >= 32) {
+        // Byte counters overflow after 255 blocks
+        __m256i acc = _mm256_setzero_si256();
+        int k;
+        for(k = 0; k < 255 && end - p >= 32; ++k, p += 32) {
+            acc = _mm256_add_epi8(acc, block_avx2(p));
+        }
+        *n += starts_avx2(acc);
+    }
+    return p;
+}
+
+// Skip whole blocks which hold fewer than *n characters
+__attribute__((target("avx2")))
+static const char* skip_avx2(const char* p, const char* end, size_t* n) {
+    while (end - p >= 32) {
+        size_t c = starts_avx2(block_avx2(p));
+        if (c >= *n) break;
+        *n -= c;
+        p += 32;
+    }
+    return p;
+}
+
+__attribute__((target("avx2")))
+static const char* ascii_avx2(const char* p, const char* end) {
+    while (end - p >= 32 &&
+           _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)p)) == 0) {
+        p += 32;
+    }
+    return p;
+}
+
+__attribute__((target("sse2")))
+static size_t starts_sse2(__m128i acc) {
+    uint64_t sums[2];
+    acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i*)sums, acc);
+    return sums[0] + sums[1];
+}
+
+__attribute__((target("sse2")))
+static __m128i block_sse2(const char* p) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    return _mm_sub_epi8(_mm_setzero_si128(),
+                        _mm_cmpgt_epi8(v, _mm_set1_epi8(-65)));
+}
+
+__attribute__((target("sse2")))
+static const char* count_sse2(const char* p, const char* end, size_t* n) {
+    while (end - p >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        int k;
+        for(k = 0; k < 255 && end - p >= 16; ++k, p += 16) {
+            acc = _mm_add_epi8(acc, block_sse2(p));
+        }
+        *n += starts_sse2(acc);
+    }
+    return p;
+}
+
+__attribute__((target("sse2")))
+static const char* skip_sse2(const char* p, const char* end, size_t* n) {
+    while (end - p >= 16) {
+        size_t c = starts_sse2(block_sse2(p));
+        if (c >= *n) break;
+        *n -= c;
+        p += 16;
+    }
+    return p;
+}
+
+__attribute__((target("sse2")))
+static const char* ascii_sse2(const char* p, const char* end) {
+    while (end - p >= 16 &&
+           _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p)) == 0) {
+        p += 16;
+    }
+    return p;
+}
+#endif
+
+#define HIGH_BITS 0x8080808080808080ULL
+
+static size_t starts_word(const char* p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    // The top bit of each continuation byte, moved down and summed
+    uint64_t cont = (w & ~(w << 1) & HIGH_BITS) >> 7;
+    return 8 - (size_t)((cont * 0x0101010101010101ULL) >> 56);
+}
+
+static const char* count_words(const char* p, const char* end, size_t* n) {
+    for(; end - p >= 8; p += 8) {
+        *n += starts_word(p);
+    }
+    return p;
+}
+
+static const char* skip_words(const char* p, const char* end, size_t* n) {
+    while (end - p >= 8) {
+        size_t c = starts_word(p);
+        if (c >= *n) break;
+        *n -= c;
+        p += 8;
+    }
+    return p;
+}
+
+static const char* ascii_words(const char* p, const char* end) {
+    uint64_t w;
+    while (end - p >= 8) {
+        memcpy(&w, p, sizeof(w));
+        if ((w & HIGH_BITS) != 0) break;
+        p += 8;
+    }
+    return p;
+}
+
+// Each scan falls through to narrower blocks for the rest
+
+static const char* skip_blocks(const char* p, const char* end, size_t* n) {
+    switch(utf8_level()) {
+#ifdef UTF8_X86
+    case UTF8_AVX2:
+        p = skip_avx2(p, end, n);
+        // fall through
+    case UTF8_SSE2:
+        p = skip_sse2(p, end, n);
+#endif
+        // fall through
+    default:
+        return skip_words(p, end, n);
+    }
+}
+
+static const char* skip_ascii(const char* p, const char* end) {
+    switch(utf8_level()) {
+#ifdef UTF8_X86
+    case UTF8_AVX2:
+        p = ascii_avx2(p, end);
+        // fall through
+    case UTF8_SSE2:
+        p = ascii_sse2(p, end);
+#endif
+        // fall through
+    default:
+        return ascii_words(p, end);
+    }
+}
+
+size_t idris_utf8_count(const char* s, size_t len) {
+    const char* p = s;
+    const char* end = s + len;
+    size_t n = 0;
+    switch(utf8_level()) {
+#ifdef UTF8_X86
+    case UTF8_AVX2:
+        p = count_avx2(p, end, &n);
+        // fall through
+    case UTF8_SSE2:
+        p = count_sse2(p, end, &n);
+#endif
+        // fall through
+    default:
+        p = count_words(p, end, &n);
+    }
+    for(; p < end; ++p) {
+        if ((*p & 0xc0) != 0x80) n++;
+    }
+    return n;
+}
+
+int idris_utf8_valid(const char* s, size_t len) {
+    const char* end = s + len;
+    while (s < end) {
+        const unsigned char* p = (const unsigned char*)s;
+        unsigned char lo = 0x80, hi = 0xbf; // range of the second byte
+        size_t k, follow;
+        if (p[0] < 0x80) {
+            s = skip_ascii(s, end);
+            while (s < end && (unsigned char)*s < 0x80) s++;
+            continue;
+        } else if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+            follow = 1;
+        } else if (p[0] >= 0xe0 && p[0] <= 0xef) {
+            follow = 2;
+            if (p[0] == 0xe0) lo = 0xa0; // overlong
+            if (p[0] == 0xed) hi = 0x9f; // surrogates
+        } else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+            follow = 3;
+            if (p[0] == 0xf0) lo = 0x90; // overlong
+            if (p[0] == 0xf4) hi = 0x8f; // beyond U+10FFFF
+        } else {
+            return 0;
+        }
+        if ((size_t)(end - s) <= follow || p[1] < lo || p[1] > hi) {
+            return 0;
+        }
+        for(k = 2; k <= follow; ++k) {
+            if ((p[k] & 0xc0) != 0x80) return 0;
+        }
+        s += follow + 1;
+    }
+    return 1;
+}
+
 int idris_utf8_strlen(char *s) {
-   int i = 0, j = 0;
-   while (s[i]) {
-     if ((s[i] & 0xc0) != 0x80) j++;
-     i++;
-   }
-   return j;
+    return (int)idris_utf8_count(s, strlen(s));
 }
 
 int idris_utf8_charlen(char* s) {
@@ -30,18 +283,13 @@ int idris_utf8_charlen(char* s) {
 }
 
 unsigned idris_utf8_index(char* s, int idx) {
-   int i = 0, j = 0;
-   while (j < idx) {
-     if ((s[i] & 0xc0) != 0x80) j++;
-     i++;
-   }
-   // Find the start of the next character
-   while ((s[i] & 0xc0) == 0x80) { i++; }
+   int i = 0;
+   s = idris_utf8_advance(s, idx);
 
    unsigned bytes = 0;
    unsigned top = 0;
 
-   int init = (int)s[1];
+   int init = (int)s[i];
 
    // s[i] is now the start of the character we want
    if ((s[i] & 0x80) == 0) {
@@ -79,6 +327,14 @@ unsigned idris_utf8_index(char* s, int idx) {
 }
 
 char* idris_utf8_advance(char* str, int i) {
+    if (i > 0) {
+        // A character takes at most 4 bytes, so there is no need to look
+        // further for the terminator. Characters in blocks skipped here
+        // are counted in the same way as by the loop below.
+        size_t n = i;
+        str = (char*)skip_blocks(str, str + strnlen(str, n * 4), &n);
+        i = (int)n;
+    }
     while (i > 0 && *str != '\0') {
         // In a UTF8 single-byte char, the highest bit is 0.  In the
         // first byte of a multi-byte char, the highest two bits are
@@ -6,8 +6,15 @@
    correctness.) Nevertheless, they mean that we can treat Strings as
    UFT8. Patches welcome :). */
 
+#include <stddef.h>
+
 // Get length of a UTF8 encoded string in characters
 int idris_utf8_strlen(char *s);
+// Count the characters in the first len bytes of s
+size_t idris_utf8_count(const char* s, size_t len);
+// Check that the len bytes at s are well formed UTF8 (no overlong forms,
+// surrogates, or code points beyond U+10FFFF)
+int idris_utf8_valid(const char* s, size_t len);
 // Get number of bytes the first character takes in a string
 int idris_utf8_charlen(char* s);
 // Return int representation of string at an index.
@@ -133,6 +133,14 @@ int idrnet_accept(int sockfd, void* sockaddr) {
     return accept(sockfd, addr, &addr_size);
 }
 
+int idrnet_set_nonblocking(int sockfd) {
+    u_long mode = 1;
+    if (!check_init()) {
+        return -1;
+    }
+    return ioctlsocket(sockfd, FIONBIO, &mode) == 0 ? 0 : -1;
+}
+
 int idrnet_send(int sockfd, char* data) {
     int len = strlen(data); // For now.
     if (!check_init()) {
@@ -173,6 +181,80 @@ int idrnet_recv_buf(int sockfd, void* buf, int len) {
     return recv(sockfd, buf, len, 0);
 }
 
+void* idrnet_iov_new(int count) {
+    return calloc(count, sizeof(WSABUF));
+}
+
+void idrnet_iov_set(void* iov, int i, void* buf, int len) {
+    WSABUF* v = (WSABUF*) iov;
+    v[i].buf = buf;
+    v[i].len = len;
+}
+
+int idrnet_writev(int sockfd, void* iov, int count) {
+    DWORD sent;
+    if (!check_init()) {
+        return -1;
+    }
+    if (WSASend(sockfd, (WSABUF*) iov, count, &sent, 0, NULL, NULL) != 0) {
+        return -1;
+    }
+    return sent;
+}
+
+int idrnet_readv(int sockfd, void* iov, int count) {
+    DWORD received, flags = 0;
+    if (!check_init()) {
+        return -1;
+    }
+    if (WSARecv(sockfd, (WSABUF*) iov, count, &received, &flags,
+                NULL, NULL) != 0) {
+        return -1;
+    }
+    return received;
+}
+
+int64_t idrnet_sendfile(int sockfd, void* h, int64_t offset, int64_t len) {
+    FILE* f = (FILE*) h;
+    char buf[65536];
+    int64_t sent = 0;
+    if (!check_init() || _fseeki64(f, offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    while (sent < len) {
+        size_t want = len - sent < (int64_t) sizeof(buf)
+                          ? len - sent : sizeof(buf);
+        size_t got = fread(buf, 1, want, f);
+        if (got == 0) {
+            break;
+        }
+        int res = send(sockfd, buf, got, 0);
+        if (res <= 0) {
+            return sent > 0 ? sent : -1;
+        }
+        sent += res;
+        if ((size_t) res < got) { // the rest of buf is not sent
+            break;
+        }
+    }
+    return sent;
+}
+
+void buf_htonl(void* buf, int len) {
+    unsigned char* bytes = (unsigned char*) buf;
+    int i;
+    for (i = 0; i + 4 <= len; i += 4) {
+        uint32_t word;
+        memcpy(&word, bytes + i, 4);
+        word = htonl(word);
+        memcpy(bytes + i, &word, 4);
+    }
+}
+
+void buf_ntohl(void* buf, int len) {
+    buf_htonl(buf, len);
+}
+
 int idrnet_get_recv_res(void* res_struct) {
     return (((idrnet_recv_result*) res_struct)->result);
 }
@@ -20,13 +20,14 @@ import Util.System
 import Numeric
 import Data.Char
 import Data.Bits
-import Data.List (intercalate, nubBy)
+import Data.List (elemIndex, intercalate, nub, nubBy)
 import System.Process
 import System.Exit
 import System.IO
 import System.Directory
 import System.FilePath ((</>), (<.>))
 import Control.Monad
+import Data.Maybe (isJust)
 
 import Debug.Trace
 
@@ -64,11 +65,13 @@ codegenC' defs out exec incs objs libs flags exports iface dbg
          let bc = map toBC defs
          let wrappers = genWrappers bc
          let h = concatMap toDecl (map fst bc)
-         let cc = concatMap (uncurry toC) bc
+         let consts = nub (concatMap (bigLits . snd) bc)
+         let cc = concatMap (uncurry (toC consts)) bc
          let hi = concatMap ifaceC (concatMap getExp exports)
          d <- getDataDir
          mprog <- readFile (d </> "rts" </> "idris_main" <.> "c")
-         let cout = headers incs ++ debug dbg ++ h ++ wrappers ++ cc ++
+         let cout = headers incs ++ debug dbg ++ h ++ bigConstTable consts ++
+                     wrappers ++ cc ++
                      (if (exec == Executable) then mprog else hi)
          case exec of
            Raw -> writeSource out cout
@@ -134,12 +137,285 @@ creg Tmp = "REG1"
 toDecl :: Name -> String
 toDecl f = "void " ++ cname f ++ "(VM*, VAL*);\n"
 
-toC :: Name -> [BC] -> String
-toC f code
+toC :: [Integer] -> Name -> [BC] -> String
+toC consts f code
     = -- "/* " ++ show code ++ "*/\n\n" ++
       "void " ++ cname f ++ "(VM* vm, VAL* oldbase) {\n" ++
                  indent 1 ++ "INITFRAME;\n" ++
-                 concatMap (bcc 1) code ++ "}\n\n"
+                 concatMap decl [UBits64, UDouble] ++
+                 concatMap (bcc u 1) code' ++ "}\n\n"
+  where
+    code' = fuseBig (useBigConsts consts code)
+    u = unboxedLocals code'
+    decl ty = case [L i | (i, t) <- u, t == ty] of
+                   [] -> ""
+                   ls -> indent 1 ++ unboxedCType ty ++ " " ++
+                         intercalate ", " (map (unboxedLocal ty) ls) ++ ";\n"
+
+-- | Integer literals which may not fit in a small Integer
+bigLit :: Integer -> Bool
+bigLit i = i < -(2^30) || i >= 2^30
+
+bigLits :: [BC] -> [Integer]
+bigLits = concatMap lits
+  where
+    lits (ASSIGNCONST _ (BI i)) | bigLit i = [i]
+    lits (CASE _ _ alts def) = concatMap bigLits (map snd alts ++ maybe [] (: []) def)
+    lits (CONSTCASE _ alts def) = concatMap bigLits (map snd alts ++ maybe [] (: []) def)
+    lits _ = []
+
+-- | Big Integer literals are parsed once, before main, into a table (see
+-- bigConstTable); each use of one reads it from there.
+useBigConsts :: [Integer] -> [BC] -> [BC]
+useBigConsts consts = map use
+  where
+    use (ASSIGNCONST l (BI i))
+        | Just k <- elemIndex i consts = OP l (LExternal (sMN k "bigconst")) []
+    use (CASE safe r alts def)
+        = CASE safe r [(t, map use c) | (t, c) <- alts] (fmap (map use) def)
+    use (CONSTCASE r alts def)
+        = CONSTCASE r [(c, map use b) | (c, b) <- alts] (fmap (map use) def)
+    use i = i
+
+bigConstTable :: [Integer] -> String
+bigConstTable [] = ""
+bigConstTable consts
+    = "static VAL idris_bigconsts[" ++ n ++ "];\n\n" ++
+      "static void __attribute__((constructor)) idris_initBigConsts(void) {\n" ++
+      indent 1 ++ "static const char* const digits[] = {\n" ++
+      intercalate ",\n" [indent 2 ++ show (show i) | i <- consts] ++ "\n" ++
+      indent 1 ++ "};\n" ++
+      indent 1 ++ "idris_bigConsts(idris_bigconsts, digits, " ++ n ++ ");\n" ++
+      "}\n\n"
+  where n = show (length consts)
+
+-- | Fuse Integer arithmetic whose intermediate results are used just once:
+-- a multiplication which feeds an addition or subtraction becomes a single
+-- multiply-add, and an operation on a fresh result which nothing else
+-- refers to updates it in place instead of allocating another.
+fuseBig :: [BC] -> [BC]
+fuseBig code = fuse [] code
+  where
+    once = usedOnce code
+
+    -- 'fresh' are the registers which an earlier instruction set to a newly
+    -- allocated Integer, and which are read only once
+    fuse fresh (OP t (LTimes (ATInt ITBig)) [x, y] : OP r op args : bc)
+        | once t, Just (ext, a) <- mulAdd op args
+            = fuse fresh (OP r (LExternal (sUN ext)) [a, x, y] : bc)
+      where
+        mulAdd (LPlus (ATInt ITBig)) [a, b]
+            | b == t = Just ("prim__bigMulAdd", a)
+            | a == t = Just ("prim__bigMulAdd", b)
+        mulAdd (LMinus (ATInt ITBig)) [a, b]
+            | b == t = Just ("prim__bigMulSub", a)
+        mulAdd _ _ = Nothing
+    fuse fresh (OP r op [x, y] : bc)
+        | Just ext <- into op, x `elem` fresh
+            = OP r (LExternal (sUN ext)) [x, y] : fuse (made r fresh) bc
+        | Just ext <- into op, commutes op, y `elem` fresh
+            = OP r (LExternal (sUN ext)) [y, x] : fuse (made r fresh) bc
+    fuse fresh (OP r op args : bc)
+        | bigResult op = OP r op args : fuse (made r fresh) bc
+    fuse fresh (CASE safe r alts def : bc)
+        = CASE safe r [(t, fuse fresh c) | (t, c) <- alts] (fmap (fuse fresh) def)
+              : fuse fresh bc
+    fuse fresh (CONSTCASE r alts def : bc)
+        = CONSTCASE r [(c, fuse fresh b) | (c, b) <- alts] (fmap (fuse fresh) def)
+              : fuse fresh bc
+    fuse fresh (i : bc) = i : fuse fresh bc
+    fuse _ [] = []
+
+    made r fresh | once r = r : fresh
+                 | otherwise = fresh
+
+    into (LPlus (ATInt ITBig)) = Just "prim__bigPlusInto"
+    into (LMinus (ATInt ITBig)) = Just "prim__bigMinusInto"
+    into (LTimes (ATInt ITBig)) = Just "prim__bigTimesInto"
+    into _ = Nothing
+
+    commutes (LMinus _) = False
+    commutes _ = True
+
+    -- Integer arithmetic always allocates its result (or makes it small)
+    bigResult (LPlus (ATInt ITBig)) = True
+    bigResult (LMinus (ATInt ITBig)) = True
+    bigResult (LTimes (ATInt ITBig)) = True
+    bigResult (LSDiv (ATInt ITBig)) = True
+    bigResult (LSRem (ATInt ITBig)) = True
+    bigResult (LExternal n) = n `elem` map sUN ["prim__bigMulAdd", "prim__bigMulSub"]
+    bigResult _ = False
+
+-- | Locals which the code of a function writes once and reads once, so that
+-- nothing else can see their values
+usedOnce :: [BC] -> Reg -> Bool
+usedOnce code = once
+  where
+    regs = concatMap bcRegs code
+
+    once r@(L _) = length (filter (== r) regs) == 2
+    once _ = False
+
+-- | Primitive values which can be kept unboxed, in C locals
+data Unboxed = UBits64 | UDouble
+  deriving Eq
+
+unboxedCType :: Unboxed -> String
+unboxedCType UBits64 = "uint64_t"
+unboxedCType UDouble = "double"
+
+unboxedLocal :: Unboxed -> Reg -> String
+unboxedLocal UBits64 (L i) = "b64_" ++ show i
+unboxedLocal UDouble (L i) = "fl_" ++ show i
+
+box :: Unboxed -> String -> String
+box UBits64 x = "MKB64(vm, " ++ x ++ ")"
+box UDouble x = "MKFLOAT(vm, " ++ x ++ ")"
+
+unbox :: Unboxed -> String -> String
+unbox UBits64 x = getBits IT64 x
+unbox UDouble x = "GETFLOAT(" ++ x ++ ")"
+
+-- | The locals holding Bits64 or Double results which are read only by a
+-- later Bits64 or Double operation in the same block, and so never escape
+-- to the heap. These are kept unboxed, in C locals (see unboxedLocal),
+-- instead of being allocated, so that a chain of arithmetic only boxes its
+-- final result.
+unboxedLocals :: [BC] -> [(Int, Unboxed)]
+unboxedLocals code = locals code
+  where
+    once = usedOnce code
+
+    locals (i : bc) = here i bc ++ nested i ++ locals bc
+    locals [] = []
+
+    here (OP t@(L k) op _) bc
+        | Just (_, Just ty, _) <- unboxedOp op, once t, any (readsUnboxed ty t) bc = [(k, ty)]
+    here (ASSIGNCONST t@(L k) (B64 _)) bc
+        | once t, any (readsUnboxed UBits64 t) bc = [(k, UBits64)]
+    here (ASSIGNCONST t@(L k) (Fl _)) bc
+        | once t, any (readsUnboxed UDouble t) bc = [(k, UDouble)]
+    here _ _ = []
+
+    nested (CASE _ _ alts def) = concatMap locals (map snd alts ++ maybe [] (: []) def)
+    nested (CONSTCASE _ alts def) = concatMap locals (map snd alts ++ maybe [] (: []) def)
+    nested _ = []
+
+    readsUnboxed ty t (OP _ op args)
+        | Just (tys, _, _) <- unboxedOp op = or [a == t | (a, Just ty') <- zip args tys, ty' == ty]
+    readsUnboxed _ _ _ = False
+
+unboxedType :: [(Int, Unboxed)] -> Reg -> Maybe Unboxed
+unboxedType u (L i) = lookup i u
+unboxedType _ _ = Nothing
+
+-- | Bits64 and Double operations as C expressions: which operands are
+-- given unboxed (as uint64_t or double), whether the result is unboxed
+-- or already a VAL, and the expression for the result
+unboxedOp :: PrimFn -> Maybe ([Maybe Unboxed], Maybe Unboxed, [String] -> String)
+unboxedOp (LPlus (ATInt (ITFixed IT64))) = b64Binary "+"
+unboxedOp (LMinus (ATInt (ITFixed IT64))) = b64Binary "-"
+unboxedOp (LTimes (ATInt (ITFixed IT64))) = b64Binary "*"
+unboxedOp (LUDiv (ITFixed IT64)) = b64Binary "/"
+unboxedOp (LSDiv (ATInt (ITFixed IT64))) = b64Signed "/"
+unboxedOp (LURem (ITFixed IT64)) = b64Binary "%"
+unboxedOp (LSRem (ATInt (ITFixed IT64))) = b64Signed "%"
+unboxedOp (LAnd (ITFixed IT64)) = b64Binary "&"
+unboxedOp (LOr (ITFixed IT64)) = b64Binary "|"
+unboxedOp (LXOr (ITFixed IT64)) = b64Binary "^"
+unboxedOp (LSHL (ITFixed IT64)) = b64Binary "<<"
+unboxedOp (LLSHR (ITFixed IT64)) = b64Binary ">>"
+unboxedOp (LASHR (ITFixed IT64)) = b64Signed ">>"
+unboxedOp (LCompl (ITFixed IT64)) = Just ([Just UBits64], Just UBits64, \[x] -> "(~" ++ x ++ ")")
+unboxedOp (LEq (ATInt (ITFixed IT64))) = compareOp UBits64 "=="
+unboxedOp (LLt (ITFixed IT64)) = compareOp UBits64 "<"
+unboxedOp (LLe (ITFixed IT64)) = compareOp UBits64 "<="
+unboxedOp (LGt (ITFixed IT64)) = compareOp UBits64 ">"
+unboxedOp (LGe (ITFixed IT64)) = compareOp UBits64 ">="
+unboxedOp (LZExt (ITFixed from) (ITFixed IT64)) | from /= IT64
+    = toUnboxed UBits64 (\x -> "(uint64_t)" ++ getBits from x)
+unboxedOp (LSExt (ITFixed from) (ITFixed IT64)) | from /= IT64
+    = toUnboxed UBits64 (\x -> "(uint64_t)(" ++ signedTy from ++ ")" ++ getBits from x)
+unboxedOp (LZExt ITNative (ITFixed IT64))
+    = toUnboxed UBits64 (\x -> "(uint64_t)(uintptr_t)GETINT(" ++ x ++ ")")
+unboxedOp (LSExt ITNative (ITFixed IT64))
+    = toUnboxed UBits64 (\x -> "(uint64_t)GETINT(" ++ x ++ ")")
+unboxedOp (LTrunc ITNative (ITFixed IT64))
+    = toUnboxed UBits64 (\x -> "(uint64_t)GETINT(" ++ x ++ ")")
+unboxedOp (LTrunc ITBig (ITFixed IT64))
+    = toUnboxed UBits64 (\x -> "(ISINT(" ++ x ++ ") ? (uint64_t)GETINT(" ++ x ++
+                               ") : idris_truncBigB64(GETMPZ(" ++ x ++ ")))")
+unboxedOp (LTrunc (ITFixed IT64) (ITFixed to)) | to /= IT64
+    = fromUnboxed UBits64 (\x -> "MKB" ++ show (nativeTyWidth to) ++ "(vm, " ++ x ++ ")")
+unboxedOp (LZExt (ITFixed IT64) ITNative)
+    = fromUnboxed UBits64 (\x -> "MKINT((i_int)" ++ x ++ ")")
+unboxedOp (LTrunc (ITFixed IT64) ITNative)
+    = fromUnboxed UBits64 (\x -> "MKINT((i_int)" ++ x ++ ")")
+unboxedOp (LSExt (ITFixed IT64) ITNative)
+    = fromUnboxed UBits64 (\x -> "MKINT((i_int)(int64_t)" ++ x ++ ")")
+unboxedOp (LZExt (ITFixed IT64) ITBig)
+    = fromUnboxed UBits64 (\x -> "MKBIGUI(vm, " ++ x ++ ")")
+unboxedOp (LSExt (ITFixed IT64) ITBig)
+    = fromUnboxed UBits64 (\x -> "MKBIGSI(vm, (int64_t)" ++ x ++ ")")
+
+unboxedOp (LPlus ATFloat) = flBinary "+"
+unboxedOp (LMinus ATFloat) = flBinary "-"
+unboxedOp (LTimes ATFloat) = flBinary "*"
+unboxedOp (LSDiv ATFloat) = flBinary "/"
+unboxedOp (LEq ATFloat) = compareOp UDouble "=="
+unboxedOp (LSLt ATFloat) = compareOp UDouble "<"
+unboxedOp (LSLe ATFloat) = compareOp UDouble "<="
+unboxedOp (LSGt ATFloat) = compareOp UDouble ">"
+unboxedOp (LSGe ATFloat) = compareOp UDouble ">="
+unboxedOp LFExp = flUnary "exp"
+unboxedOp LFLog = flUnary "log"
+unboxedOp LFSin = flUnary "sin"
+unboxedOp LFCos = flUnary "cos"
+unboxedOp LFTan = flUnary "tan"
+unboxedOp LFASin = flUnary "asin"
+unboxedOp LFACos = flUnary "acos"
+unboxedOp LFATan = flUnary "atan"
+unboxedOp LFSqrt = flUnary "sqrt"
+unboxedOp LFFloor = flUnary "floor"
+unboxedOp LFCeil = flUnary "ceil"
+unboxedOp LFNegate = flUnary "-"
+unboxedOp (LIntFloat ITNative)
+    = toUnboxed UDouble (\x -> "(double)GETINT(" ++ x ++ ")")
+unboxedOp (LFloatInt ITNative)
+    = fromUnboxed UDouble (\x -> "MKINT((i_int)" ++ x ++ ")")
+unboxedOp _ = Nothing
+
+b64Binary op = Just ([Just UBits64, Just UBits64], Just UBits64, \[x, y] ->
+                   "(" ++ x ++ " " ++ op ++ " " ++ y ++ ")")
+b64Signed op = Just ([Just UBits64, Just UBits64], Just UBits64, \[x, y] ->
+                   "(uint64_t)((int64_t)" ++ x ++ " " ++ op ++ " (int64_t)" ++ y ++ ")")
+flBinary op = Just ([Just UDouble, Just UDouble], Just UDouble, \[x, y] ->
+                  "(" ++ x ++ " " ++ op ++ " " ++ y ++ ")")
+flUnary f = Just ([Just UDouble], Just UDouble, \[x] -> f ++ "(" ++ x ++ ")")
+compareOp ty op = Just ([Just ty, Just ty], Nothing, \[x, y] ->
+                      "MKINT((i_int)(" ++ x ++ " " ++ op ++ " " ++ y ++ "))")
+toUnboxed ty f = Just ([Nothing], Just ty, \[x] -> f x)
+fromUnboxed ty f = Just ([Just ty], Nothing, \[x] -> f x)
+
+getBits :: NativeTy -> String -> String
+getBits ty x = "GETBITS" ++ show (nativeTyWidth ty) ++ "(" ++ x ++ ")"
+
+-- | Every register an instruction mentions, including those which
+-- PROJECT and SLIDE write to implicitly
+bcRegs :: BC -> [Reg]
+bcRegs (ASSIGN l r) = [l, r]
+bcRegs (ASSIGNCONST l _) = [l]
+bcRegs (UPDATE l r) = [l, r]
+bcRegs (MKCON l loc _ args) = l : maybe [] (: []) loc ++ args
+bcRegs (CASE _ r alts def) = r : concatMap (concatMap bcRegs) (map snd alts ++ maybe [] (: []) def)
+bcRegs (PROJECT r loc n) = r : map L [loc .. loc + n - 1]
+bcRegs (PROJECTINTO l r _) = [l, r]
+bcRegs (CONSTCASE r alts def) = r : concatMap (concatMap bcRegs) (map snd alts ++ maybe [] (: []) def)
+bcRegs (FOREIGNCALL l _ _ args) = l : map snd args
+bcRegs (SLIDE n) = map L [0 .. n - 1]
+bcRegs (OP l _ args) = l : args
+bcRegs (NULL r) = [r]
+bcRegs _ = []
 
 showCStr :: String -> String
 showCStr s = '"' : foldr ((++) . showChar) "\"" s
@@ -175,20 +451,24 @@ showCStr s = '"' : foldr ((++) . showChar) "\"" s
     showHexes = foldr ((++) . showUTF8) ""
     showUTF8 c = "\"\"\\x" ++ showHex c "\"\""
 
-bcc :: Int -> BC -> String
-bcc i (ASSIGN l r) = indent i ++ creg l ++ " = " ++ creg r ++ ";\n"
-bcc i (ASSIGNCONST l c)
+bcc :: [(Int, Unboxed)] -> Int -> BC -> String
+bcc u i (ASSIGN l r) = indent i ++ creg l ++ " = " ++ creg r ++ ";\n"
+bcc u i (ASSIGNCONST l (B64 x)) | Just ty <- unboxedType u l
+    = indent i ++ unboxedLocal ty l ++ " = " ++ show x ++ "ULL;\n"
+bcc u i (ASSIGNCONST l (Fl x)) | Just ty <- unboxedType u l
+    = indent i ++ unboxedLocal ty l ++ " = " ++ show x ++ ";\n"
+bcc u i (ASSIGNCONST l c)
     = indent i ++ creg l ++ " = " ++ mkConst c ++ ";\n"
   where
     mkConst (I i) = "MKINT(" ++ show i ++ ")"
-    mkConst (BI i) | i < (2^30) = "MKINT(" ++ show i ++ ")"
+    mkConst (BI i) | not (bigLit i) = "MKINT(" ++ show i ++ ")"
                    | otherwise = "MKBIGC(vm,\"" ++ show i ++ "\")"
     mkConst (Fl f) = "MKFLOAT(vm, " ++ show f ++ ")"
     mkConst (Ch c) = "MKINT(" ++ show (fromEnum c) ++ ")"
     mkConst (Str s) = "MKSTR(vm, " ++ showCStr s ++ ")"
-    mkConst (B8  x) = "idris_b8const(vm, "  ++ show x ++ "U)"
-    mkConst (B16 x) = "idris_b16const(vm, " ++ show x ++ "U)"
-    mkConst (B32 x) = "idris_b32const(vm, " ++ show x ++ "UL)"
+    mkConst (B8  x) = "MKB8(vm, "  ++ show x ++ "U)"
+    mkConst (B16 x) = "MKB16(vm, " ++ show x ++ "U)"
+    mkConst (B32 x) = "MKB32(vm, " ++ show x ++ "UL)"
     mkConst (B64 x) = "idris_b64const(vm, " ++ show x ++ "ULL)"
     -- if it's a type constant, we won't use it, but equally it shouldn't
     -- report an error. These might creep into generated for various reasons
@@ -196,10 +476,10 @@ bcc i (ASSIGNCONST l c)
     mkConst c | isTypeConst c = "MKINT(42424242)"
     mkConst c = error $ "mkConst of (" ++ show c ++ ") not implemented"
 
-bcc i (UPDATE l r) = indent i ++ creg l ++ " = " ++ creg r ++ ";\n"
-bcc i (MKCON l loc tag []) | tag < 256
+bcc u i (UPDATE l r) = indent i ++ creg l ++ " = " ++ creg r ++ ";\n"
+bcc u i (MKCON l loc tag []) | tag < 256
     = indent i ++ creg l ++ " = NULL_CON(" ++ show tag ++ ");\n"
-bcc i (MKCON l loc tag args)
+bcc u i (MKCON l loc tag args)
     = indent i ++ alloc loc tag ++
       indent i ++ setArgs 0 args ++ "\n" ++
       indent i ++ creg l ++ " = " ++ creg Tmp ++ ";\n"
@@ -217,15 +497,15 @@ bcc i (MKCON l loc tag args)
             = "updateCon(" ++ creg Tmp ++ ", " ++ creg old ++ ", " ++ show tag ++ ", " ++
                     show (length args) ++ ");\n"
 
-bcc i (PROJECT l loc a) = indent i ++ "PROJECT(vm, " ++ creg l ++ ", " ++ show loc ++
+bcc u i (PROJECT l loc a) = indent i ++ "PROJECT(vm, " ++ creg l ++ ", " ++ show loc ++
                                       ", " ++ show a ++ ");\n"
-bcc i (PROJECTINTO r t idx)
+bcc u i (PROJECTINTO r t idx)
     = indent i ++ creg r ++ " = GETARG(" ++ creg t ++ ", " ++ show idx ++ ");\n"
-bcc i (CASE True r code def)
+bcc u i (CASE True r code def)
     | length code < 4 = showCase i def code
   where
     showCode :: Int -> [BC] -> String
-    showCode i bc = "{\n" ++ concatMap (bcc (i + 1)) bc ++
+    showCode i bc = "{\n" ++ concatMap (bcc u (i + 1)) bc ++
                     indent i ++ "}\n"
 
     showCase :: Int -> Maybe [BC] -> [(Int, [BC])] -> String
@@ -235,7 +515,7 @@ bcc i (CASE True r code def)
         = indent i ++ "if (CTAG(" ++ creg r ++ ") == " ++ show t ++ ") " ++ showCode i c
            ++ indent i ++ "else\n" ++ showCase i def cs
 
-bcc i (CASE safe r code def)
+bcc u i (CASE safe r code def)
     = indent i ++ "switch(" ++ ctag safe ++ "(" ++ creg r ++ ")) {\n" ++
       concatMap (showCase i) code ++
       showDef i def ++
@@ -245,11 +525,11 @@ bcc i (CASE safe r code def)
     ctag False = "TAG"
 
     showCase i (t, bc) = indent i ++ "case " ++ show t ++ ":\n"
-                         ++ concatMap (bcc (i+1)) bc ++ indent (i + 1) ++ "break;\n"
+                         ++ concatMap (bcc u (i+1)) bc ++ indent (i + 1) ++ "break;\n"
     showDef i Nothing = ""
     showDef i (Just c) = indent i ++ "default:\n"
-                         ++ concatMap (bcc (i+1)) c ++ indent (i + 1) ++ "break;\n"
-bcc i (CONSTCASE r code def)
+                         ++ concatMap (bcc u (i+1)) c ++ indent (i + 1) ++ "break;\n"
+bcc u i (CONSTCASE r code def)
    | intConsts code
 --      = indent i ++ "switch(GETINT(" ++ creg r ++ ")) {\n" ++
 --        concatMap (showCase i) code ++
@@ -281,67 +561,78 @@ bcc i (CONSTCASE r code def)
 
     strCase sv (s, bc) =
         indent i ++ "if (strcmp(" ++ sv ++ ", " ++ show s ++ ") == 0) {\n" ++
-           concatMap (bcc (i+1)) bc ++ indent i ++ "} else\n"
+           concatMap (bcc u (i+1)) bc ++ indent i ++ "} else\n"
     biCase bv (BI b, bc) =
         indent i ++ "if (bigEqConst(" ++ bv ++ ", " ++ show b ++ ")) {\n"
-           ++ concatMap (bcc (i+1)) bc ++ indent i ++ "} else\n"
+           ++ concatMap (bcc u (i+1)) bc ++ indent i ++ "} else\n"
     iCase v (I b, bc) =
         indent i ++ "if (GETINT(" ++ v ++ ") == " ++ show b ++ ") {\n"
-           ++ concatMap (bcc (i+1)) bc ++ indent i ++ "} else\n"
+           ++ concatMap (bcc u (i+1)) bc ++ indent i ++ "} else\n"
     iCase v (Ch b, bc) =
         indent i ++ "if (GETINT(" ++ v ++ ") == " ++ show (fromEnum b) ++ ") {\n"
-           ++ concatMap (bcc (i+1)) bc ++ indent i ++ "} else\n"
+           ++ concatMap (bcc u (i+1)) bc ++ indent i ++ "} else\n"
     iCase v (B8 w, bc) =
         indent i ++ "if (GETBITS8(" ++ v ++ ") == " ++ show (fromEnum w) ++ ") {\n"
-           ++ concatMap (bcc (i+1)) bc ++ indent i ++ "} else\n"
+           ++ concatMap (bcc u (i+1)) bc ++ indent i ++ "} else\n"
     iCase v (B16 w, bc) =
         indent i ++ "if (GETBITS16(" ++ v ++ ") == " ++ show (fromEnum w) ++ ") {\n"
-           ++ concatMap (bcc (i+1)) bc ++ indent i ++ "} else\n"
+           ++ concatMap (bcc u (i+1)) bc ++ indent i ++ "} else\n"
     iCase v (B32 w, bc) =
         indent i ++ "if (GETBITS32(" ++ v ++ ") == " ++ show (fromEnum w) ++ ") {\n"
-           ++ concatMap (bcc (i+1)) bc ++ indent i ++ "} else\n"
+           ++ concatMap (bcc u (i+1)) bc ++ indent i ++ "} else\n"
     iCase v (B64 w, bc) =
         indent i ++ "if (GETBITS64(" ++ v ++ ") == " ++ show (fromEnum w) ++ ") {\n"
-           ++ concatMap (bcc (i+1)) bc ++ indent i ++ "} else\n"
+           ++ concatMap (bcc u (i+1)) bc ++ indent i ++ "} else\n"
     showCase i (t, bc) = indent i ++ "case " ++ show t ++ ":\n"
-                         ++ concatMap (bcc (i+1)) bc ++
+                         ++ concatMap (bcc u (i+1)) bc ++
                             indent (i + 1) ++ "break;\n"
     showDef i Nothing = ""
     showDef i (Just c) = indent i ++ "default:\n"
-                         ++ concatMap (bcc (i+1)) c ++
+                         ++ concatMap (bcc u (i+1)) c ++
                             indent (i + 1) ++ "break;\n"
     showDefS i Nothing = ""
-    showDefS i (Just c) = concatMap (bcc (i+1)) c
-
-bcc i (CALL n) = indent i ++ "CALL(" ++ cname n ++ ");\n"
-bcc i (TAILCALL n) = indent i ++ "TAILCALL(" ++ cname n ++ ");\n"
-bcc i (SLIDE n) = indent i ++ "SLIDE(vm, " ++ show n ++ ");\n"
-bcc i REBASE = indent i ++ "REBASE;\n"
-bcc i (RESERVE 0) = ""
-bcc i (RESERVE n) = indent i ++ "RESERVE(" ++ show n ++ ");\n"
-bcc i (ADDTOP 0) = ""
-bcc i (ADDTOP n) = indent i ++ "ADDTOP(" ++ show n ++ ");\n"
-bcc i (TOPBASE n) = indent i ++ "TOPBASE(" ++ show n ++ ");\n"
-bcc i (BASETOP n) = indent i ++ "BASETOP(" ++ show n ++ ");\n"
-bcc i STOREOLD = indent i ++ "STOREOLD;\n"
-bcc i (OP l fn args) = indent i ++ doOp (creg l ++ " = ") fn args ++ ";\n"
-bcc i (FOREIGNCALL l rty (FStr fn@('&':name)) [])
+    showDefS i (Just c) = concatMap (bcc u (i+1)) c
+
+bcc u i (CALL n) = indent i ++ "CALL(" ++ cname n ++ ");\n"
+bcc u i (TAILCALL n) = indent i ++ "TAILCALL(" ++ cname n ++ ");\n"
+bcc u i (SLIDE n) = indent i ++ "SLIDE(vm, " ++ show n ++ ");\n"
+bcc u i REBASE = indent i ++ "REBASE;\n"
+bcc u i (RESERVE 0) = ""
+bcc u i (RESERVE n) = indent i ++ "RESERVE(" ++ show n ++ ");\n"
+bcc u i (ADDTOP 0) = ""
+bcc u i (ADDTOP n) = indent i ++ "ADDTOP(" ++ show n ++ ");\n"
+bcc u i (TOPBASE n) = indent i ++ "TOPBASE(" ++ show n ++ ");\n"
+bcc u i (BASETOP n) = indent i ++ "BASETOP(" ++ show n ++ ");\n"
+bcc u i STOREOLD = indent i ++ "STOREOLD;\n"
+bcc u i (OP l fn args)
+    | Just (tys, rty, expr) <- unboxedOp fn, any (isJust . unboxedType u) (l : args)
+        = indent i ++ result rty (expr (zipWith arg tys args)) ++ ";\n"
+  where
+    arg (Just ty) a | isJust (unboxedType u a) = unboxedLocal ty a
+                    | otherwise = unbox ty (creg a)
+    arg Nothing a = creg a
+
+    result (Just ty) e | isJust (unboxedType u l) = unboxedLocal ty l ++ " = " ++ e
+                       | otherwise = creg l ++ " = " ++ box ty e
+    result Nothing e = creg l ++ " = " ++ e
+bcc u i (OP l fn args) = indent i ++ doOp (creg l ++ " = ") fn args ++ ";\n"
+bcc u i (FOREIGNCALL l rty (FStr fn@('&':name)) [])
       = indent i ++
         c_irts (toFType rty) (creg l ++ " = ") fn ++ ";\n"
-bcc i (FOREIGNCALL l rty (FStr fn) (x:xs)) | fn == "%wrapper"
+bcc u i (FOREIGNCALL l rty (FStr fn) (x:xs)) | fn == "%wrapper"
       = indent i ++
         c_irts (toFType rty) (creg l ++ " = ")
             ("_idris_get_wrapper(" ++ creg (snd x) ++ ")") ++ ";\n"
-bcc i (FOREIGNCALL l rty (FStr fn) (x:xs)) | fn == "%dynamic"
+bcc u i (FOREIGNCALL l rty (FStr fn) (x:xs)) | fn == "%dynamic"
       = indent i ++ c_irts (toFType rty) (creg l ++ " = ")
             ("(*(" ++ cFnSig "" rty xs ++ ") GETPTR(" ++ creg (snd x) ++ "))" ++
              "(" ++ showSep "," (map fcall xs) ++ ")") ++ ";\n"
-bcc i (FOREIGNCALL l rty (FStr fn) args)
+bcc u i (FOREIGNCALL l rty (FStr fn) args)
       = indent i ++
         c_irts (toFType rty) (creg l ++ " = ")
                    (fn ++ "(" ++ showSep "," (map fcall args) ++ ")") ++ ";\n"
-bcc i (NULL r) = indent i ++ creg r ++ " = NULL;\n" -- clear, so it'll be GCed
-bcc i (ERROR str) = indent i ++ "fprintf(stderr, " ++ show str ++ "); fprintf(stderr, \"\\n\"); exit(-1);\n"
+bcc u i (NULL r) = indent i ++ creg r ++ " = NULL;\n" -- clear, so it'll be GCed
+bcc u i (ERROR str) = indent i ++ "fprintf(stderr, " ++ show str ++ "); fprintf(stderr, \"\\n\"); exit(-1);\n"
 -- bcc i c = error (show c) -- indent i ++ "// not done yet\n"
 
 fcall (t, arg) = irts_c (toFType t) (creg arg)
@@ -394,7 +685,7 @@ c_irts FFunctionIO l x = error "Return of function from foreign call is not supp
 irts_c (FArith (ATInt ITNative)) x = "GETINT(" ++ x ++ ")"
 irts_c (FArith (ATInt ITChar)) x = irts_c (FArith (ATInt ITNative)) x
 irts_c (FArith (ATInt (ITFixed ity))) x
-    = "(" ++ x ++ "->info.bits" ++ show (nativeTyWidth ity) ++ ")"
+    = getBits ity x
 irts_c FString x = "GETSTR(" ++ x ++ ")"
 irts_c FUnit x = x
 irts_c FPtr x = "GETPTR(" ++ x ++ ")"
@@ -534,13 +825,13 @@ doOp v (LURem (ITFixed ty)) [x, y] = bitOp v "URem" ty [x, y]
 doOp v (LSRem (ATInt (ITFixed ty))) [x, y] = bitOp v "SRem" ty [x, y]
 
 doOp v (LSExt (ITFixed from) ITBig) [x]
-    = v ++ "MKBIGSI(vm, (" ++ signedTy from ++ ")" ++ creg x ++ "->info.bits" ++ show (nativeTyWidth from) ++ ")"
+    = v ++ "MKBIGSI(vm, (" ++ signedTy from ++ ")" ++ getBits from (creg x) ++ ")"
 doOp v (LSExt ITNative (ITFixed to)) [x]
     = v ++ "idris_b" ++ show (nativeTyWidth to) ++ "const(vm, GETINT(" ++ creg x ++ "))"
 doOp v (LSExt ITChar (ITFixed to)) [x]
     = doOp v (LSExt ITNative (ITFixed to)) [x]
 doOp v (LSExt (ITFixed from) ITNative) [x]
-    = v ++ "MKINT((i_int)((" ++ signedTy from ++ ")" ++ creg x ++ "->info.bits" ++ show (nativeTyWidth from) ++ "))"
+    = v ++ "MKINT((i_int)((" ++ signedTy from ++ ")" ++ getBits from (creg x) ++ "))"
 doOp v (LSExt (ITFixed from) ITChar) [x]
     = doOp v (LSExt (ITFixed from) ITNative) [x]
 doOp v (LSExt (ITFixed from) (ITFixed to)) [x]
@@ -550,11 +841,11 @@ doOp v (LZExt ITNative (ITFixed to)) [x]
 doOp v (LZExt ITChar (ITFixed to)) [x]
     = doOp v (LZExt ITNative (ITFixed to)) [x]
 doOp v (LZExt (ITFixed from) ITNative) [x]
-    = v ++ "MKINT((i_int)" ++ creg x ++ "->info.bits" ++ show (nativeTyWidth from) ++ ")"
+    = v ++ "MKINT((i_int)" ++ getBits from (creg x) ++ ")"
 doOp v (LZExt (ITFixed from) ITChar) [x]
     = doOp v (LZExt (ITFixed from) ITNative) [x]
 doOp v (LZExt (ITFixed from) ITBig) [x]
-    = v ++ "MKBIGUI(vm, " ++ creg x ++ "->info.bits" ++ show (nativeTyWidth from) ++ ")"
+    = v ++ "MKBIGUI(vm, " ++ getBits from (creg x) ++ ")"
 doOp v (LZExt ITNative ITBig) [x]
     = v ++ "MKBIGUI(vm, (uintptr_t)GETINT(" ++ creg x ++ "))"
 doOp v (LZExt (ITFixed from) (ITFixed to)) [x]
@@ -564,7 +855,7 @@ doOp v (LTrunc ITNative (ITFixed to)) [x]
 doOp v (LTrunc ITChar (ITFixed to)) [x]
     = doOp v (LTrunc ITNative (ITFixed to)) [x]
 doOp v (LTrunc (ITFixed from) ITNative) [x]
-    = v ++ "MKINT((i_int)" ++ creg x ++ "->info.bits" ++ show (nativeTyWidth from) ++ ")"
+    = v ++ "MKINT((i_int)" ++ getBits from (creg x) ++ ")"
 doOp v (LTrunc (ITFixed from) ITChar) [x]
     = doOp v (LTrunc (ITFixed from) ITNative) [x]
 doOp v (LTrunc ITBig (ITFixed IT64)) [x]
@@ -627,6 +918,19 @@ doOp v (LExternal wf) [_,x,s]
        = v ++ "MKINT((i_int)(idris_writeStr(GETPTR(" ++ creg x
                               ++ "),GETSTR("
                               ++ creg s ++ "))))"
+-- Fused Integer arithmetic (see fuseBig)
+doOp v (LExternal ma) [a, x, y] | ma == sUN "prim__bigMulAdd"
+    = v ++ "idris_bigMulAdd(vm, " ++ creg a ++ ", " ++ creg x ++ ", " ++ creg y ++ ")"
+doOp v (LExternal ms) [a, x, y] | ms == sUN "prim__bigMulSub"
+    = v ++ "idris_bigMulSub(vm, " ++ creg a ++ ", " ++ creg x ++ ", " ++ creg y ++ ")"
+doOp v (LExternal pl) [acc, y] | pl == sUN "prim__bigPlusInto"
+    = v ++ "idris_bigPlusInto(vm, " ++ creg acc ++ ", " ++ creg y ++ ")"
+doOp v (LExternal mi) [acc, y] | mi == sUN "prim__bigMinusInto"
+    = v ++ "idris_bigMinusInto(vm, " ++ creg acc ++ ", " ++ creg y ++ ")"
+doOp v (LExternal ti) [acc, y] | ti == sUN "prim__bigTimesInto"
+    = v ++ "idris_bigTimesInto(vm, " ++ creg acc ++ ", " ++ creg y ++ ")"
+doOp v (LExternal n@(MN k _)) [] | n == sMN k "bigconst"
+    = v ++ "idris_bigconsts[" ++ show k ++ "]"
 doOp v (LExternal vm) [] | vm == sUN "prim__vm" = v ++ "MKPTR(vm, vm)"
 doOp v (LExternal si) [] | si == sUN "prim__stdin" = v ++ "MKPTR(vm, stdin)"
 doOp v (LExternal so) [] | so == sUN "prim__stdout" = v ++ "MKPTR(vm, stdout)"
@@ -0,0 +1,85 @@
+// Ropes flattened while the heap is full are put outside it, and copied
+// into the heap by the next full collection, which must leave room for
+// them. Builds that situation under each kind of collector.
+#include "idris_rts.h"
+#include "idris_gc.h"
+#include "idris_gmp.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PUSH(x) (*vm->valstack_top++ = (x))
+#define POP() (*--vm->valstack_top)
+#define LEN 40000
+
+static int check(VAL s, char first, char second) {
+    char* c = GETSTR(s);
+    size_t i;
+    if (strlen(c) != 2 * LEN) {
+        return 0;
+    }
+    for (i = 0; i < LEN; ++i) {
+        if (c[i] != first || c[LEN + i] != second) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Use up the free space (the nursery, if there is one)
+static void fill(VM* vm) {
+    VAL j;
+    while (vm->heap.next + 4096 < vm->heap.end) {
+        allocCon(j, vm, 1, 0, 0);
+    }
+}
+
+static void run(const char* name, int nursery, int threads) {
+    VM* vm = init_vm(4096000, 100000, 0);
+    init_threaddata(vm);
+    if (nursery) {
+        alloc_nursery(&vm->heap, 65536);
+    }
+    vm->gc_threads = threads;
+
+    char* buf = malloc(LEN + 1);
+    memset(buf, 'a', LEN);
+    buf[LEN] = '\0';
+    PUSH(MKSTR(vm, buf));
+    memset(buf, 'b', LEN);
+    PUSH(MKSTR(vm, buf));
+    free(buf);
+
+    VAL a = vm->valstack_top[-2];
+    VAL b = vm->valstack_top[-1];
+    PUSH(idris_concat(vm, a, b));
+    a = vm->valstack_top[-3];
+    b = vm->valstack_top[-2];
+    PUSH(idris_concat(vm, b, a));
+
+    // Flatten both ropes; there is no room left for them in the heap
+    fill(vm);
+    VAL ab = vm->valstack_top[-2];
+    VAL ba = vm->valstack_top[-1];
+    GETSTR(ab);
+    GETSTR(ba);
+    int spilled = vm->spill != NULL;
+
+    idris_gc(vm);
+    ba = POP();
+    ab = POP();
+    int ok = check(ab, 'a', 'b') && check(ba, 'b', 'a');
+
+    printf("%s: %s%s\n", name, ok ? "ok" : "wrong", spilled ? "" : " (no spill)");
+    terminate(vm);
+}
+
+int main(void) {
+    init_threadkeys();
+    init_gmpalloc();
+    init_nullaries();
+    run("semispace", 0, 1);
+    run("generational", 1, 1);
+    run("parallel", 0, 4);
+    return 0;
+}
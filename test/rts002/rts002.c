@@ -0,0 +1,89 @@
+// A view which is not a tail of its string is copied out when C needs its
+// characters, and if the heap is full the copy goes outside it. The next
+// full collection copies it into the heap, and must leave room for it.
+// Builds that situation under each kind of collector.
+#include "idris_rts.h"
+#include "idris_gc.h"
+#include "idris_gmp.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PUSH(x) (*vm->valstack_top++ = (x))
+#define POP() (*--vm->valstack_top)
+#define LEN 40000
+
+// The characters of each string follow the alphabet, from 'first'
+static int check(VAL s, size_t len, char first) {
+    char* c = GETSTR(s);
+    size_t i;
+    if (strlen(c) != len) {
+        return 0;
+    }
+    for (i = 0; i < len; ++i) {
+        if (c[i] != 'a' + (first - 'a' + i) % 26) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Use up the free space (the nursery, if there is one)
+static void fill(VM* vm) {
+    VAL j;
+    while (vm->heap.next + 4096 < vm->heap.end) {
+        allocCon(j, vm, 1, 0, 0);
+    }
+}
+
+static void run(const char* name, int nursery, int threads) {
+    VM* vm = init_vm(4096000, 100000, 0);
+    init_threaddata(vm);
+    if (nursery) {
+        alloc_nursery(&vm->heap, 65536);
+    }
+    vm->gc_threads = threads;
+
+    char* buf = malloc(LEN + 1);
+    size_t i;
+    for (i = 0; i < LEN; ++i) {
+        buf[i] = 'a' + i % 26;
+    }
+    buf[LEN] = '\0';
+    PUSH(MKSTR(vm, buf));
+    PUSH(MKSTR(vm, buf));
+    free(buf);
+
+    // Views of all but the ends of each string
+    PUSH(idris_substr(vm, MKINT(2), MKINT(LEN - 4), vm->valstack_top[-2]));
+    PUSH(idris_substr(vm, MKINT(1), MKINT(LEN - 2), vm->valstack_top[-2]));
+
+    // Copy both out; there is no room left for them in the heap
+    fill(vm);
+    VAL v1 = vm->valstack_top[-2];
+    VAL v2 = vm->valstack_top[-1];
+    GETSTR(v1);
+    GETSTR(v2);
+    int spilled = vm->spill != NULL;
+
+    idris_gc(vm);
+    idris_gc(vm);
+    v2 = POP();
+    v1 = POP();
+    int ok = GETTY(v1) == CT_STROFFSET && GETTY(v2) == CT_STROFFSET &&
+             check(v1, LEN - 4, 'c') && check(v2, LEN - 2, 'b') &&
+             check(POP(), LEN, 'a') && check(POP(), LEN, 'a');
+
+    printf("%s: %s%s\n", name, ok ? "ok" : "wrong", spilled ? "" : " (no spill)");
+    terminate(vm);
+}
+
+int main(void) {
+    init_threadkeys();
+    init_gmpalloc();
+    init_nullaries();
+    run("semispace", 0, 1);
+    run("generational", 1, 1);
+    run("parallel", 0, 4);
+    return 0;
+}